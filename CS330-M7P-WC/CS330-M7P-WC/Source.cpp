@@ -1,5 +1,12 @@
 #include <iostream>					// cout, cerr
 #include <cstdlib>					// EXIT_FAILURE
+#include <cstring>					// strcmp
+#include <cmath>					// sin, cos, atan2, asin
+#include <cfloat>					// FLT_MAX
+#include <chrono>					// steady_clock
+#include <fstream>					// ofstream
+#include <memory>					// unique_ptr
+#include <vector>					// vector
 #include <GL/glew.h>				// GLEW library
 #include <GLFW/glfw3.h>				// GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -7,15 +14,35 @@
 #include <glm/glm.hpp>				// GLM Math Header inclusions
 #include <glm/gtx/transform.hpp>	// GLM Math Header inclusions
 #include <glm/gtc/type_ptr.hpp>		// GLM Math Header inclusions
+#include <glm/gtc/constants.hpp>	// GLM Math Header inclusions
 #include "camera.h"					// Camera class
+#include "benchmark.h"				// FrameStats class
+#include "shader_program.h"			// ShaderProgram class
+#include "program_cache.h"			// ProgramCache class
+#include "shader_reloader.h"		// ShaderReloader class
+#include "mesh_builder.h"			// MeshBuilder class
+#include "model_loader.h"			// ModelLoader class
+#include "mesh_cache.h"				// MeshCache class
+#include "texture_loader.h"			// TextureLoader class
+#include "image_kernels.h"			// ImageKernels
+#include "block_compressor.h"		// BlockCompressor class
+#include "ktx_texture.h"			// Ktx2Texture class
+#include "mip_cache.h"				// MipCache class
+#include "texture_residency.h"		// TextureResidency class
+#include "transform_system.h"		// TransformSystem class
+#include "instance_buffer.h"			// InstanceBuffer class
+#include "mesh_pool.h"				// MeshPool class
+#include "indirect_draws.h"			// IndirectDrawList class
+#include "frustum_culler.h"			// FrustumCuller class
+#include "bvh.h"					// SceneBvh and MeshBvh classes
+#include "gpu_culler.h"				// GpuCuller class
+#include "depth_pyramid.h"			// DepthPyramid class
+#include "render_queue.h"			// RenderQueue class
+#include "gl_state_cache.h"			// GLStateCache class
+#include "worker_pool.h"			// WorkerPool class
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace {
 	const char* const WINDOW_TITLE = "CS330-M7P-WC"; // Macro for window title
@@ -27,25 +54,104 @@ namespace {
 	// Stores the GL data relative to a given mesh
 	struct GLMesh {
 		GLuint vao;         // Handle for the vertex array object
-		GLuint vbo;         // Handle for the vertex buffer object
-		GLuint nVertices;    // Number of indices of the mesh
+		GLuint vbos[2];     // Handles for the vertex buffer object and the index buffer object
+		GLuint nIndices;    // Number of indices of the mesh
+		GLenum indexType;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, whichever fits the vertex count
+		glm::vec3 center;   // Bounding sphere in model space (radius 0 when the bounds are unknown)
+		float radius;
+		glm::vec3 extents;  // Half size of the axis-aligned bounding box around center
 	};
 
+	// Vertex layout of every mesh: position (location 0, 3 floats), texture coordinate (location 2, 2 floats)
+	// and texture array layer (location 3, 1 float)
+	const MeshCacheLayout MESH_LAYOUT = { 3, { 0, 2, 3 }, { 3, 2, 1 } };
+
 	// Main GLFW window
 	GLFWwindow* gWindow = nullptr;
 	// Triangle mesh data
 	GLMesh gMesh;
-	// Texture id
-	GLuint gTextureId;
-	unsigned int tex0;
-	unsigned int tex1;
-	unsigned int tex2;
+	// Streams texture mip levels in and out of video memory under a budget (--texture-budget MB)
+	const size_t TEXTURE_BUDGET_DEFAULT_MB = 256;
+	TextureResidency gTextureResidency(TEXTURE_BUDGET_DEFAULT_MB * 1024 * 1024);
+	// Handle of the 2D texture array holding every material (one layer each)
+	TextureResidency::Handle gTextureArray;
 
 	//TODO
 	// Shader program
-	GLuint gProgramId;
-	GLuint gCubeProgramId;
-	GLuint gLampProgramId;
+	ShaderProgram gProgram;
+	ShaderProgram gCubeProgram;
+	ShaderProgram gLampProgram;
+	ShaderProgram gInstancedProgram;
+	ShaderProgram gIndirectProgram;
+	ShaderProgram gCullProgram;
+	ShaderProgram gHizProgram;
+
+	// One program of a UCreateShaderPrograms batch
+	struct ShaderProgramSource {
+		const char* vertexSource;
+		const char* fragmentSource;
+		ShaderProgram* program;     // receives the linked program
+	};
+
+	// GLSL files of every program
+	struct ShaderProgramFiles {
+		const char* vertexPath;
+		const char* fragmentPath;
+		ShaderProgram* program;
+	};
+	const ShaderProgramFiles SHADER_PROGRAM_FILES[] = {
+		{ "../resources/shaders/textured.vert", "../resources/shaders/textured.frag", &gProgram },
+		{ "../resources/shaders/cube.vert", "../resources/shaders/cube.frag", &gCubeProgram },
+		{ "../resources/shaders/lamp.vert", "../resources/shaders/lamp.frag", &gLampProgram },
+		{ "../resources/shaders/instanced.vert", "../resources/shaders/instanced.frag", &gInstancedProgram },
+		{ "../resources/shaders/indirect.vert", "../resources/shaders/instanced.frag", &gIndirectProgram }
+	};
+	const int SHADER_PROGRAM_COUNT = sizeof(SHADER_PROGRAM_FILES) / sizeof(SHADER_PROGRAM_FILES[0]);
+
+	// GLSL files of the compute programs (built on their own, not cached or hot reloaded)
+	struct ComputeProgramFile {
+		const char* path;
+		ShaderProgram* program;
+	};
+	const ComputeProgramFile COMPUTE_PROGRAM_FILES[] = {
+		{ "../resources/shaders/cull.comp", &gCullProgram },
+		{ "../resources/shaders/hiz.comp", &gHizProgram }
+	};
+	const int COMPUTE_PROGRAM_COUNT = sizeof(COMPUTE_PROGRAM_FILES) / sizeof(COMPUTE_PROGRAM_FILES[0]);
+
+	// shader hot reload: edited GLSL files are rebuilt in the background and swapped in between frames
+	// (interactive runs only, --no-hot-reload disables)
+	bool gHotReloadEnabled = true;
+	GLFWwindow* gReloadContext = nullptr;	// hidden window whose context shares objects with gWindow
+	ShaderReloader gShaderReloader;
+
+	// Typed uniform handles, resolved once after the programs are linked
+	Uniform<glm::mat4> gMvpUniform;
+	Uniform<glm::mat4> gCubeModelUniform;
+	Uniform<glm::mat4> gCubeMvpUniform;
+	Uniform<glm::mat3> gCubeNormalUniform;
+	Uniform<glm::vec3> gObjectColorUniform;
+	Uniform<glm::vec3> gLightColorUniform;
+	Uniform<glm::vec3> gLightPositionUniform;
+	Uniform<glm::mat4> gLampMvpUniform;
+	Uniform<int> gCullPhaseUniform;
+	Uniform<int> gHizLevelUniform;
+
+	// Linked program binaries from earlier runs (--no-program-cache disables)
+	bool gProgramCacheEnabled = true;
+	ProgramCache gProgramCache("shader_cache");
+
+	// Camera uniform block shared by every program, updated once per frame (layout matches the std140 CameraBlock
+	// of resources/shaders/camera.glsl, which every shader includes)
+	struct CameraBlock {
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::mat4 viewProjection;
+		glm::vec4 cameraPosition;
+		glm::vec4 frustumPlanes[6];		// see Camera::GetFrustumPlanes
+	};
+	const GLuint CAMERA_BLOCK_BINDING = 0;
+	GLuint gCameraUbo = 0;
 
 	// camera
 	Camera gCamera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -62,6 +168,121 @@ namespace {
 	glm::vec3 gLightColor(1.0f, 1.0f, 1.0f);
 	glm::vec3 gLightPosition(-2.5f, 5.0f, 0.0f);
 	glm::vec3 gLightScale(0.3f);
+
+	// Object transforms: world, normal and MVP matrices are recomputed in SIMD batches, and only when something changed
+	TransformSystem gTransforms;
+	TransformSystem::Handle gMeshTransform;
+	TransformSystem::Handle gLampTransform;
+
+	// frustum culling (--no-culling disables): objects outside the view are not drawn
+	bool gCullingEnabled = true;
+	FrustumCuller gCuller;
+
+	// stress scene (--stress N): N more USB drives on a grid, drawn with a single instanced call
+	int gStressCount = 0;
+	bool gStressInstancing = true;			// --no-instancing draws them with one call each, for comparison
+	TransformSystem::Handle gStressFirstTransform = 0;
+	InstanceBuffer gStressInstances;
+	const float STRESS_SPACING = 1.5f;		// distance between neighbouring drives
+
+	// multi-draw scene (--mdi-scene N): N objects cycling through the parts of the built-in mesh, pooled in one
+	// vertex array and submitted with a single glMultiDrawElementsIndirect call
+	int gMdiCount = 0;
+	bool gMdiEnabled = true;				// --no-mdi issues one draw call per object instead, for comparison
+	TransformSystem::Handle gMdiFirstTransform = 0;
+	GLMesh gPoolMesh;
+	IndirectDrawList gMdiDraws;
+
+	// GPU culling of the multi-draw scene (--gpu-culling): a compute pass compacts the visible commands and the
+	// draw reads their count from a GPU buffer, so visibility never comes back to the CPU (except the counter,
+	// read by --benchmark for its statistics)
+	bool gGpuCulling = false;
+	bool gIndirectCount = false;			// glMultiDrawElementsIndirectCount is available (ARB_indirect_parameters)
+	GpuCuller gMdiCuller;
+	GLuint gGpuVisibleCount = 0;			// last counter readback
+
+	// Hierarchical-Z occlusion culling (--hiz, implies --gpu-culling), in two passes: the early one draws the draws
+	// the last occlusion test found visible, their depth (with the rest of the frame's) is reduced into a pyramid of
+	// farthest depths, and the late one draws the draws that pyramid does not hide and the early one left out
+	bool gOcclusionCulling = false;
+	bool gOcclusionThisFrame = false;		// --benchmark turns it off every other frame to time the frames without it
+	DepthPyramid gDepthPyramid;
+	GLuint gGpuOccludedCount = 0;			// last counter readback of a frame with occlusion culling
+
+	// Draws of the current frame, recorded as they are culled and replayed sorted by state and depth; the
+	// replay binds through a shadow of the GL state, so it only issues the binds that change something
+	RenderQueue gRenderQueue;
+	GLStateCache gStateCache;
+	const float CAMERA_NEAR_PLANE = 0.1f;
+	const float CAMERA_FAR_PLANE = 100.0f;	// far plane of the view projection, the depth range of the sort keys
+
+	// Per-object work of a frame (matrices, culling, per-draw data and per-object draws), split across worker
+	// threads (--threads N, 0 for one per hardware thread, 1 to run it all on the main thread)
+	unsigned int gWorkerThreads = 0;
+	WorkerPool gWorkers;
+	// What one worker produced this frame
+	struct ObjectWorker {
+		size_t worlds;		// objects whose world matrix / MVP it recomputed
+		size_t mvps;
+		size_t visible;		// objects of its batches that passed the frustum test
+		RenderQueue queue;	// its per-object draws, appended to gRenderQueue in worker order
+	};
+	vector<ObjectWorker> gObjectWorkers;	// one per worker
+	double gObjectMs = 0.0;					// time the current frame spent on the per-object work (recorded by --benchmark)
+
+	// BVH over every object's world box, refitted when objects move; left clicks cast a ray through it (picking)
+	SceneBvh gSceneBvh;
+	// --bvh-cull: frustum cull through the tree's query instead of the linear SIMD test of every object
+	bool gBvhCulling = false;
+	vector<TransformSystem::Handle> gBvhVisible;
+	MeshBvh gMeshBvh;						// triangles of gMesh (empty for streamed models, whose vertices never reach the CPU)
+	MeshCache gMeshBvhSource;				// .mesh file gMeshBvh is built from on the first pick, so cached startups skip the build
+	bool gMeshBvhPending = false;
+	vector<MeshBvh> gPoolBvhs;				// triangles of the multi-draw scene's pool meshes
+	// draw calls issued by the current frame (recorded by --benchmark)
+	unsigned int gDrawCalls = 0;
+
+	// headless rendering (--headless [--frames N] [--output file.ppm])
+	bool gHeadless = false;					// render into an offscreen framebuffer instead of a visible window
+	int gMaxFrames = 100;					// number of frames rendered before a headless or benchmark run exits
+	const char* gHeadlessOutput = nullptr;	// optional PPM dump of the last rendered frame
+	GLuint gOffscreenFbo = 0;				// Handle for the offscreen framebuffer object
+	GLuint gOffscreenRbos[2];				// Handles for the color and depth renderbuffers
+
+	// benchmarking (--benchmark [--frames N] [--json file.json])
+	bool gBenchmark = false;				// drive the camera along a scripted path and time every frame
+	const char* gBenchmarkJson = nullptr;	// optional file for the JSON report (stdout otherwise)
+	const int BENCHMARK_WARMUP_FRAMES = 10;	// frames rendered before any timing is recorded
+	const float BENCHMARK_FRAME_STEP = 1.0f / 60.0f; // fixed delta time so every run is identical
+	const int TIMER_QUERY_COUNT = 4;		// GPU timer queries in flight, read back a few frames late to avoid stalls
+	GLuint gTimerQueries[TIMER_QUERY_COUNT];
+	int gTimerQueryFrames[TIMER_QUERY_COUNT];
+	FrameStats gFrameStats;
+
+	// model loading (--model file.obj|.gltf|.glb, --bench-loader file)
+	const char* gModelPath = nullptr;		// replaces the built-in USB mesh when set
+	const char* gLoaderBenchmarkPath = nullptr; // times ModelLoader against the naive OBJ parser and exits
+	bool gMeshCacheEnabled = true;			// load models through precooked .mesh files (--no-mesh-cache disables)
+	bool gTextureCacheEnabled = true;		// load texture mip chains from .mips files (--no-texture-cache disables)
+
+	// image kernels (--bench-kernels): times every supported kernel set and checks it against the scalar one
+	bool gKernelBenchmark = false;
+	const int KERNEL_BENCHMARK_SIZE = 4096;		// width and height of the benchmark images
+	const int KERNEL_BENCHMARK_RUNS = 5;		// best of this many runs is reported
+
+	// transforms (--bench-transforms N): per-object glm matrix math against TransformSystem for N objects
+	int gTransformBenchmarkCount = 0;
+	const int TRANSFORM_BENCHMARK_RUNS = 5;		// best of this many runs is reported
+
+	// BVH (--bench-bvh N): build, refit, ray and frustum query times on a scene of meshes with N triangles each
+	int gBvhBenchmarkCount = 0;
+	const int BVH_BENCHMARK_OBJECTS = 4096;		// objects on a square grid, all sharing the one mesh
+	const int BVH_BENCHMARK_RAYS = 200000;
+	const int BVH_BENCHMARK_CHECKED_RAYS = 64;	// rays also tested against every triangle and every object
+	const int BVH_BENCHMARK_RUNS = 5;			// best of this many refits and frustum queries is reported
+
+	// offline texture compression (--encode-ktx2 image...): writes a BC1/BC3 .ktx2 next to each image and exits
+	vector<const char*> gKtx2EncodeFiles;
 }
 
 /* User-defined Function prototypes to:
@@ -76,228 +297,283 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void UCreateMesh(GLMesh &mesh);
+void UBuildMesh(MeshBuilder &builder, float layer);
+void UComputeBounds(const MeshBuilder &builder, glm::vec3 &boundsMin, glm::vec3 &boundsMax);
+bool UCreateMeshFromFile(const char* filename, GLMesh &mesh);
+bool UCreateMeshFromCache(const char* filename, GLMesh &mesh);
+bool UCookMeshCache(const char* filename, uint64_t sourceHash, const string& cachePath);
+bool UStreamMeshFromFile(const char* filename, GLMesh &mesh);
+void UEnableMeshAttributes();
 void UDestroyMesh(GLMesh &mesh);
-bool UCreateTexture(const char* filename, GLuint &textureId);
-void UDestroyTexture(GLuint textureId);
+void UCreateInstancedMesh(const GLMesh &mesh, InstanceBuffer &instances);
+void UQueueInstanced(const GLMesh &mesh, const InstanceBuffer &instances, GLuint texture);
+void UQueueEachInstance(const GLMesh &mesh, const InstanceBuffer &instances, const uint8_t* visible, GLuint texture, size_t first, size_t last, RenderQueue &queue);
+void UCreateStressScene(int count);
+glm::vec3 UGridPosition(int index, int count, float height);
+void UCreateMeshPool(const MeshPool &pool, GLMesh &mesh);
+void UCreateIndirectDraws(const GLMesh &poolMesh, IndirectDrawList &draws);
+void UQueueIndirect(const IndirectDrawList &draws, GLuint texture);
+void UQueueEachIndirect(const IndirectDrawList &draws, GLuint texture, size_t first, size_t last, RenderQueue &queue);
+void UCullIndirectOnGpu(const IndirectDrawList &draws, const GpuCuller &culler, int phase);
+void UQueueIndirectCount(const IndirectDrawList &draws, const GpuCuller &culler, GLuint texture, bool late);
+void UQueueMesh(const ShaderProgram &program, const GLMesh &mesh, GLuint texture, TransformSystem::Handle handle);
+uint32_t UQueueDepth(const glm::vec3& position);
+void UExecuteRenderQueue();
+void UUpdateObjects(const glm::mat4& viewProjection, const glm::vec4 frustum[6]);
+void UPackObjects(bool moved, bool visibilityChanged, GLuint texture);
+bool UBuildDepthPyramid();
+void UCreateMdiScene(int count);
+bool UVisible(TransformSystem::Handle handle);
+void UPick(double x, double y);
+void UBuildMeshBvhFromCache();
+void USetMeshBounds(GLMesh &mesh, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+float UProjectedSize(const GLMesh &mesh, const glm::mat4& model);
+bool UCreateTextureArray(const char* const filenames[], int layers, TextureResidency::Handle &handle);
+unique_ptr<TextureSource> UOpenCompressedTextureSource(const char* const filenames[], int layers);
+bool UEncodeKtx2(const char* filename);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId);
-void UDestroyShaderProgram(GLuint programId);
-
-
-/* Vertex Shader Source Code*/
-const GLchar * vertexShaderSource = GLSL(440,
-	layout(location = 0) in vec3 position;
-	layout(location = 2) in vec2 textureCoordinate;
-	out vec2 vertexTextureCoordinate;
-
-	//Global variables for the transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
-
-	void main() {
-		gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
-		vertexTextureCoordinate = textureCoordinate;
-	}
-);
-
-// Cube Vertex Shader Source Code
-const GLchar * cubeVertexShaderSource = GLSL(440,
-	layout(location = 0) in vec3 position;	// VAP position 0 for vertex position data
-	layout(location = 1) in vec3 normal;	// VAP position 1 for normals
-	out vec3 vertexNormal;					// For outgoing normals to fragment shader
-	out vec3 vertexFragmentPos;				// For outgoing color / pixels to fragment shader
-	
-	// Uniform / Global variables for the  transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
-
-	void main() {
-		gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-		vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-		vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-	}
-);
-
-//Cube Fragment Shader Source Code
-const GLchar * cubeFragmentShaderSource = GLSL(440,
-	in vec3 vertexNormal;		// For incoming normals
-	in vec3 vertexFragmentPos;	// For incoming fragment position
-	out vec4 fragmentColor;		// For outgoing cube color to the GPU
-	
-	// Uniform / Global variables for object color, light color, light position, and camera/view position
-	uniform vec3 objectColor;
-	uniform vec3 lightColor;
-	uniform vec3 lightPos;
-	uniform vec3 viewPosition;
-
-	void main() {
-		//Phong lighting model calculations to generate ambient, diffuse, and specular components
-		//Calculate Ambient lighting
-		float ambientStrength = 0.1f; // Set ambient or global lighting strength
-		vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-		
-		//Calculate Diffuse lighting
-		vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-		vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-		float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-		vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-		//Calculate Specular lighting
-		float specularIntensity = 0.8f; // Set specular light strength
-		float highlightSize = 16.0f; // Set specular highlight size
-		vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-		vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-		
-		//Calculate specular component
-		float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-		vec3 specular = specularIntensity * specularComponent * lightColor;
-		
-		// Calculate phong result
-		vec3 phong = (ambient + diffuse + specular) * objectColor;
-		fragmentColor = vec4(phong, 1.0f); // Send lighting results to GPU
-	}
-);
-
-/* Lamp Shader Source Code*/
-const GLchar * lampVertexShaderSource = GLSL(440,
-	layout(location = 0) in vec3 position; // VAP position 0 for vertex position data transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
-
-	void main() {
-		gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-	}
-);
-
-/* Fragment Shader Source Code*/
-const GLchar * fragmentShaderSource = GLSL(440,
-	in vec3 position;
-	in vec2 vertexTextureCoordinate;
-	out vec4 fragmentColor;
-	uniform sampler2D tex0;
-	uniform sampler2D tex1;
-	uniform sampler2D tex2;
-
-	void main() {
-		if (vertexTextureCoordinate.y > 0.5)
-			fragmentColor = texture(tex0, vertexTextureCoordinate);
-		if(vertexTextureCoordinate.y < 0.5 && vertexTextureCoordinate.y > -0.5)
-			fragmentColor = texture(tex1, vertexTextureCoordinate);
-		else
-			fragmentColor = texture(tex2, vertexTextureCoordinate);
-			//fragmentColor = texture(uTexture, vertexTextureCoordinate); // Sends texture to the GPU for rendering
-	}
-);
-
-/* Fragment Shader Source Code*/
-const GLchar * lampFragmentShaderSource = GLSL(440,
-	out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
-	
-	void main() {
-		fragmentColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-	}
-);
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char *image, int width, int height, int channels) {
-	for (int j = 0; j < height / 2; ++j) {
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
-
-		for (int i = width * channels; i > 0; --i) {
-			unsigned char tmp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = tmp;
-			++index1;
-			++index2;
-		}
-	}
-}
+bool UCreateShaderPrograms(const ShaderProgramSource sources[], int count);
+bool ULoadShaderPrograms();
+bool UCreateComputeProgram(const char* path, ShaderProgram &program);
+void UResolveUniforms();
+bool UStartShaderReload();
+void UApplyShaderReloads();
+void UStopShaderReload();
+void UDestroyShaderProgram(ShaderProgram &program);
+bool UCreateOffscreenTarget(int width, int height);
+void UDestroyOffscreenTarget();
+bool UWriteFramebuffer(const char* filename, int width, int height);
+void UBenchmarkCamera(int frame, int totalFrames);
+void UCollectGpuTimer(int slot);
+bool UWriteBenchmarkReport();
+bool UBenchmarkLoader(const char* filename);
+bool UBenchmarkImageKernels(int size);
+template <typename Body> double UBestOfRuns(int runs, Body body);
+bool UBenchmarkTransforms(int count);
+bool UBenchmarkBvh(int triangles);
+void UCreateCameraBuffer();
+glm::mat4 UCameraProjection();
+void UUpdateCameraBuffer(const glm::mat4& view, const glm::mat4& projection);
+void UDestroyCameraBuffer();
+
 
 int main(int argc, char* argv[]) {
 	if (!UInitialize(argc, argv, &gWindow))
 		return EXIT_FAILURE;
 
-	// Create the mesh
-	UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
-
-	//TODO
-	// Create the shader program
-	if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-		return EXIT_FAILURE;
-	if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
-		return EXIT_FAILURE;
-
-	// Load texture
-	const char * texFilename0 = "../resources/textures/usbRubber.png";
-	if (!UCreateTexture(texFilename0, tex0)) {
-		cout << "Failed to load texture " << texFilename0 << endl;
-		return EXIT_FAILURE;
+	// Loader benchmark runs on its own and exits
+	if (gLoaderBenchmarkPath != nullptr)
+		return UBenchmarkLoader(gLoaderBenchmarkPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (gKernelBenchmark)
+		return UBenchmarkImageKernels(KERNEL_BENCHMARK_SIZE) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (gTransformBenchmarkCount > 0)
+		return UBenchmarkTransforms(gTransformBenchmarkCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (gBvhBenchmarkCount > 0)
+		return UBenchmarkBvh(gBvhBenchmarkCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	// Offline texture compression runs on its own and exits
+	if (!gKtx2EncodeFiles.empty()) {
+		bool encoded = true;
+		for (const char* filename : gKtx2EncodeFiles)
+			encoded = UEncodeKtx2(filename) && encoded;
+		return encoded ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
-	const char * texFilename1 = "../resources/textures/usbMetal.jpg";
-	if (!UCreateTexture(texFilename1, tex1)) {
-		cout << "Failed to load texture " << texFilename1 << endl;
-		return EXIT_FAILURE;
+	// Create the mesh
+	if (gModelPath != nullptr) {
+		if (!UCreateMeshFromFile(gModelPath, gMesh))
+			return EXIT_FAILURE;
 	}
+	else
+		UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
 
-	const char * texFilename2 = "../resources/textures/plane.jpg";
-	if (!UCreateTexture(texFilename2, tex2)) {
-		cout << "Failed to load texture " << texFilename2 << endl;
+	//TODO
+	// Create the shader programs from their GLSL files
+	if (!ULoadShaderPrograms())
 		return EXIT_FAILURE;
+	UResolveUniforms();
+
+	// Create the camera uniform buffer shared by all programs
+	UCreateCameraBuffer();
+
+	// Place the objects. The USB mesh is scaled by 2 and rotated by 45 (radians, which is what glm::rotate takes)
+	// about (1, 1, 1) at the origin; the lamp marks the light position
+	gMeshTransform = gTransforms.Add(glm::vec3(0.0f, 0.0f, 0.0f), 45.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(2.0f, 2.0f, 2.0f));
+	gLampTransform = gTransforms.Add(gLightPosition, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f), gLightScale);
+	gTransforms.SetBounds(gMeshTransform, gMesh.center, gMesh.radius, gMesh.extents);
+	gTransforms.SetBounds(gLampTransform, gMesh.center, gMesh.radius, gMesh.extents);
+	if (gMeshBvh.TriangleCount() > 0 || gMeshBvhPending) {
+		gSceneBvh.SetMesh(gMeshTransform, &gMeshBvh);
+		gSceneBvh.SetMesh(gLampTransform, &gMeshBvh);
 	}
+	if (gStressCount > 0)
+		UCreateStressScene(gStressCount);
+	if (gMdiCount > 0)
+		UCreateMdiScene(gMdiCount);
+	else
+		gGpuCulling = gOcclusionCulling = false;	// the GPU culls only the multi-draw scene
+
+	// Worker threads for the per-object work of every frame
+	gWorkers.Start(gWorkerThreads);
+	gObjectWorkers.resize(gWorkers.Count());
+	cout << "INFO: Per-object work split across " << gWorkers.Count() << " threads" << endl;
+
+	// Load textures, one texture array layer per material (the layer numbers match UCreateMesh)
+	const char * texFilenames[] = {
+		"../resources/textures/usbRubber.png",	// layer 0: usb main body
+		"../resources/textures/usbMetal.jpg",	// layer 1: usb input
+		"../resources/textures/plane.jpg"		// layer 2: plane
+	};
+	if (!UCreateTextureArray(texFilenames, 3, gTextureArray))
+		return EXIT_FAILURE;
 
-	// tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-	glUseProgram(gProgramId);
+	// The texture array is the only texture and stays on unit 0 (URender rebinds it, streaming replaces the GL texture)
+	glUseProgram(gProgram.Id);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex0);
-
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tex1);
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, tex2);
-
-	// set texture as texture unit
-	glUniform1i(glGetUniformLocation(gProgramId, "tex0"), 0);
-	glUniform1i(glGetUniformLocation(gProgramId, "tex1"), 1);
-	glUniform1i(glGetUniformLocation(gProgramId, "tex2"), 2);
+	// Watch the GLSL files while the program runs interactively
+	if (gHotReloadEnabled && !gHeadless && !gBenchmark)
+		UStartShaderReload();
 
 	// Sets the background color of the window to black (it will be implicitely used by glClear)
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+	// Benchmark frames are timed on the GPU with a small ring of timer queries
+	const int totalFrames = gBenchmark ? gMaxFrames + BENCHMARK_WARMUP_FRAMES : gMaxFrames;
+	if (gBenchmark) {
+		glGenQueries(TIMER_QUERY_COUNT, gTimerQueries);
+		for (int i = 0; i < TIMER_QUERY_COUNT; ++i)
+			gTimerQueryFrames[i] = -1;
+	}
+
 	// render loop
+	int frameCount = 0;
 	while (!glfwWindowShouldClose(gWindow)) {
+		chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+
 		// per-frame timing
-		float currentFrame = glfwGetTime();
-		gDeltaTime = currentFrame - gLastFrame;
-		gLastFrame = currentFrame;
+		if (gBenchmark) {
+			// scripted camera and fixed time step instead of the wall clock
+			gDeltaTime = BENCHMARK_FRAME_STEP;
+			UBenchmarkCamera(frameCount, totalFrames);
+		}
+		else {
+			float currentFrame = glfwGetTime();
+			gDeltaTime = currentFrame - gLastFrame;
+			gLastFrame = currentFrame;
+		}
+
+		// input (there is no keyboard or mouse in headless or benchmark mode)
+		if (!gHeadless && !gBenchmark)
+			UProcessInput(gWindow);
 
-		// input
-		UProcessInput(gWindow);
+		// Swap in the shader programs rebuilt since the last frame
+		if (gReloadContext != nullptr)
+			UApplyShaderReloads();
+
+		// Occlusion culling runs every frame, or every other one when the benchmark compares against frames without it
+		gOcclusionThisFrame = gOcclusionCulling && (!gBenchmark || frameCount % 2 == 0);
 
 		// Render this frame
-		URender();
+		if (gBenchmark) {
+			int slot = frameCount % TIMER_QUERY_COUNT;
+			UCollectGpuTimer(slot);
+			gTimerQueryFrames[slot] = frameCount;
+			glBeginQuery(GL_TIME_ELAPSED, gTimerQueries[slot]);
+			URender();
+			glEndQuery(GL_TIME_ELAPSED);
+		}
+		else
+			URender();
 
 		glfwPollEvents();
+
+		if (gBenchmark && frameCount >= BENCHMARK_WARMUP_FRAMES) {
+			chrono::duration<double, milli> frameTime = chrono::steady_clock::now() - frameStart;
+			gFrameStats.RecordCpu(frameTime.count());
+			gFrameStats.RecordObjectTime(gObjectMs);
+			gFrameStats.RecordDrawCalls(gDrawCalls);
+			gFrameStats.RecordStateChanges(gStateCache.ChangeCount, gStateCache.SkippedCount);
+			if (gCullingEnabled && gGpuCulling)
+				gFrameStats.RecordCulling(gCuller.VisibleCount() + gGpuVisibleCount, gCuller.CulledCount() + gMdiCount - gGpuVisibleCount);
+			else if (gCullingEnabled)
+				gFrameStats.RecordCulling(gCuller.VisibleCount(), gCuller.CulledCount());
+			else
+				gFrameStats.RecordCulling(gTransforms.Count(), 0);
+			if (gOcclusionThisFrame)
+				gFrameStats.RecordOccluded(gGpuOccludedCount);
+		}
+
+		// headless and benchmark runs stop after a fixed number of frames
+		if ((gHeadless || gBenchmark) && ++frameCount >= totalFrames)
+			break;
 	}
 
+	// Read back the GPU timers still in flight and report
+	if (gBenchmark) {
+		for (int i = 0; i < TIMER_QUERY_COUNT; ++i)
+			UCollectGpuTimer(i);
+		glDeleteQueries(TIMER_QUERY_COUNT, gTimerQueries);
+
+		if (!UWriteBenchmarkReport())
+			cout << "Failed to write benchmark report " << gBenchmarkJson << endl;
+	}
+
+	// Save the last headless frame so regression jobs can compare it
+	if (gHeadless && gHeadlessOutput != nullptr) {
+		if (!UWriteFramebuffer(gHeadlessOutput, WINDOW_WIDTH, WINDOW_HEIGHT))
+			cout << "Failed to write frame " << gHeadlessOutput << endl;
+	}
+
+	// State changes of the last frame, and how many the state cache skipped
+	cout << "INFO: Render queue: " << gRenderQueue.Count() << " draws, " << gStateCache.ChangeCount << " state changes, "
+		<< gStateCache.SkippedCount << " redundant binds skipped" << endl;
+
+	// Culling results of the last frame
+	if (gCullingEnabled)
+		cout << "INFO: Frustum culling: " << gCuller.VisibleCount() << " objects visible, " << gCuller.CulledCount() << " culled" << endl;
+	if (gGpuCulling && gBenchmark)
+		cout << "INFO: GPU culling: " << gGpuVisibleCount << " of " << gMdiCount << " draws visible" << endl;
+	if (gOcclusionCulling && gBenchmark)
+		cout << "INFO: Occlusion culling: " << gGpuOccludedCount << " of " << gMdiCount << " draws occluded" << endl;
+
+	// Release offscreen framebuffer
+	if (gHeadless)
+		UDestroyOffscreenTarget();
+
 	// Release mesh data
+	if (gStressCount > 0)
+		gStressInstances.Destroy();
+	if (gMdiCount > 0) {
+		if (gGpuCulling)
+			gMdiCuller.Destroy();
+		if (gOcclusionCulling)
+			gDepthPyramid.Destroy();
+		gMdiDraws.Destroy();
+		UDestroyMesh(gPoolMesh);
+	}
 	UDestroyMesh(gMesh);
 
-	// Release texture
-	UDestroyTexture(tex0);
-	UDestroyTexture(tex1);
-	UDestroyTexture(tex2);
+	// Release camera uniform buffer
+	UDestroyCameraBuffer();
+
+	// Release textures
+	cout << "INFO: Texture streaming: " << gTextureResidency.StreamedLevels() << " levels streamed in, " << gTextureResidency.EvictedLevels()
+		<< " evicted, peak " << gTextureResidency.PeakBytes() / 1024 << " KB of a " << gTextureResidency.Budget() / 1024 << " KB budget" << endl;
+	gTextureResidency.Clear();
 
 	//TODO
 	// Release shader program
-	UDestroyShaderProgram(gProgramId);
-	//UDestroyShaderProgram(gCubeProgramId);
-	UDestroyShaderProgram(gLampProgramId);
+	UStopShaderReload();
+	UDestroyShaderProgram(gProgram);
+	UDestroyShaderProgram(gCubeProgram);
+	UDestroyShaderProgram(gLampProgram);
+	UDestroyShaderProgram(gInstancedProgram);
+	UDestroyShaderProgram(gIndirectProgram);
+	for (int i = 0; i < COMPUTE_PROGRAM_COUNT; ++i)
+		UDestroyShaderProgram(*COMPUTE_PROGRAM_FILES[i].program);
+
+	gWorkers.Stop();
 
 	exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -305,8 +581,73 @@ int main(int argc, char* argv[]) {
 
 // Initialize GLFW, GLEW, and create a window
 bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
+	// Command line options
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0)
+			gHeadless = true;
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			gMaxFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			gHeadlessOutput = argv[++i];
+		else if (strcmp(argv[i], "--benchmark") == 0)
+			gBenchmark = true;
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			gBenchmarkJson = argv[++i];
+		else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+			gModelPath = argv[++i];
+		else if (strcmp(argv[i], "--bench-loader") == 0 && i + 1 < argc)
+			gLoaderBenchmarkPath = argv[++i];
+		else if (strcmp(argv[i], "--no-mesh-cache") == 0)
+			gMeshCacheEnabled = false;
+		else if (strcmp(argv[i], "--no-texture-cache") == 0)
+			gTextureCacheEnabled = false;
+		else if (strcmp(argv[i], "--no-program-cache") == 0)
+			gProgramCacheEnabled = false;
+		else if (strcmp(argv[i], "--no-hot-reload") == 0)
+			gHotReloadEnabled = false;
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+			gTextureResidency.SetBudget(static_cast<size_t>(atoi(argv[++i])) * 1024 * 1024);
+		else if (strcmp(argv[i], "--bench-kernels") == 0)
+			gKernelBenchmark = true;
+		else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc)
+			gStressCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--no-instancing") == 0)
+			gStressInstancing = false;
+		else if (strcmp(argv[i], "--mdi-scene") == 0 && i + 1 < argc)
+			gMdiCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--no-mdi") == 0)
+			gMdiEnabled = false;
+		else if (strcmp(argv[i], "--gpu-culling") == 0)
+			gGpuCulling = true;
+		else if (strcmp(argv[i], "--hiz") == 0)
+			gOcclusionCulling = gGpuCulling = true;
+		else if (strcmp(argv[i], "--no-culling") == 0)
+			gCullingEnabled = false;
+		else if (strcmp(argv[i], "--bvh-cull") == 0)
+			gBvhCulling = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			gWorkerThreads = static_cast<unsigned int>(atoi(argv[++i]));
+		else if (strcmp(argv[i], "--bench-transforms") == 0 && i + 1 < argc)
+			gTransformBenchmarkCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--bench-bvh") == 0 && i + 1 < argc)
+			gBvhBenchmarkCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--encode-ktx2") == 0) {
+			while (i + 1 < argc && argv[i + 1][0] != '-')
+				gKtx2EncodeFiles.push_back(argv[++i]);
+		}
+	}
+
+	// Headless runs have no display server, so use GLFW's null platform (GLFW 3.4+)
+	#ifdef GLFW_PLATFORM_NULL
+		if (gHeadless)
+			glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+	#endif
+
 	// GLFW: initialize and configure
-	glfwInit();
+	if (!glfwInit()) {
+		std::cout << "Failed to initialize GLFW" << std::endl;
+		return false;
+	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -316,7 +657,19 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
 	#endif
 
 	// GLFW: window creation
-	*window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+	if (gHeadless) {
+		// Surfaceless context: try EGL first, then fall back to OSMesa (both run on Mesa llvmpipe)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+		*window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+		if (*window == NULL) {
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+			*window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+		}
+	}
+	else
+		*window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+
 	if (*window == NULL) {
 		std::cout << "Failed to create GLFW window" << std::endl;
 		glfwTerminate();
@@ -324,19 +677,27 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
 	}
 
 	glfwMakeContextCurrent(*window);
-	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-	glfwSetCursorPosCallback(*window, UMousePositionCallback);
-	glfwSetScrollCallback(*window, UMouseScrollCallback);
-	glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
-
-	// tell GLFW to capture our mouse
-	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (!gHeadless) {
+		glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+		glfwSetCursorPosCallback(*window, UMousePositionCallback);
+		glfwSetScrollCallback(*window, UMouseScrollCallback);
+		glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+
+		// tell GLFW to capture our mouse
+		glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	}
 
 	// GLEW: initialize
 	// Note: if using GLEW version 1.13 or earlier
 	glewExperimental = GL_TRUE;
 	GLenum GlewInitResult = glewInit();
 
+	// A surfaceless context has no GLX display, but the core GL entry points are already loaded
+	#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		if (gHeadless && GlewInitResult == GLEW_ERROR_NO_GLX_DISPLAY)
+			GlewInitResult = GLEW_OK;
+	#endif
+
 	if (GLEW_OK != GlewInitResult) {
 		std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
 		return false;
@@ -345,10 +706,468 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
 	// Displays GPU OpenGL version
 	cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
+	// Benchmarks measure rendering, not waiting for the display refresh
+	if (gBenchmark && !gHeadless)
+		glfwSwapInterval(0);
+
+	// Headless frames are rendered into an offscreen framebuffer instead of the default one
+	if (gHeadless) {
+		if (!UCreateOffscreenTarget(WINDOW_WIDTH, WINDOW_HEIGHT))
+			return false;
+		cout << "INFO: Headless rendering " << gMaxFrames << " frames" << endl;
+	}
+
+	return true;
+}
+
+
+// Creates the offscreen framebuffer used by headless rendering and binds it as the draw target
+bool UCreateOffscreenTarget(int width, int height) {
+	glGenFramebuffers(1, &gOffscreenFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, gOffscreenFbo);
+
+	// Color and depth attachments
+	glGenRenderbuffers(2, gOffscreenRbos);
+	glBindRenderbuffer(GL_RENDERBUFFER, gOffscreenRbos[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gOffscreenRbos[0]);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, gOffscreenRbos[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gOffscreenRbos[1]);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << std::endl;
+		UDestroyOffscreenTarget();
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+void UDestroyOffscreenTarget() {
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteRenderbuffers(2, gOffscreenRbos);
+	glDeleteFramebuffers(1, &gOffscreenFbo);
+	gOffscreenFbo = 0;
+}
+
+// Reads back the current framebuffer and writes it as a binary PPM image
+bool UWriteFramebuffer(const char* filename, int width, int height) {
+	const int channels = 3;
+	vector<unsigned char> pixels(width * height * channels);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+	// OpenGL rows start at the bottom, image rows start at the top
+	GetImageKernels().FlipRows(pixels.data(), width * channels, height);
+
+	ofstream file(filename, ios::binary);
+	if (!file)
+		return false;
+	file << "P6\n" << width << " " << height << "\n255\n";
+	file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+	return file.good();
+}
+
+
+// Moves the camera along a fixed orbit around the scene, one full turn over the benchmark
+void UBenchmarkCamera(int frame, int totalFrames) {
+	const float radius = 3.5f;
+	float angle = 2.0f * glm::pi<float>() * frame / totalFrames;
+
+	glm::vec3 position(radius * cos(angle), 1.0f + 0.5f * sin(2.0f * angle), radius * sin(angle));
+
+	// Aim at the origin: convert the look direction back into the camera's Euler angles
+	glm::vec3 direction = glm::normalize(-position);
+	float yaw = glm::degrees(atan2(direction.z, direction.x));
+	float pitch = glm::degrees(asin(direction.y));
+
+	gCamera.SetPose(position, yaw, pitch);
+}
+
+// Reads the GPU time of the frame that last used this timer query slot
+void UCollectGpuTimer(int slot) {
+	int frame = gTimerQueryFrames[slot];
+	if (frame < 0)
+		return;
+
+	// The slot is TIMER_QUERY_COUNT frames old, so this rarely has to wait
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(gTimerQueries[slot], GL_QUERY_RESULT, &elapsed);
+	// with occlusion culling the odd frames ran without it, as the baseline of the GPU time it saves
+	if (frame >= BENCHMARK_WARMUP_FRAMES) {
+		if (gOcclusionCulling && frame % 2 != 0)
+			gFrameStats.RecordGpuBaseline(elapsed / 1.0e6);
+		else
+			gFrameStats.RecordGpu(elapsed / 1.0e6);
+	}
+	gTimerQueryFrames[slot] = -1;
+}
+
+// Writes the benchmark summary as JSON to the --json file, or stdout
+bool UWriteBenchmarkReport() {
+	if (gBenchmarkJson == nullptr) {
+		gFrameStats.WriteJson(cout, gMaxFrames);
+		return true;
+	}
+
+	ofstream file(gBenchmarkJson);
+	if (!file)
+		return false;
+	gFrameStats.WriteJson(file, gMaxFrames);
+	return file.good();
+}
+
+
+// Times the naive single-threaded OBJ parse against ModelLoader filling mapped GL buffers, and prints JSON
+bool UBenchmarkLoader(const char* filename) {
+	string name(filename);
+	bool isObj = name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0;
+
+	double naiveMs = 0.0;
+	size_t naiveVertices = 0;
+	if (isObj) {
+		vector<float> vertices;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (!LoadObjNaive(filename, vertices)) {
+			cout << "Failed to load model " << filename << endl;
+			return false;
+		}
+		naiveMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		naiveVertices = vertices.size() / MODEL_FLOATS_PER_VERTEX;
+	}
+
+	GLMesh mesh;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!UStreamMeshFromFile(filename, mesh))
+		return false;
+	glFinish();
+	double loaderMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout << "{\n"
+		<< "  \"file\": \"" << filename << "\",\n"
+		<< "  \"triangles\": " << mesh.nIndices / 3 << ",\n"
+		<< "  \"threads\": " << max(1u, thread::hardware_concurrency()) << ",\n";
+	if (isObj)
+		cout << "  \"naive_ms\": " << naiveMs << ",\n"
+			<< "  \"naive_vertices\": " << naiveVertices << ",\n";
+	cout << "  \"loader_ms\": " << loaderMs << "\n"
+		<< "}" << endl;
+
+	UDestroyMesh(mesh);
 	return true;
 }
 
 
+// Best time of runs calls of body(run), in milliseconds
+template <typename Body>
+double UBestOfRuns(int runs, Body body) {
+	double bestMs = 0.0;
+	for (int run = 0; run < runs; ++run) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		body(run);
+		double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		bestMs = run == 0 ? elapsedMs : min(bestMs, elapsedMs);
+	}
+	return bestMs;
+}
+
+
+// Times every image kernel of every kernel set the CPU supports on size x size images, and checks each
+// set's output against the scalar reference byte for byte
+bool UBenchmarkImageKernels(int size) {
+	const size_t pixels = static_cast<size_t>(size) * size;
+	const size_t halfPixels = static_cast<size_t>(max(1, size / 2)) * max(1, size / 2);
+
+	// Deterministic noise, so every run and every kernel set sees the same input
+	vector<unsigned char> source(pixels * 4);
+	uint32_t state = 0x12345678u;
+	for (unsigned char& value : source) {
+		state = state * 1664525u + 1013904223u;
+		value = static_cast<unsigned char>(state >> 24);
+	}
+	vector<uint16_t> linearSource(pixels * 4);
+	for (size_t i = 0; i < linearSource.size(); ++i)
+		linearSource[i] = static_cast<uint16_t>(source[i] * 257 ^ source[(i * 7) % source.size()]);
+
+	// one entry per kernel: runs it into "output", whose first OutputBytes bytes are compared
+	struct KernelCase {
+		const char* Name;
+		size_t OutputBytes;
+		void (*Run)(const ImageKernels& kernels, const vector<unsigned char>& source, const vector<uint16_t>& linearSource, int size, unsigned char* output);
+	};
+	const KernelCase cases[] = {
+		{ "flip_rows", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			memcpy(o, s.data(), s.size()); k.FlipRows(o, n * 4, n); } },
+		{ "rgb_to_rgba", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.RgbToRgba(s.data(), o, static_cast<size_t>(n) * n); } },
+		{ "gray_to_rgba", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.GrayToRgba(s.data(), o, static_cast<size_t>(n) * n); } },
+		{ "gray_alpha_to_rgba", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.GrayAlphaToRgba(s.data(), o, static_cast<size_t>(n) * n); } },
+		{ "premultiply_alpha", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			memcpy(o, s.data(), s.size()); k.PremultiplyAlpha(o, static_cast<size_t>(n) * n); } },
+		{ "srgb_to_linear", pixels * 8, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.SrgbToLinear(s.data(), reinterpret_cast<uint16_t*>(o), static_cast<size_t>(n) * n); } },
+		{ "linear_to_srgb", pixels * 4, [](const ImageKernels& k, const vector<unsigned char>&, const vector<uint16_t>& l, int n, unsigned char* o) {
+			k.LinearToSrgb(l.data(), o, static_cast<size_t>(n) * n); } },
+		{ "downsample_rgba", halfPixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.DownsampleRgba(s.data(), n, n, o); } },
+		{ "downsample_srgb_rgba", halfPixels * 4, [](const ImageKernels& k, const vector<unsigned char>& s, const vector<uint16_t>&, int n, unsigned char* o) {
+			k.DownsampleSrgbRgba(s.data(), n, n, o); } },
+	};
+
+	const vector<ImageKernels>& kernelSets = SupportedImageKernels();
+	vector<unsigned char> reference(pixels * 8);
+	vector<unsigned char> output(pixels * 8);
+	bool exact = true;
+
+	cout << "{\n"
+		<< "  \"size\": " << size << ",\n"
+		<< "  \"selected\": \"" << GetImageKernels().Name << "\",\n"
+		<< "  \"kernels\": [\n";
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		const KernelCase& kernelCase = cases[c];
+		cases[c].Run(kernelSets[0], source, linearSource, size, reference.data());
+
+		cout << "    { \"name\": \"" << kernelCase.Name << "\"";
+		for (const ImageKernels& kernels : kernelSets) {
+			double bestMs = UBestOfRuns(KERNEL_BENCHMARK_RUNS, [&](int) {
+				kernelCase.Run(kernels, source, linearSource, size, output.data());
+			});
+			bool matches = memcmp(reference.data(), output.data(), kernelCase.OutputBytes) == 0;
+			exact = exact && matches;
+			cout << ", \"" << kernels.Name << "_ms\": " << bestMs;
+			if (!matches)
+				cout << ", \"" << kernels.Name << "_mismatch\": true";
+		}
+		cout << " }" << (c + 1 < sizeof(cases) / sizeof(cases[0]) ? "," : "") << "\n";
+	}
+	cout << "  ],\n"
+		<< "  \"exact\": " << (exact ? "true" : "false") << "\n"
+		<< "}" << endl;
+	return exact;
+}
+
+
+// Times per-object glm model, normal and MVP matrices against TransformSystem for count objects: everything
+// dirty, only the camera moved, and one object in a hundred moved. Prints JSON; fails if the results differ
+bool UBenchmarkTransforms(int count) {
+	// Deterministic transforms, so every run sees the same input
+	vector<glm::vec3> positions(count), axes(count), scales(count);
+	vector<float> angles(count);
+	uint32_t state = 0x12345678u;
+	auto random = [&state](float low, float high) {
+		state = state * 1664525u + 1013904223u;
+		return low + (high - low) * (state >> 8) / 16777216.0f;
+	};
+	for (int i = 0; i < count; ++i) {
+		positions[i] = glm::vec3(random(-50.0f, 50.0f), random(-50.0f, 50.0f), random(-50.0f, 50.0f));
+		axes[i] = glm::vec3(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(1.0f, 2.0f));
+		scales[i] = glm::vec3(random(0.5f, 2.0f), random(0.5f, 2.0f), random(0.5f, 2.0f));
+		angles[i] = random(0.0f, 6.0f);
+	}
+	glm::mat4 viewProjection = glm::perspective(glm::radians(ZOOM), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f)
+		* glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// What URender used to do for every object every frame
+	vector<glm::mat4> models(count), mvps(count);
+	vector<glm::mat3> normals(count);
+	double glmMs = UBestOfRuns(TRANSFORM_BENCHMARK_RUNS, [&](int) {
+		for (int i = 0; i < count; ++i) {
+			models[i] = glm::translate(positions[i]) * glm::rotate(angles[i], axes[i]) * glm::scale(scales[i]);
+			normals[i] = glm::transpose(glm::inverse(glm::mat3(models[i])));
+			mvps[i] = viewProjection * models[i];
+		}
+	});
+
+	TransformSystem transforms;
+	for (int i = 0; i < count; ++i)
+		transforms.Add(positions[i], angles[i], axes[i], scales[i]);
+	double allDirtyMs = UBestOfRuns(TRANSFORM_BENCHMARK_RUNS, [&](int) {
+		for (int i = 0; i < count; ++i)
+			transforms.SetPosition(i, positions[i]);
+		transforms.Update(viewProjection);
+	});
+
+	// compare before the camera moves below
+	float maxError = 0.0f;
+	for (int i = 0; i < count; ++i) {
+		glm::mat3 normal(transforms.Normal(i));
+		for (int c = 0; c < 4; ++c)
+			for (int row = 0; row < 4; ++row) {
+				maxError = max(maxError, fabs(transforms.World(i)[c][row] - models[i][c][row]));
+				maxError = max(maxError, fabs(transforms.Mvp(i)[c][row] - mvps[i][c][row]) / max(1.0f, fabs(mvps[i][c][row])));
+				if (c < 3 && row < 3)
+					maxError = max(maxError, fabs(normal[c][row] - normals[i][c][row]));
+			}
+	}
+
+	double cameraMs = UBestOfRuns(TRANSFORM_BENCHMARK_RUNS, [&](int run) {
+		glm::mat4 moved = viewProjection;
+		moved[3][0] += 0.01f * (run + 1);
+		transforms.Update(moved);
+	});
+
+	double fewDirtyMs = UBestOfRuns(TRANSFORM_BENCHMARK_RUNS, [&](int run) {
+		for (int i = run; i < count; i += 100)
+			transforms.SetPosition(i, positions[i] + glm::vec3(0.0f, 0.01f, 0.0f));
+		transforms.Update(viewProjection);
+	});
+
+	bool exact = maxError < 1.0e-4f;
+	cout << "{\n"
+		<< "  \"objects\": " << count << ",\n"
+		<< "  \"simd\": \"" << transform_lanes::NAME << "\",\n"
+		<< "  \"glm_ms\": " << glmMs << ",\n"
+		<< "  \"all_dirty_ms\": " << allDirtyMs << ",\n"
+		<< "  \"camera_moved_ms\": " << cameraMs << ",\n"
+		<< "  \"one_percent_dirty_ms\": " << fewDirtyMs << ",\n"
+		<< "  \"max_error\": " << maxError << ",\n"
+		<< "  \"exact\": " << (exact ? "true" : "false") << "\n"
+		<< "}" << endl;
+	return exact;
+}
+
+// Times the mesh BVH build over about triangles triangles, the scene BVH build and refit over objects sharing that
+// mesh, ray casts into the scene and frustum queries. Prints JSON; fails if rays disagree with brute force
+bool UBenchmarkBvh(int triangles) {
+	// A wavy terrain tile of about the requested triangle count, 2 units wide
+	const int side = max(1, static_cast<int>(ceil(sqrt(triangles * 0.5))));
+	vector<float> vertices;
+	vector<uint32_t> indices;
+	vertices.reserve(static_cast<size_t>(side + 1) * (side + 1) * 3);
+	indices.reserve(static_cast<size_t>(side) * side * 6);
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (int row = 0; row <= side; ++row)
+		for (int column = 0; column <= side; ++column) {
+			float x = 2.0f * column / side - 1.0f, z = 2.0f * row / side - 1.0f;
+			glm::vec3 position(x, 0.1f * sin(17.0f * x) * cos(13.0f * z), z);
+			vertices.insert(vertices.end(), { position.x, position.y, position.z });
+			boundsMin = glm::min(boundsMin, position);
+			boundsMax = glm::max(boundsMax, position);
+		}
+	for (int row = 0; row < side; ++row)
+		for (int column = 0; column < side; ++column) {
+			uint32_t corner = row * (side + 1) + column;
+			indices.insert(indices.end(), { corner, corner + side + 1, corner + 1, corner + 1, corner + side + 1, corner + side + 2 });
+		}
+
+	MeshBvh mesh;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	mesh.Build(vertices.data(), vertices.size() / 3, 3, indices.data(), indices.size());
+	double meshBuildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	// Deterministic objects on a grid, tilted a little so their boxes overlap
+	uint32_t state = 0x12345678u;
+	auto random = [&state](float low, float high) {
+		state = state * 1664525u + 1013904223u;
+		return low + (high - low) * (state >> 8) / 16777216.0f;
+	};
+	const int objectSide = static_cast<int>(ceil(sqrt(static_cast<float>(BVH_BENCHMARK_OBJECTS))));
+	const float spacing = 2.5f;
+	const float extent = 0.5f * spacing * objectSide;
+	TransformSystem transforms;
+	SceneBvh scene;
+	for (int i = 0; i < BVH_BENCHMARK_OBJECTS; ++i) {
+		glm::vec3 position(spacing * (i % objectSide) - extent, random(-0.5f, 0.5f), spacing * (i / objectSide) - extent);
+		TransformSystem::Handle handle = transforms.Add(position, random(-0.3f, 0.3f), glm::vec3(random(-1.0f, 1.0f), 1.0f, random(-1.0f, 1.0f)), glm::vec3(1.0f, 1.0f, 1.0f));
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		transforms.SetBounds(handle, center, glm::length(boundsMax - center), boundsMax - center);
+		scene.SetMesh(handle, &mesh);
+	}
+	Camera camera(glm::vec3(0.0f, 0.4f * extent, 1.2f * extent), glm::vec3(0.0f, 1.0f, 0.0f), YAW, -25.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 4.0f * extent);
+	transforms.Update(projection * camera.GetViewMatrix());
+
+	start = chrono::steady_clock::now();
+	scene.Update(transforms);
+	double sceneBuildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	// every object moves a little, which refits the tree instead of rebuilding it (only the tree update is timed)
+	size_t rebuildsBefore = scene.Rebuilds();
+	double refitMs = 0.0;
+	for (int run = 0; run < BVH_BENCHMARK_RUNS; ++run) {
+		for (int i = 0; i < BVH_BENCHMARK_OBJECTS; ++i)
+			transforms.SetPosition(i, glm::vec3(spacing * (i % objectSide) - extent, 0.01f * (run + 1), spacing * (i / objectSide) - extent));
+		transforms.Update(projection * camera.GetViewMatrix());
+		start = chrono::steady_clock::now();
+		scene.Update(transforms);
+		double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		refitMs = run == 0 ? elapsedMs : min(refitMs, elapsedMs);
+	}
+	size_t refitRebuilds = scene.Rebuilds() - rebuildsBefore;
+
+	// Rays from the camera toward random points of the grid
+	vector<glm::vec3> directions(BVH_BENCHMARK_RAYS);
+	for (glm::vec3& direction : directions)
+		direction = glm::normalize(glm::vec3(random(-extent, extent), random(-0.5f, 0.5f), random(-extent, extent)) - camera.Position);
+	int hits = 0;
+	start = chrono::steady_clock::now();
+	for (const glm::vec3& direction : directions) {
+		SceneBvh::Hit hit;
+		hits += scene.Raycast(transforms, camera.Position, direction, hit);
+	}
+	double raysMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	// The same answers without the trees: every triangle of the mesh, and every object of the scene
+	bool exact = true;
+	for (int r = 0; r < BVH_BENCHMARK_CHECKED_RAYS; ++r) {
+		Ray ray(glm::vec3(random(-1.0f, 1.0f), 1.0f, random(-1.0f, 1.0f)), glm::normalize(glm::vec3(random(-0.5f, 0.5f), -1.0f, random(-0.5f, 0.5f))));
+		float treeDistance = FLT_MAX, allDistance = FLT_MAX;
+		int32_t treeTriangle = -1, allTriangle = -1;
+		mesh.Intersect(ray, treeDistance, treeTriangle);
+		mesh.IntersectAll(ray, allDistance, allTriangle);
+		exact = exact && treeTriangle == allTriangle;
+
+		const glm::vec3& direction = directions[r];
+		SceneBvh::Hit hit;
+		scene.Raycast(transforms, camera.Position, direction, hit);
+		float nearest = FLT_MAX;
+		TransformSystem::Handle nearestObject = -1;
+		for (int i = 0; i < BVH_BENCHMARK_OBJECTS; ++i) {
+			glm::mat4 toModel = glm::inverse(transforms.World(i));
+			Ray modelRay(glm::vec3(toModel * glm::vec4(camera.Position, 1.0f)), glm::vec3(toModel * glm::vec4(direction, 0.0f)));
+			int32_t triangle = -1;
+			if (mesh.Intersect(modelRay, nearest, triangle))
+				nearestObject = i;
+		}
+		exact = exact && hit.Object == nearestObject;
+	}
+
+	// Frustum queries through the tree against the linear SIMD culler
+	glm::vec4 frustum[6];
+	camera.GetFrustumPlanes(projection, frustum);
+	vector<TransformSystem::Handle> visible;
+	double queryMs = UBestOfRuns(BVH_BENCHMARK_RUNS, [&](int) { scene.QueryFrustum(frustum, visible); });
+	FrustumCuller culler;
+	double cullMs = UBestOfRuns(BVH_BENCHMARK_RUNS, [&](int) { culler.Cull(transforms, frustum); });
+
+	cout << "{\n"
+		<< "  \"triangles_per_mesh\": " << mesh.TriangleCount() << ",\n"
+		<< "  \"objects\": " << BVH_BENCHMARK_OBJECTS << ",\n"
+		<< "  \"scene_triangles\": " << static_cast<uint64_t>(mesh.TriangleCount()) * BVH_BENCHMARK_OBJECTS << ",\n"
+		<< "  \"mesh_build_ms\": " << meshBuildMs << ",\n"
+		<< "  \"scene_build_ms\": " << sceneBuildMs << ",\n"
+		<< "  \"refit_ms\": " << refitMs << ",\n"
+		<< "  \"refit_rebuilds\": " << refitRebuilds << ",\n"
+		<< "  \"rays\": " << BVH_BENCHMARK_RAYS << ",\n"
+		<< "  \"ray_hits\": " << hits << ",\n"
+		<< "  \"rays_per_second\": " << BVH_BENCHMARK_RAYS / (raysMs / 1000.0) << ",\n"
+		<< "  \"frustum_query_ms\": " << queryMs << ",\n"
+		<< "  \"linear_cull_ms\": " << cullMs << ",\n"
+		<< "  \"visible_bvh\": " << visible.size() << ",\n"
+		<< "  \"visible_linear\": " << culler.VisibleCount() << ",\n"
+		<< "  \"exact\": " << (exact ? "true" : "false") << "\n"
+		<< "}" << endl;
+	return exact;
+}
+
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window) {
 	static const float cameraSpeed = 2.5f;
@@ -410,8 +1229,16 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
 	switch (button)	{
 	case GLFW_MOUSE_BUTTON_LEFT: {
-		if (action == GLFW_PRESS)
+		if (action == GLFW_PRESS) {
 			cout << "Left mouse button pressed" << endl;
+			// the cursor is hidden and locked while it steers the camera, so it picks through the window center
+			int width, height;
+			glfwGetWindowSize(window, &width, &height);
+			double x = 0.5 * width, y = 0.5 * height;
+			if (glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+				glfwGetCursorPos(window, &x, &y);
+			UPick(x / width * WINDOW_WIDTH, y / height * WINDOW_HEIGHT);
+		}
 		else
 			cout << "Left mouse button released" << endl;
 	}
@@ -448,81 +1275,119 @@ void URender() {
 	// Clear the frame and z buffers
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// 1. Scales the object by 2
-	glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-	// 2. Rotates shape by 15 degrees in the x axis
-	glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Place object at the origin
-	glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-
-	// Model matrix: transformations are applied right-to-left order
-	glm::mat4 model = translation * rotation * scale;
+	gDrawCalls = 0;
+	gStateCache.ResetCounters();
 
 	// camera/view transformation
 	glm::mat4 view = gCamera.GetViewMatrix();
 
 	// Creates a perspective projection
-	glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-
-	// Set the shader to be used
-	glUseProgram(gProgramId);
-
-	// Retrieves and passes transform matrices to the Shader program
-	GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-	GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-	GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	// Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-	GLint objectColorLoc = glGetUniformLocation(gCubeProgramId, "objectColor");
-	GLint lightColorLoc = glGetUniformLocation(gCubeProgramId, "lightColor");
-	GLint lightPositionLoc = glGetUniformLocation(gCubeProgramId, "lightPos");
-	GLint viewPositionLoc = glGetUniformLocation(gCubeProgramId, "viewPosition");
-
-	// Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-	glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-	glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-	glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-	const glm::vec3 cameraPosition = gCamera.Position;
-	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(gMesh.vao);
-
-	// bind textures on corresponding texture units
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tex1);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, tex2);
-	glUniform1i(glGetUniformLocation(gProgramId, "tex0"), 0);
-	glUniform1i(glGetUniformLocation(gProgramId, "tex1"), 1);
-	glUniform1i(glGetUniformLocation(gProgramId, "tex2"), 2);
+	glm::mat4 projection = UCameraProjection();
+
+	// Upload the camera once for every program that uses the shared block
+	UUpdateCameraBuffer(view, projection);
+
+	// Recompute the matrices of moved objects (every MVP if the camera moved) and cull every object against the
+	// view frustum before any draw is issued (the GPU culls the multi-draw scene), on every worker thread
+	chrono::steady_clock::time_point objectStart = chrono::steady_clock::now();
+	glm::vec4 frustum[6];
+	gCamera.GetFrustumPlanes(projection, frustum);
+	UUpdateObjects(projection * view, frustum);
+	chrono::duration<double, milli> objectTime = chrono::steady_clock::now() - objectStart;
+
+	// Keep the scene BVH around the moved objects (the first frame builds it)
+	if (gTransforms.UpdatedWorlds() > 0)
+		gSceneBvh.Update(gTransforms);
+
+	// With --bvh-cull the tree culls, now that it holds this frame's bounds
+	if (gCullingEnabled && gBvhCulling) {
+		gSceneBvh.QueryFrustum(frustum, gBvhVisible);
+		gCuller.SetVisible(gTransforms, gBvhVisible, gGpuCulling ? gMdiFirstTransform : SIZE_MAX);
+	}
+
+	// Record the frame's draws from here on; nothing is bound or drawn until the queue is sorted
+	gRenderQueue.Clear();
+
+	// Passes the MVP matrix to the Shader program (unchanged values are not re-uploaded)
+	gProgram.Set(gMvpUniform, gTransforms.Mvp(gMeshTransform));
+
+	// Tell the residency manager how large the textured mesh appears (nothing while it is culled), and draw with
+	// whichever texture holds the array now
+	if (UVisible(gMeshTransform))
+		gTextureResidency.Request(gTextureArray, UProjectedSize(gMesh, gTransforms.World(gMeshTransform)));
+	const GLuint textureArray = gTextureResidency.TextureId(gTextureArray);
+
+	// Pass the matrices, color and light data to the Cube Shader program's corresponding uniforms
+	gCubeProgram.Set(gCubeModelUniform, gTransforms.World(gMeshTransform));
+	gCubeProgram.Set(gCubeMvpUniform, gTransforms.Mvp(gMeshTransform));
+	gCubeProgram.Set(gCubeNormalUniform, glm::mat3(gTransforms.Normal(gMeshTransform)));
+	gCubeProgram.Set(gObjectColorUniform, gObjectColor);
+	gCubeProgram.Set(gLightColorUniform, gLightColor);
+	gCubeProgram.Set(gLightPositionUniform, gLightPosition);
 
 	// Draws the triangles
-	glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+	if (UVisible(gMeshTransform))
+		UQueueMesh(gProgram, gMesh, textureArray, gMeshTransform);
 
 	//TODO
 	// LAMP: draw lamp
-	glUseProgram(gLampProgramId);
-
-	//Transform the smaller cube used as a visual que for the light source
-	model = glm::translate(gLightPosition) * glm::scale(gLightScale);
+	// Pass the MVP matrix of the smaller cube used as a visual que for the light source to the Lamp Shader program
+	gLampProgram.Set(gLampMvpUniform, gTransforms.Mvp(gLampTransform));
+	if (UVisible(gLampTransform))
+		UQueueMesh(gLampProgram, gMesh, 0, gLampTransform);
+
+	// Visibility changes whenever an object or the camera moved, which is also when MVPs were recomputed
+	const bool moved = gTransforms.UpdatedWorlds() > 0;
+	const bool visibilityChanged = gCullingEnabled && gTransforms.UpdatedMvps() > 0;
+
+	// Refresh the per-object data of the stress and multi-draw scenes (transforms if any moved, the culled
+	// commands) and record their per-object draws, on every worker thread
+	objectStart = chrono::steady_clock::now();
+	UPackObjects(moved, visibilityChanged, textureArray);
+	objectTime += chrono::steady_clock::now() - objectStart;
+	gObjectMs = objectTime.count();
+
+	// Stress scene: upload the visible drives, then draw them
+	if (gStressCount > 0) {
+		if (moved || visibilityChanged)
+			gStressInstances.Upload(gCullingEnabled ? gCuller.VisibleFlags() + gStressFirstTransform : nullptr);
+		if (gStressInstancing)
+			UQueueInstanced(gMesh, gStressInstances, textureArray);
+	}
 
-	// Reference matrix uniforms from the Lamp Shader program
-	modelLoc = glGetUniformLocation(gLampProgramId, "model");
-	viewLoc = glGetUniformLocation(gLampProgramId, "view");
-	projLoc = glGetUniformLocation(gLampProgramId, "projection");
+	// Multi-draw scene: submit every object
+	if (gMdiCount > 0) {
+		if (gGpuCulling) {
+			// with occlusion culling, only the draws found visible last time (the late pass below adds the rest)
+			UCullIndirectOnGpu(gMdiDraws, gMdiCuller, gOcclusionThisFrame ? CULL_PHASE_EARLY : CULL_PHASE_ALL);
+			if (gBenchmark) {
+				GLuint occluded = 0;
+				gMdiCuller.ReadCounts(gGpuVisibleCount, occluded, false);
+			}
+			UQueueIndirectCount(gMdiDraws, gMdiCuller, textureArray, false);
+		}
+		else if (gMdiEnabled)
+			UQueueIndirect(gMdiDraws, textureArray);
+	}
 
-	// Pass matrix data to the Lamp Shader program's matrix uniforms
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-	glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+	// Sort the recorded draws and issue them
+	gRenderQueue.Sort();
+	UExecuteRenderQueue();
+
+	// Late occlusion pass: reduce the depth drawn so far into the pyramid, then draw the multi-draw objects it does
+	// not hide that the early pass left out. The pyramid holds this frame's depth seen by this frame's camera, so
+	// camera and object motion cannot hide anything behind stale depth.
+	if (gOcclusionThisFrame && UBuildDepthPyramid()) {
+		UCullIndirectOnGpu(gMdiDraws, gMdiCuller, CULL_PHASE_LATE);
+		if (gBenchmark) {
+			GLuint lateVisible = 0;
+			gMdiCuller.ReadCounts(lateVisible, gGpuOccludedCount, true);
+			gGpuVisibleCount += lateVisible;
+		}
+		gRenderQueue.Clear();
+		UQueueIndirectCount(gMdiDraws, gMdiCuller, textureArray, true);
+		UExecuteRenderQueue();
+	}
 
 	// Deactivate the Vertex Array Object
 	glBindVertexArray(0);
@@ -530,260 +1395,1193 @@ void URender() {
 	//TODO
 	glUseProgram(0);
 
+	// Stream texture levels toward what this frame asked for (new levels show up in later frames)
+	gTextureResidency.Update();
+
 	// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-	glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+	// Headless frames stay in the offscreen framebuffer, so there is nothing to present
+	if (!gHeadless)
+		glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Implements the UCreateMesh function
-void UCreateMesh(GLMesh &mesh) {
-	// Vertex data
+// Creates the camera uniform buffer and binds it to the fixed binding point declared by every shader
+void UCreateCameraBuffer() {
+	glGenBuffers(1, &gCameraUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, gCameraUbo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, gCameraUbo);
+}
+
+// The camera's perspective projection, shared by rendering and picking so both see the same frustum
+glm::mat4 UCameraProjection() {
+	return glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+}
+
+// Uploads this frame's camera data with a single buffer update
+void UUpdateCameraBuffer(const glm::mat4& view, const glm::mat4& projection) {
+	CameraBlock block;
+	block.view = view;
+	block.projection = projection;
+	block.viewProjection = projection * view;
+	block.cameraPosition = glm::vec4(gCamera.Position, 1.0f);
+	gCamera.GetFrustumPlanes(projection, block.frustumPlanes);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, gCameraUbo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UDestroyCameraBuffer() {
+	glDeleteBuffers(1, &gCameraUbo);
+}
+
+
+// Welds the built-in mesh into builder: all of it, or only the part whose triangles use one texture array layer
+void UBuildMesh(MeshBuilder &builder, float layer) {
+	// Vertex data: position, texture coordinate, texture array layer (0 usb main, 1 usb input, 2 plane)
 	GLfloat verts[] = {
 		// usb main rear face
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f,	//2 back left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f, 0.0f,	//2 back left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
 
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
-		0.25f, -0.5f, -0.25f,    1.0f, 0.0f,	//4 front right
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
+		0.25f, -0.5f, -0.25f,    1.0f, 0.0f, 0.0f,	//4 front right
 
 
 		// usb main front face
-		-0.25f, -0.5f, 0.0f,     0.0f, 0.0f,	//5 front left
-		-0.25f, 0.5f, 0.0f,      0.0f, 1.0f,	//6 back left 
-		0.25f, 0.5f, 0.0f,       1.0f, 1.0f,	//7 back right
+		-0.25f, -0.5f, 0.0f,     0.0f, 0.0f, 0.0f,	//5 front left
+		-0.25f, 0.5f, 0.0f,      0.0f, 1.0f, 0.0f,	//6 back left 
+		0.25f, 0.5f, 0.0f,       1.0f, 1.0f, 0.0f,	//7 back right
 
-		-0.25f, -0.5f, 0.0f,     0.0f, 0.0f,	//5 front left
-		0.25f, 0.5f, 0.0f,       1.0f, 1.0f,	//7 back right
-		0.25f, -0.5f, 0.0f,      1.0f, 0.0f,	//8 front right
+		-0.25f, -0.5f, 0.0f,     0.0f, 0.0f, 0.0f,	//5 front left
+		0.25f, 0.5f, 0.0f,       1.0f, 1.0f, 0.0f,	//7 back right
+		0.25f, -0.5f, 0.0f,      1.0f, 0.0f, 0.0f,	//8 front right
 
 
 		// usb main left face
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f,	//2 back left
-		-0.25f, 0.5f, 0.0f,      1.0f, 1.0f,	//6 back right 
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f, 0.0f,	//2 back left
+		-0.25f, 0.5f, 0.0f,      1.0f, 1.0f, 0.0f,	//6 back right 
 
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		-0.25f, -0.5f, 0.0f,     1.0f, 0.0f,	//5 front right
-		-0.25f, 0.5f, 0.0f,      1.0f, 1.0f,	//6 back right
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		-0.25f, -0.5f, 0.0f,     1.0f, 0.0f, 0.0f,	//5 front right
+		-0.25f, 0.5f, 0.0f,      1.0f, 1.0f, 0.0f,	//6 back right
 
 
 		// usb main right face
-		0.25f, -0.5f, 0.0f,      0.0f, 0.0f,	//8 front left
-		0.25f, 0.5f, 0.0f,       0.0f, 1.0f,	//7 back left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
+		0.25f, -0.5f, 0.0f,      0.0f, 0.0f, 0.0f,	//8 front left
+		0.25f, 0.5f, 0.0f,       0.0f, 1.0f, 0.0f,	//7 back left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
 
-		0.25f, -0.5f, 0.0f,      0.0f, 0.0f,	//8 front left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
-		0.25f, -0.5f, -0.25f,    1.0f, 0.0f,	//4 front right
+		0.25f, -0.5f, 0.0f,      0.0f, 0.0f, 0.0f,	//8 front left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
+		0.25f, -0.5f, -0.25f,    1.0f, 0.0f, 0.0f,	//4 front right
 
 
 		// usb main bottom face
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		-0.25f, -0.5f, 0.0f,     0.0f, 1.0f,	//5 back left
-		0.25f, -0.5f, 0.0f,      1.0f, 1.0f,	//8 back right
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		-0.25f, -0.5f, 0.0f,     0.0f, 1.0f, 0.0f,	//5 back left
+		0.25f, -0.5f, 0.0f,      1.0f, 1.0f, 0.0f,	//8 back right
 
-		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f,	//1 front left
-		0.25f, -0.5f, 0.0f,      1.0f, 1.0f,	//8 back right
-		0.25f, -0.5f, -0.25f,    1.0f, 0.0f,	//4 front right
+		-0.25f, -0.5f, -0.25f,   0.0f, 0.0f, 0.0f,	//1 front left
+		0.25f, -0.5f, 0.0f,      1.0f, 1.0f, 0.0f,	//8 back right
+		0.25f, -0.5f, -0.25f,    1.0f, 0.0f, 0.0f,	//4 front right
 
 
 		// usb main top face
-		-0.25f, 0.5f, 0.0f,      0.0f, 0.0f,	//6 fron tleft
-		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f,	//2 back left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
+		-0.25f, 0.5f, 0.0f,      0.0f, 0.0f, 0.0f,	//6 fron tleft
+		-0.25f, 0.5f, -0.25f,    0.0f, 1.0f, 0.0f,	//2 back left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
 
-		-0.25f, 0.5f, 0.0f,      0.0f, 0.0f,	//6 front left
-		0.25f, 0.5f, -0.25f,     1.0f, 1.0f,	//3 back right
-		0.25f, 0.5f, 0.0f,       1.0f, 0.0f,	//7 front right
+		-0.25f, 0.5f, 0.0f,      0.0f, 0.0f, 0.0f,	//6 front left
+		0.25f, 0.5f, -0.25f,     1.0f, 1.0f, 0.0f,	//3 back right
+		0.25f, 0.5f, 0.0f,       1.0f, 0.0f, 0.0f,	//7 front right
 
 
 		// usb input rear face 
-		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f,		//9 front left
-		-0.2f, 0.8f, -0.2f,     0.0f, 1.0f,		//10 back left
-		0.2f, 0.8f, -0.2f,      1.0f, 1.0f,		//11 back right
+		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f, 1.0f,		//9 front left
+		-0.2f, 0.8f, -0.2f,     0.0f, 1.0f, 1.0f,		//10 back left
+		0.2f, 0.8f, -0.2f,      1.0f, 1.0f, 1.0f,		//11 back right
 
-		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f,		//9 front left
-		0.2f, 0.8f, -0.2f,      1.0f, 1.0f,		//11 back right
-		0.2f, 0.5f, -0.2f,      1.0f, 0.0f,		//12 front right
+		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f, 1.0f,		//9 front left
+		0.2f, 0.8f, -0.2f,      1.0f, 1.0f, 1.0f,		//11 back right
+		0.2f, 0.5f, -0.2f,      1.0f, 0.0f, 1.0f,		//12 front right
 
 
 		// usb input front face 
-		-0.2f, 0.5f, -0.05f,    0.0f, 0.0f,		//13 front left
-		-0.2f, 0.8f, -0.05f,    0.0f, 1.0f,		//14 back left
-		0.2f, 0.8f, -0.05f,     1.0f, 1.0f,		//15 back right 
+		-0.2f, 0.5f, -0.05f,    0.0f, 0.0f, 1.0f,		//13 front left
+		-0.2f, 0.8f, -0.05f,    0.0f, 1.0f, 1.0f,		//14 back left
+		0.2f, 0.8f, -0.05f,     1.0f, 1.0f, 1.0f,		//15 back right 
 
-		-0.2f, 0.5f, -0.05f,    0.0f, 0.0f,		//13 front left
-		0.2f, 0.8f, -0.05f,     1.0f, 1.0f,		//15 back right 
-		0.2f, 0.5f, -0.05f,     1.0f, 0.0f,		//16 front right
+		-0.2f, 0.5f, -0.05f,    0.0f, 0.0f, 1.0f,		//13 front left
+		0.2f, 0.8f, -0.05f,     1.0f, 1.0f, 1.0f,		//15 back right 
+		0.2f, 0.5f, -0.05f,     1.0f, 0.0f, 1.0f,		//16 front right
 
 
 		// usb input left face 
-		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f,		//9 front left
-		-0.2f, 0.8f, -0.2f,     0.0f, 1.0f,		//10 back left
-		-0.2f, 0.8f, -0.05f,    1.0f, 1.0f,		//14 back right
+		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f, 1.0f,		//9 front left
+		-0.2f, 0.8f, -0.2f,     0.0f, 1.0f, 1.0f,		//10 back left
+		-0.2f, 0.8f, -0.05f,    1.0f, 1.0f, 1.0f,		//14 back right
 
-		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f,		//9 front left
-		-0.2f, 0.8f, -0.05f,    1.0f, 1.0f,		//14 back right
-		-0.2f, 0.5f, -0.05f,    1.0f, 0.0f,		//13 front right
+		-0.2f, 0.5f, -0.2f,     0.0f, 0.0f, 1.0f,		//9 front left
+		-0.2f, 0.8f, -0.05f,    1.0f, 1.0f, 1.0f,		//14 back right
+		-0.2f, 0.5f, -0.05f,    1.0f, 0.0f, 1.0f,		//13 front right
 
 
 		// usb input right face 
-		0.2f, 0.5f, -0.05f,     0.0f, 0.0f,		//16 front left
-		0.2f, 0.8f, -0.05f,     0.0f, 1.0f,		//15 back left
-		0.2f, 0.8f, -0.2f,      1.0f, 1.0f,		//11 back right
+		0.2f, 0.5f, -0.05f,     0.0f, 0.0f, 1.0f,		//16 front left
+		0.2f, 0.8f, -0.05f,     0.0f, 1.0f, 1.0f,		//15 back left
+		0.2f, 0.8f, -0.2f,      1.0f, 1.0f, 1.0f,		//11 back right
 
-		0.2f, 0.5f, -0.05f,     0.0f, 0.0f,		//16 front left
-		0.2f, 0.8f, -0.2f,      1.0f, 1.0f,		//11 back right
-		0.2f, 0.5f, -0.2f,      1.0f, 0.0f,		//12 front right
+		0.2f, 0.5f, -0.05f,     0.0f, 0.0f, 1.0f,		//16 front left
+		0.2f, 0.8f, -0.2f,      1.0f, 1.0f, 1.0f,		//11 back right
+		0.2f, 0.5f, -0.2f,      1.0f, 0.0f, 1.0f,		//12 front right
 
 
 		// usb input right face 
-		-0.2f, 0.8f, -0.05f,	0.0f, 0.0f,		//14 front left
-		-0.2f, 0.8f, -0.2f,		0.0f, 1.0f,		//10 back left
-		0.2f, 0.8f, -0.2f,		1.0f, 1.0f,		//11 back right
+		-0.2f, 0.8f, -0.05f,	0.0f, 0.0f, 1.0f,		//14 front left
+		-0.2f, 0.8f, -0.2f,		0.0f, 1.0f, 1.0f,		//10 back left
+		0.2f, 0.8f, -0.2f,		1.0f, 1.0f, 1.0f,		//11 back right
 
-		-0.2f, 0.8f, -0.05f,	0.0f, 0.0f,		//14 front left
-		0.2f, 0.8f, -0.2f,		1.0f, 1.0f,		//11 back right
-		0.2f, 0.8f, -0.05f,		1.0f, 0.0f,		//15 front right
+		-0.2f, 0.8f, -0.05f,	0.0f, 0.0f, 1.0f,		//14 front left
+		0.2f, 0.8f, -0.2f,		1.0f, 1.0f, 1.0f,		//11 back right
+		0.2f, 0.8f, -0.05f,		1.0f, 0.0f, 1.0f,		//15 front right
 
 
 		//plane (aerial)
-		-5.0f, -1.0f, -5.0f,	0.0f, 0.0f,		//1 front left
-		5.0f, -1.0f, -5.0f,		0.0f, 1.0f,		//2 back left
-		5.0f, -1.0f, 5.0f,		1.0f, 1.0f,		//3 back right
+		-5.0f, -1.0f, -5.0f,	0.0f, 0.0f, 2.0f,		//1 front left
+		5.0f, -1.0f, -5.0f,		0.0f, 1.0f, 2.0f,		//2 back left
+		5.0f, -1.0f, 5.0f,		1.0f, 1.0f, 2.0f,		//3 back right
 
-		-5.0f, -1.0f, -5.0f,	0.0f, 0.0f,		//1 front left
-		5.0f, -1.0f, 5.0f,		1.0f, 1.0f,		//3 back right
-		-5.0f, -1.0f, 5.0f,		1.0f, 0.0f		//4 front right
+		-5.0f, -1.0f, -5.0f,	0.0f, 0.0f, 2.0f,		//1 front left
+		5.0f, -1.0f, 5.0f,		1.0f, 1.0f, 2.0f,		//3 back right
+		-5.0f, -1.0f, 5.0f,		1.0f, 0.0f, 2.0f		//4 front right
 	};
 
 	const GLuint floatsPerVertex = 3;
 	const GLuint floatsPerUV = 2;
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerUV));
+	const GLuint floatsPerLayer = 1;
+	const GLuint stride = floatsPerVertex + floatsPerUV + floatsPerLayer;
+	const size_t nVertices = sizeof(verts) / (sizeof(verts[0]) * stride);
+
+	// Weld the repeated quad corners into shared vertices, one triangle at a time
+	for (size_t i = 0; i < nVertices; i += 3) {
+		const GLfloat* triangle = &verts[i * stride];
+		if (layer < 0.0f || triangle[floatsPerVertex + floatsPerUV] == layer)
+			builder.AddVertices(triangle, 3);
+	}
+}
+
+// Implements the UCreateMesh function
+void UCreateMesh(GLMesh &mesh) {
+	// Weld the repeated quad corners into shared vertices and order triangles for the vertex cache
+	MeshBuilder builder(MESH_LAYOUT.FloatsPerVertex());
+	UBuildMesh(builder, -1.0f);
+	const size_t nVertices = builder.IndexCount();
+
+	// Bounds of the positions, for the screen size estimates
+	glm::vec3 boundsMin, boundsMax;
+	UComputeBounds(builder, boundsMin, boundsMax);
+	USetMeshBounds(mesh, boundsMin, boundsMax);
+	float acmrBefore = builder.ComputeAcmr();
+	builder.OptimizeVertexCache();
+	cout << "INFO: Mesh welded " << nVertices << " -> " << builder.VertexCount() << " vertices, ACMR "
+		<< acmrBefore << " -> " << builder.ComputeAcmr() << endl;
+
+	// Triangles for picking, numbered in their final (drawn) order
+	gMeshBvh.Build(builder.Vertices().data(), builder.VertexCount(), MESH_LAYOUT.FloatsPerVertex(), builder.Indices().data(), builder.IndexCount());
+
 	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
 	glBindVertexArray(mesh.vao);
 
-	// Create VBO
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Create 2 buffers: first one for the vertex data; second one for the indices
+	glGenBuffers(2, mesh.vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+	glBufferData(GL_ARRAY_BUFFER, builder.Vertices().size() * sizeof(float), builder.Vertices().data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+
+	// Index buffer, 16-bit whenever the vertex count allows it
+	mesh.nIndices = static_cast<GLuint>(builder.IndexCount());
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	if (builder.UsesShortIndices()) {
+		vector<uint16_t> indices = builder.ShortIndices();
+		mesh.indexType = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+	}
+	else {
+		mesh.indexType = GL_UNSIGNED_INT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, builder.Indices().size() * sizeof(uint32_t), builder.Indices().data(), GL_STATIC_DRAW);
+	}
+
+	// Create Vertex Attribute Pointers
+	UEnableMeshAttributes();
+}
+
+// Loads an OBJ or glTF model, through its precooked .mesh cache when possible
+bool UCreateMeshFromFile(const char* filename, GLMesh &mesh) {
+	if (gMeshCacheEnabled && UCreateMeshFromCache(filename, mesh))
+		return true;
+
+	// No usable cache (e.g. the model directory is read-only): parse the model directly
+	return UStreamMeshFromFile(filename, mesh);
+}
+
+// Uploads <model>.mesh with one buffer call per blob, cooking it first if it is missing or stale
+bool UCreateMeshFromCache(const char* filename, GLMesh &mesh) {
+	// The cache is keyed by the source contents, so any edit to the model rebuilds it
+	MappedFile source;
+	if (!source.Open(filename))
+		return false;
+	uint64_t sourceHash = HashBytes(source.Data(), source.Size());
+	source.Close();
+
+	string cachePath = string(filename) + ".mesh";
+	// kept mapped until the first pick builds gMeshBvh from it
+	MeshCache& cache = gMeshBvhSource;
+	if (!cache.Open(cachePath, sourceHash, MESH_LAYOUT)) {
+		if (!UCookMeshCache(filename, sourceHash, cachePath) || !cache.Open(cachePath, sourceHash, MESH_LAYOUT))
+			return false;
+	}
+
+	const MeshCacheHeader& header = cache.Header();
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	glGenBuffers(2, mesh.vbos);
+
+	// Immutable storage, filled straight from the mapped file
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferStorage(GL_ARRAY_BUFFER, header.VertexBytes, cache.VertexData(), 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, header.IndexBytes, cache.IndexData(), 0);
 
+	mesh.nIndices = static_cast<GLuint>(header.IndexCount);
+	mesh.indexType = header.IndexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	USetMeshBounds(mesh, glm::make_vec3(header.BoundsMin), glm::make_vec3(header.BoundsMax));
+
+	// Triangles for picking are read from the mapping too, but only once something is picked
+	gMeshBvhPending = true;
+
+	UEnableMeshAttributes();
+	glBindVertexArray(0);
+
+	cout << "INFO: Loaded " << cachePath << " (" << header.IndexCount / 3 << " triangles, " << header.VertexCount << " vertices)" << endl;
+	return true;
+}
+
+// Parses the model once (the loader welds it), cache-optimizes it, and writes the .mesh file
+bool UCookMeshCache(const char* filename, uint64_t sourceHash, const string& cachePath) {
+	ModelLoader loader;
+	if (!loader.Open(filename) || loader.VertexCount() == 0)
+		return false;
+
+	vector<float> vertices(loader.VertexCount() * MODEL_FLOATS_PER_VERTEX);
+	vector<uint32_t> indices(loader.IndexCount());
+	if (!loader.WriteVertices(vertices.data()) || !loader.WriteIndices(indices.data(), false))
+		return false;
+
+	MeshBuilder builder(MESH_LAYOUT.FloatsPerVertex());
+	builder.AddIndexed(vertices.data(), loader.VertexCount(), indices.data(), indices.size());
+	builder.OptimizeVertexCache();
+
+	cout << "INFO: Cooking " << cachePath << " (" << builder.VertexCount() << " vertices)" << endl;
+	return MeshCache::Write(cachePath, sourceHash, MESH_LAYOUT, builder);
+}
+
+// Loads an OBJ or glTF model, writing its vertices and indices straight into mapped GL buffers
+bool UStreamMeshFromFile(const char* filename, GLMesh &mesh) {
+	ModelLoader loader;
+	if (!loader.Open(filename) || loader.VertexCount() == 0) {
+		cout << "Failed to load model " << filename << ": " << (loader.Error().empty() ? "no triangles" : loader.Error()) << endl;
+		return false;
+	}
+
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	glGenBuffers(2, mesh.vbos);
+
+	// Allocate both buffers and let the loader's workers fill the mappings directly
+	GLsizeiptr vertexBytes = loader.VertexCount() * MODEL_FLOATS_PER_VERTEX * sizeof(float);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+	void* vertices = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	bool shortIndices = loader.VertexCount() <= 0xFFFF;
+	mesh.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	mesh.radius = 0.0f; // the vertices only pass through write-only mappings, so the bounds stay unknown
+	mesh.extents = glm::vec3(0.0f);
+	mesh.nIndices = static_cast<GLuint>(loader.IndexCount());
+	GLsizeiptr indexBytes = loader.IndexCount() * (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+	void* indices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indexBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	bool written = vertices != nullptr && indices != nullptr
+		&& loader.WriteVertices(static_cast<float*>(vertices))
+		&& loader.WriteIndices(indices, shortIndices);
+
+	// Unmapping fails if the driver lost the buffer contents in the meantime
+	if (vertices != nullptr && !glUnmapBuffer(GL_ARRAY_BUFFER))
+		written = false;
+	if (indices != nullptr && !glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER))
+		written = false;
+
+	UEnableMeshAttributes();
+	glBindVertexArray(0);
+
+	if (!written) {
+		cout << "Failed to load model " << filename << ": " << (loader.Error().empty() ? "buffer mapping failed" : loader.Error()) << endl;
+		UDestroyMesh(mesh);
+		return false;
+	}
+
+	cout << "INFO: Loaded " << filename << " (" << loader.IndexCount() / 3 << " triangles, " << loader.ThreadCount() << " threads)" << endl;
+	return true;
+}
+
+// Creates the vertex attribute pointers of MESH_LAYOUT for the bound VAO and vertex buffer
+void UEnableMeshAttributes() {
 	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
+	GLint stride = sizeof(float) * MESH_LAYOUT.FloatsPerVertex();
 
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(2);
+	size_t offset = 0;
+	for (uint32_t i = 0; i < MESH_LAYOUT.AttributeCount; ++i) {
+		glVertexAttribPointer(MESH_LAYOUT.Locations[i], MESH_LAYOUT.Components[i], GL_FLOAT, GL_FALSE, stride, (void*)offset);
+		glEnableVertexAttribArray(MESH_LAYOUT.Locations[i]);
+		offset += sizeof(float) * MESH_LAYOUT.Components[i];
+	}
 }
 
 void UDestroyMesh(GLMesh &mesh) {
 	glDeleteVertexArrays(1, &mesh.vao);
-	glDeleteBuffers(1, &mesh.vbo);
+	glDeleteBuffers(2, mesh.vbos);
 }
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint &textureId) {
-	int width, height, channels;
-	unsigned char *image = stbi_load(filename, &width, &height, &channels, 0);
+// Creates the vertex array of an instanced draw: the mesh's vertex and index buffers plus the per-instance attributes
+void UCreateInstancedMesh(const GLMesh &mesh, InstanceBuffer &instances) {
+	instances.Create();
+	glBindVertexArray(instances.Vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	UEnableMeshAttributes();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	instances.EnableAttributes();
+	glBindVertexArray(0);
+}
+
+// Queues every uploaded instance of the mesh as a single call (the instances span the scene, so it has no depth)
+void UQueueInstanced(const GLMesh &mesh, const InstanceBuffer &instances, GLuint texture) {
+	if (instances.Count() == 0)
+		return;
+	RenderCommand command;
+	command.Program = gInstancedProgram.Id;
+	command.Vao = instances.Vao;
+	command.Texture = texture;
+	command.Draw = RenderDraw::Instanced;
+	command.IndexType = mesh.indexType;
+	command.Count = mesh.nIndices;
+	command.InstanceCount = instances.Count();
+	gRenderQueue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, 0), command);
+}
+
+// Queues the instances [first, last) one call each, feeding the same shader its per-instance attributes as constant
+// vertex attributes (the mesh's own vertex array leaves those locations disabled); the cost instancing removes.
+// Instances whose visible flag is clear are skipped
+void UQueueEachInstance(const GLMesh &mesh, const InstanceBuffer &instances, const uint8_t* visible, GLuint texture, size_t first, size_t last, RenderQueue &queue) {
+	RenderCommand command;
+	command.Program = gInstancedProgram.Id;
+	command.Vao = mesh.vao;
+	command.Texture = texture;
+	command.IndexType = mesh.indexType;
+	command.Count = mesh.nIndices;
+	for (size_t i = first; i < last; ++i) {
+		if (visible != nullptr && !visible[i])
+			continue;
+		command.Instance = &instances.Instances[i];
+		queue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, UQueueDepth(glm::vec3(command.Instance->World[3]))), command);
+	}
+}
 
-	if (image) {
-		flipImageVertically(image, width, height, channels);
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
+// Places count copies of the mesh on a square grid below the original, each with its own spin and tint
+void UCreateStressScene(int count) {
+	gStressInstances.Instances.resize(count);
+	for (int i = 0; i < count; ++i) {
+		glm::vec3 position = UGridPosition(i, count, -3.0f);
+		TransformSystem::Handle handle = gTransforms.Add(position, 0.7f * i, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.5f, 0.5f, 0.5f));
+		gTransforms.SetBounds(handle, gMesh.center, gMesh.radius, gMesh.extents);
+		if (gMeshBvh.TriangleCount() > 0 || gMeshBvhPending)
+			gSceneBvh.SetMesh(handle, &gMeshBvh);
+		if (i == 0)
+			gStressFirstTransform = handle;
+
+		InstanceData& instance = gStressInstances.Instances[i];
+		instance.World = glm::mat4(1.0f);	// filled in by the first URender
+		instance.Tint = glm::vec4(0.6f + 0.4f * sin(0.37f * i), 0.6f + 0.4f * sin(0.59f * i + 2.0f), 0.6f + 0.4f * sin(0.83f * i + 4.0f), 1.0f);
+		instance.Layer = -1.0f;
+	}
 
-		// set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	UCreateInstancedMesh(gMesh, gStressInstances);
+	cout << "INFO: Stress scene: " << count << " instances, " << (gStressInstancing ? "instanced" : "one draw call each") << endl;
+}
 
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Position of object index of count on a square grid of STRESS_SPACING cells centered under the origin
+glm::vec3 UGridPosition(int index, int count, float height) {
+	const int side = static_cast<int>(ceil(sqrt(static_cast<float>(count))));
+	const float origin = -0.5f * STRESS_SPACING * (side - 1);
+	return glm::vec3(origin + STRESS_SPACING * (index % side), height, origin + STRESS_SPACING * (index / side));
+}
 
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else {
-			cout << "Not implemented to handle image with " << channels << " channels" << endl;
-			return false;
+// Uploads every mesh of the pool into one vertex and one 32-bit index buffer (the pool keeps each mesh's range and bounds)
+void UCreateMeshPool(const MeshPool &pool, GLMesh &mesh) {
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	glGenBuffers(2, mesh.vbos);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, pool.Vertices().size() * sizeof(float), pool.Vertices().data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, pool.Indices().size() * sizeof(uint32_t), pool.Indices().data(), GL_STATIC_DRAW);
+	mesh.nIndices = static_cast<GLuint>(pool.Indices().size());
+	mesh.indexType = GL_UNSIGNED_INT;
+	mesh.radius = 0.0f;
+	mesh.extents = glm::vec3(0.0f);
+
+	UEnableMeshAttributes();
+	glBindVertexArray(0);
+}
+
+// Creates the vertex array of a multi-draw: the pool's vertex and index buffers plus the draw index attribute
+void UCreateIndirectDraws(const GLMesh &poolMesh, IndirectDrawList &draws) {
+	draws.Create();
+	glBindVertexArray(draws.Vao);
+	glBindBuffer(GL_ARRAY_BUFFER, poolMesh.vbos[0]);
+	UEnableMeshAttributes();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, poolMesh.vbos[1]);
+	draws.EnableAttributes();
+	glBindVertexArray(0);
+}
+
+// Queues every draw of the list as a single call
+void UQueueIndirect(const IndirectDrawList &draws, GLuint texture) {
+	RenderCommand command;
+	command.Program = gIndirectProgram.Id;
+	command.Vao = draws.Vao;
+	command.Texture = texture;
+	command.DrawBuffer = draws.DrawBuffer;
+	command.IndirectBuffer = draws.CommandBuffer;
+	command.Draw = RenderDraw::MultiIndirect;
+	command.Count = draws.Count();
+	gRenderQueue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, 0), command);
+}
+
+// Queues the draws [first, last) one call each from the CPU copy of the commands, each at its object's depth; the
+// cost multi-draw removes
+void UQueueEachIndirect(const IndirectDrawList &draws, GLuint texture, size_t first, size_t last, RenderQueue &queue) {
+	RenderCommand command;
+	command.Program = gIndirectProgram.Id;
+	command.Vao = draws.Vao;
+	command.Texture = texture;
+	command.DrawBuffer = draws.DrawBuffer;
+	command.Draw = RenderDraw::ElementsBaseInstance;
+	for (size_t i = first; i < last; ++i) {
+		const DrawElementsIndirectCommand& indirect = draws.Commands[i];
+		if (indirect.InstanceCount == 0)
+			continue;
+		command.Count = indirect.Count;
+		command.InstanceCount = indirect.InstanceCount;
+		command.FirstIndex = indirect.FirstIndex;
+		command.BaseVertex = indirect.BaseVertex;
+		command.BaseInstance = indirect.BaseInstance;
+		queue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, UQueueDepth(glm::vec3(draws.Draws[i].World[3]))), command);
+	}
+}
+
+// Frustum culls the draws on the GPU: the compute pass compacts the visible commands and counts them. The late
+// pass of occlusion culling also tests them against the depth pyramid, and writes to its own buffers.
+void UCullIndirectOnGpu(const IndirectDrawList &draws, const GpuCuller &culler, int phase) {
+	const bool late = phase == CULL_PHASE_LATE;
+	culler.Clear(!gIndirectCount, late);
+	culler.Bind(draws, late);
+	glUseProgram(gCullProgram.Id);
+	gCullProgram.Set(gCullPhaseUniform, phase);
+	if (late) {
+		glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, gDepthPyramid.Pyramid);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	glDispatchCompute(culler.GroupCount(), 1, 1);
+	// the draw reads the commands and the count as indirect parameters, the late pass the early pass's visibility
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Queues the commands the GPU culling kept, as many as it counted (or every slot, the empty ones drawing nothing)
+void UQueueIndirectCount(const IndirectDrawList &draws, const GpuCuller &culler, GLuint texture, bool late) {
+	RenderCommand command;
+	command.Program = gIndirectProgram.Id;
+	command.Vao = draws.Vao;
+	command.Texture = texture;
+	command.DrawBuffer = draws.DrawBuffer;
+	command.IndirectBuffer = culler.Commands(late);
+	command.ParameterBuffer = culler.Counts(late);
+	command.Draw = gIndirectCount ? RenderDraw::MultiIndirectCount : RenderDraw::MultiIndirect;
+	command.Count = culler.Count();
+	gRenderQueue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, 0), command);
+}
+
+// Queues one object drawn with its own vertex array; its uniforms are already set
+void UQueueMesh(const ShaderProgram &program, const GLMesh &mesh, GLuint texture, TransformSystem::Handle handle) {
+	RenderCommand command;
+	command.Program = program.Id;
+	command.Vao = mesh.vao;
+	command.Texture = texture;
+	command.IndexType = mesh.indexType;
+	command.Count = mesh.nIndices;
+	gRenderQueue.Add(RenderQueue::Key(RENDER_PASS_OPAQUE, command.Program, texture, command.Vao, UQueueDepth(glm::vec3(gTransforms.World(handle)[3]))), command);
+}
+
+// First pass over the objects: every worker updates the matrices of an even share of the transform batches, then
+// culls the same batches while they are still in its cache
+void UUpdateObjects(const glm::mat4& viewProjection, const glm::vec4 frustum[6]) {
+	const bool linearCulling = gCullingEnabled && !gBvhCulling;	// --bvh-cull culls after the tree is updated
+	gTransforms.BeginUpdate(viewProjection);
+	if (linearCulling)
+		gCuller.BeginCull(gTransforms, gGpuCulling ? gMdiFirstTransform : SIZE_MAX);
+
+	gWorkers.Run([&](unsigned int worker) {
+		ObjectWorker& objectWorker = gObjectWorkers[worker];
+		size_t first, last;
+		WorkerPool::Split(gTransforms.Batches(), worker, gWorkers.Count(), first, last);
+		objectWorker.worlds = objectWorker.mvps = 0;
+		gTransforms.UpdateBatches(first, last, objectWorker.worlds, objectWorker.mvps);
+		objectWorker.visible = linearCulling ? gCuller.CullBatches(gTransforms, frustum, first, last) : 0;
+	});
+
+	size_t worlds = 0, mvps = 0, visible = 0;
+	for (const ObjectWorker& objectWorker : gObjectWorkers) {
+		worlds += objectWorker.worlds;
+		mvps += objectWorker.mvps;
+		visible += objectWorker.visible;
+	}
+	gTransforms.EndUpdate(worlds, mvps);
+	if (linearCulling)
+		gCuller.EndCull(visible);
+}
+
+// Second pass over the objects: every worker takes an even share of the stress and multi-draw objects, copies
+// their transforms into the instances and into its own range of the mapped per-draw buffer, writes their
+// commands' instance counts, and records their per-object draws in its own queue. The main thread maps and
+// unmaps the buffers and merges the queues; only the buffers whose contents changed are mapped.
+void UPackObjects(bool moved, bool visibilityChanged, GLuint texture) {
+	const uint8_t* visible = gCullingEnabled ? gCuller.VisibleFlags() : nullptr;
+	const bool writeDraws = gMdiCount > 0 && moved;
+	const bool writeCommands = gMdiCount > 0 && visibilityChanged && !gGpuCulling;	// GPU culling never changes them
+	DrawData* mappedDraws = writeDraws ? gMdiDraws.MapDraws() : nullptr;
+	DrawElementsIndirectCommand* mappedCommands = writeCommands ? gMdiDraws.MapCommands() : nullptr;
+
+	gWorkers.Run([&](unsigned int worker) {
+		RenderQueue& queue = gObjectWorkers[worker].queue;
+		queue.Clear();
+
+		size_t first, last;
+		WorkerPool::Split(gStressCount, worker, gWorkers.Count(), first, last);
+		if (moved) {
+			for (size_t i = first; i < last; ++i)
+				gStressInstances.Instances[i].World = gTransforms.World(static_cast<TransformSystem::Handle>(gStressFirstTransform + i));
+		}
+		if (gStressCount > 0 && !gStressInstancing)
+			UQueueEachInstance(gMesh, gStressInstances, visible != nullptr ? visible + gStressFirstTransform : nullptr, texture, first, last, queue);
+
+		WorkerPool::Split(gMdiCount, worker, gWorkers.Count(), first, last);
+		for (size_t i = first; i < last; ++i) {
+			const TransformSystem::Handle handle = static_cast<TransformSystem::Handle>(gMdiFirstTransform + i);
+			if (writeDraws) {
+				gMdiDraws.Draws[i].World = gTransforms.World(handle);
+				if (mappedDraws != nullptr)
+					mappedDraws[i] = gMdiDraws.Draws[i];
+			}
+			if (writeCommands) {
+				gMdiDraws.Commands[i].InstanceCount = visible == nullptr || visible[handle] ? 1 : 0;
+				if (mappedCommands != nullptr)
+					mappedCommands[i] = gMdiDraws.Commands[i];
+			}
 		}
+		if (gMdiCount > 0 && !gMdiEnabled)
+			UQueueEachIndirect(gMdiDraws, texture, first, last, queue);
+	});
+
+	// a buffer that could not be mapped, or lost its mapped contents, gets the CPU copy uploaded instead
+	if (writeDraws && (mappedDraws == nullptr || !gMdiDraws.UnmapDraws()))
+		gMdiDraws.UploadDraws();
+	if (writeCommands && (mappedCommands == nullptr || !gMdiDraws.UnmapCommands()))
+		gMdiDraws.UploadCommands();
+
+	for (const ObjectWorker& objectWorker : gObjectWorkers)
+		gRenderQueue.Append(objectWorker.queue);
+}
 
-		glGenerateMipmap(GL_TEXTURE_2D);
-		stbi_image_free(image);
-		glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-		return true;
+// Sort key depth of a world position: its distance in front of the camera, quantized
+uint32_t UQueueDepth(const glm::vec3& position) {
+	return RenderQueue::QuantizeDepth(glm::dot(position - gCamera.Position, gCamera.Front), CAMERA_FAR_PLANE);
+}
+
+// Issues the sorted draws, binding only the state that differs from the draw before. Everything bound outside
+// the queue since it last ran (uploads, compute passes, texture streaming) is forgotten first.
+void UExecuteRenderQueue() {
+	gStateCache.Invalidate();
+	for (size_t i = 0; i < gRenderQueue.Count(); ++i) {
+		const RenderCommand& command = gRenderQueue[i];
+		gStateCache.UseProgram(command.Program);
+		gStateCache.BindVertexArray(command.Vao);
+		if (command.Texture != 0)
+			gStateCache.BindTexture(0, GL_TEXTURE_2D_ARRAY, command.Texture);
+		if (command.DrawBuffer != 0)
+			gStateCache.BindStorageBuffer(DRAW_DATA_BINDING, command.DrawBuffer);
+
+		switch (command.Draw) {
+		case RenderDraw::Elements:
+			if (command.Instance != nullptr) {
+				for (GLuint column = 0; column < 4; ++column)
+					glVertexAttrib4fv(INSTANCE_WORLD_LOCATION + column, glm::value_ptr(command.Instance->World[column]));
+				glVertexAttrib4fv(INSTANCE_TINT_LOCATION, glm::value_ptr(command.Instance->Tint));
+				glVertexAttrib1f(INSTANCE_LAYER_LOCATION, command.Instance->Layer);
+			}
+			glDrawElements(GL_TRIANGLES, command.Count, command.IndexType, NULL);
+			break;
+		case RenderDraw::Instanced:
+			glDrawElementsInstanced(GL_TRIANGLES, command.Count, command.IndexType, NULL, command.InstanceCount);
+			break;
+		case RenderDraw::ElementsBaseInstance:
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.Count, command.IndexType, (void*)(command.FirstIndex * sizeof(uint32_t)),
+				command.InstanceCount, command.BaseVertex, command.BaseInstance);
+			break;
+		case RenderDraw::MultiIndirect:
+			gStateCache.BindIndirectBuffer(command.IndirectBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, command.IndexType, NULL, command.Count, 0);
+			break;
+		case RenderDraw::MultiIndirectCount:
+			gStateCache.BindIndirectBuffer(command.IndirectBuffer);
+			gStateCache.BindParameterBuffer(command.ParameterBuffer);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, command.IndexType, NULL, 0, command.Count, 0);
+			break;
+		}
+		++gDrawCalls;
+	}
+
+	// the code outside the queue expects no indirect buffers bound
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	if (gIndirectCount)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+}
+
+// Reduces the depth buffer drawn so far into the depth pyramid: level 0 converts it to R32F, every level after
+// it keeps the farthest depth of the level before. False when there is no framebuffer to reduce (minimized).
+bool UBuildDepthPyramid() {
+	// the pyramid follows the framebuffer
+	int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+	if (!gHeadless)
+		glfwGetFramebufferSize(gWindow, &width, &height);
+	if (width == 0 || height == 0)
+		return false;
+	if (width != gDepthPyramid.Width || height != gDepthPyramid.Height) {
+		gDepthPyramid.Destroy();
+		gDepthPyramid.Create(width, height);
+	}
+	gDepthPyramid.CopyDepth();
+
+	glUseProgram(gHizProgram.Id);
+	glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+	for (int level = 0; level < gDepthPyramid.Levels; ++level) {
+		glBindTexture(GL_TEXTURE_2D, level == 0 ? gDepthPyramid.DepthTexture : gDepthPyramid.Pyramid);
+		gHizProgram.Set(gHizLevelUniform, level == 0 ? 0 : level - 1);
+		glBindImageTexture(0, gDepthPyramid.Pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((gDepthPyramid.LevelWidth(level) + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE,
+			(gDepthPyramid.LevelHeight(level) + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+		// the next level, and the next frame's culling, read this one through a sampler
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(0);
+	return true;
+}
+
+// Places count objects on a grid under the stress scene, cycling through the distinct meshes of a pool: the
+// usb body, the usb input and the plane of the built-in mesh, and the whole drive
+void UCreateMdiScene(int count) {
+	const float layers[] = { 0.0f, 1.0f, 2.0f, -1.0f };
+	const float scales[] = { 0.5f, 0.5f, 0.05f, 0.5f };	// the plane is 10 units wide
+	const int meshCount = sizeof(layers) / sizeof(layers[0]);
+
+	MeshPool pool(MESH_LAYOUT.FloatsPerVertex());
+	vector<PoolMesh> meshes;
+	gPoolBvhs.resize(meshCount);	// sized once, SceneBvh keeps pointers to them
+	for (int m = 0; m < meshCount; ++m) {
+		MeshBuilder builder(MESH_LAYOUT.FloatsPerVertex());
+		UBuildMesh(builder, layers[m]);
+		builder.OptimizeVertexCache();
+		meshes.push_back(pool.Add(builder));
+		gPoolBvhs[m].Build(builder.Vertices().data(), builder.VertexCount(), MESH_LAYOUT.FloatsPerVertex(), builder.Indices().data(), builder.IndexCount());
+	}
+	UCreateMeshPool(pool, gPoolMesh);
+
+	for (int i = 0; i < count; ++i) {
+		float scale = scales[i % meshCount];
+		const PoolMesh& mesh = meshes[i % meshCount];
+		TransformSystem::Handle handle = gTransforms.Add(UGridPosition(i, count, -5.0f), 0.5f * i, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(scale, scale, scale));
+		gTransforms.SetBounds(handle, mesh.Center, mesh.Radius, mesh.Extents);
+		gSceneBvh.SetMesh(handle, &gPoolBvhs[i % meshCount]);
+		if (i == 0)
+			gMdiFirstTransform = handle;
+		// the world matrix is filled in by the first URender
+		glm::vec4 tint(0.6f + 0.4f * sin(0.41f * i + 1.0f), 0.6f + 0.4f * sin(0.67f * i + 3.0f), 0.6f + 0.4f * sin(0.29f * i + 5.0f), 1.0f);
+		gMdiDraws.Add(mesh, glm::mat4(1.0f), tint, -1.0f);
+		gMdiCuller.Add(mesh);
+	}
+
+	UCreateIndirectDraws(gPoolMesh, gMdiDraws);
+	gMdiDraws.Upload();
+	cout << "INFO: Multi-draw scene: " << count << " objects of " << meshCount << " distinct meshes, "
+		<< (gMdiEnabled ? "one glMultiDrawElementsIndirect" : "one draw call each") << endl;
+
+	// GPU culling needs the multi-draw (separate draw calls would need the visibility on the CPU)
+	if (gGpuCulling && (!gMdiEnabled || !gCullingEnabled)) {
+		cout << "INFO: GPU culling disabled: it needs multi-draw and culling enabled" << endl;
+		gGpuCulling = gOcclusionCulling = false;
+	}
+	if (gGpuCulling) {
+		gIndirectCount = GLEW_ARB_indirect_parameters != 0;
+		gMdiCuller.Create();
+		gMdiCuller.Upload();
+		cout << "INFO: GPU culling: compute pass, " << (gIndirectCount ? "glMultiDrawElementsIndirectCount" : "fixed-count glMultiDrawElementsIndirect") << endl;
+		if (gOcclusionCulling)
+			cout << "INFO: Occlusion culling: early and late pass around a depth pyramid of the frame" << (gBenchmark ? ", off every other frame for the baseline" : "") << endl;
+	}
+}
 
-	// Error loading the image
-	return false;
+// True unless frustum culling is on and rejected the object this frame
+bool UVisible(TransformSystem::Handle handle) {
+	return !gCullingEnabled || gCuller.Visible(handle);
 }
 
-void UDestroyTexture(GLuint textureId) {
-	glGenTextures(1, &textureId);
+// Casts a ray from the camera through window point (x, y) and reports the nearest object and triangle it hits
+void UPick(double x, double y) {
+	// the ray runs between the unprojected near and far plane points under the pixel
+	glm::mat4 toWorld = glm::inverse(UCameraProjection() * gCamera.GetViewMatrix());
+	float ndcX = static_cast<float>(2.0 * x / WINDOW_WIDTH - 1.0);
+	float ndcY = static_cast<float>(1.0 - 2.0 * y / WINDOW_HEIGHT);
+	glm::vec4 nearPoint = toWorld * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = toWorld * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+	if (gMeshBvhPending)
+		UBuildMeshBvhFromCache();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	SceneBvh::Hit hit;
+	bool found = gSceneBvh.Raycast(gTransforms, origin, direction, hit);
+	double elapsedUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+	if (found)
+		cout << "INFO: Picked object " << hit.Object << ", triangle " << hit.Triangle << " at distance " << hit.Distance << " (" << elapsedUs << " us)" << endl;
+	else
+		cout << "INFO: Picked nothing (" << elapsedUs << " us)" << endl;
 }
 
+// Builds gMeshBvh from the .mesh file gMesh was loaded from, then lets the mapping go
+void UBuildMeshBvhFromCache() {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	const MeshCacheHeader& header = gMeshBvhSource.Header();
+	const float* vertexData = static_cast<const float*>(gMeshBvhSource.VertexData());
+	if (header.IndexSize == 2)
+		gMeshBvh.Build(vertexData, header.VertexCount, MESH_LAYOUT.FloatsPerVertex(), static_cast<const uint16_t*>(gMeshBvhSource.IndexData()), header.IndexCount);
+	else
+		gMeshBvh.Build(vertexData, header.VertexCount, MESH_LAYOUT.FloatsPerVertex(), static_cast<const uint32_t*>(gMeshBvhSource.IndexData()), header.IndexCount);
+	gMeshBvhSource.Close();
+	gMeshBvhPending = false;
+	cout << "INFO: Built the picking BVH of " << gMeshBvh.TriangleCount() << " triangles ("
+		<< chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms)" << endl;
+}
+
+// Axis-aligned box of the positions (the first three floats of every vertex) of a welded mesh
+void UComputeBounds(const MeshBuilder &builder, glm::vec3 &boundsMin, glm::vec3 &boundsMax) {
+	const vector<float>& vertices = builder.Vertices();
+	boundsMin = vertices.empty() ? glm::vec3(0.0f) : glm::make_vec3(&vertices[0]);
+	boundsMax = boundsMin;
+	for (size_t v = 0; v < vertices.size(); v += builder.FloatsPerVertex()) {
+		glm::vec3 position = glm::make_vec3(&vertices[v]);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+}
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId) {
-	// Compilation and linkage error reporting
-	int success = 0;
-	char infoLog[512];
+// Stores the bounding sphere of an axis-aligned box of model-space positions
+void USetMeshBounds(GLMesh &mesh, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+	mesh.center = (boundsMin + boundsMax) * 0.5f;
+	mesh.radius = glm::length(boundsMax - boundsMin) * 0.5f;
+	mesh.extents = (boundsMax - boundsMin) * 0.5f;
+}
 
-	// Create a Shader program object.
-	programId = glCreateProgram();
+// Approximate size in pixels of the mesh on screen: its bounding sphere projected at its distance from the camera.
+// Unknown bounds, the orthographic view, and a camera inside the sphere all count as filling the window
+float UProjectedSize(const GLMesh &mesh, const glm::mat4& model) {
+	if (mesh.radius <= 0.0f || gCamera.OrthographicView)
+		return (float)WINDOW_HEIGHT;
+
+	glm::vec3 center = glm::vec3(model * glm::vec4(mesh.center, 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	float radius = mesh.radius * scale;
+	float distance = glm::length(center - gCamera.Position);
+	if (distance <= radius)
+		return (float)WINDOW_HEIGHT;
+	return radius / (distance * tan(glm::radians(gCamera.Zoom) * 0.5f)) * WINDOW_HEIGHT;
+}
 
-	// Create the vertex and fragment shader objects
-	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+/*Register a 2D texture array, one layer per image (all images must have the same size), with the residency manager. Only
+the smallest mips are uploaded here, the finer ones stream in once the array appears large enough on screen*/
+bool UCreateTextureArray(const char* const filenames[], int layers, TextureResidency::Handle &handle) {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	// Prefer the block-compressed .ktx2 files written by --encode-ktx2, otherwise stream the RGBA8 mip chains
+	string description;
+	unique_ptr<TextureSource> source = UOpenCompressedTextureSource(filenames, layers);
+	if (source)
+		description = source->InternalFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? "BC3" : "BC1";
+	else {
+		unique_ptr<MipChainTextureSource> chains(new MipChainTextureSource());
+		if (!chains->Open(filenames, layers, gTextureCacheEnabled)) {
+			cout << chains->Error() << endl;
+			return false;
+		}
+		description = chains->FromCache() ? "RGBA8, mip chains from cache" : "RGBA8, decoded";
+		source = move(chains);
+	}
+	handle = gTextureResidency.Add(move(source));
 
-	// Retrive the shader source
-	glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-	glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+	double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "INFO: Loaded " << layers << " textures (" << description << ") in " << elapsedMs << " ms, "
+		<< gTextureResidency.ResidentBytes() / 1024 << " KB resident up to level " << gTextureResidency.VisibleLevel(handle) << endl;
+	return true;
+}
 
-	// Compile the vertex shader, and print compilation errors (if any)
-	glCompileShader(vertexShaderId); // compile the vertex shader
 
-	// check for shader compile errors
-	glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+/*Open the .ktx2 file of every image as one texture array source; nullptr falls back to the uncompressed images*/
+unique_ptr<TextureSource> UOpenCompressedTextureSource(const char* const filenames[], int layers) {
+	// Every layer needs a .ktx2 file and they must share size and mip count
+	unique_ptr<Ktx2TextureSource> source(new Ktx2TextureSource());
+	if (!source->Open(filenames, layers)) {
+		if (!source->Error().empty())
+			cout << "INFO: Using uncompressed textures: " << source->Error() << endl;
+		return nullptr;
+	}
+	if (!GLEW_EXT_texture_compression_s3tc) {
+		cout << "INFO: Using uncompressed textures: the driver does not support S3TC" << endl;
+		return nullptr;
+	}
+	return source;
+}
+
+
+/*Compress an image into a .ktx2 file next to it: BC1, or BC3 when it has transparent pixels, with a full mip chain filtered in linear light*/
+bool UEncodeKtx2(const char* filename) {
+	int width, height, channels;
+	unsigned char *image = stbi_load(filename, &width, &height, &channels, 4);
+	if (!image) {
+		cout << "Failed to load texture " << filename << endl;
+		return false;
+	}
+	vector<unsigned char> pixels(image, image + static_cast<size_t>(width) * height * 4);
+	stbi_image_free(image);
+
+	// Bottom row first, the order every level is uploaded in
+	const ImageKernels& kernels = GetImageKernels();
+	kernels.FlipRows(pixels.data(), static_cast<size_t>(width) * 4, height);
+
+	bool alpha = false;
+	for (size_t i = 3; i < pixels.size() && !alpha; i += 4)
+		alpha = pixels[i] != 255;
+
+	// Compress level 0, then halve with the box filter (averaged in linear light, like the .mips chains) and repeat down to 1x1
+	vector<vector<unsigned char>> levels;
+	vector<unsigned char> smaller;
+	for (int levelWidth = width, levelHeight = height;;) {
+		levels.push_back(BlockCompressor::Compress(pixels.data(), levelWidth, levelHeight, alpha));
+		if ((levelWidth == 1 && levelHeight == 1) || levels.size() == KTX2_MAX_LEVELS)
+			break;
+		smaller.resize(static_cast<size_t>(max(1, levelWidth / 2)) * max(1, levelHeight / 2) * 4);
+		kernels.DownsampleSrgbRgba(pixels.data(), levelWidth, levelHeight, smaller.data());
+		pixels.swap(smaller);
+		levelWidth = max(1, levelWidth / 2);
+		levelHeight = max(1, levelHeight / 2);
+	}
+
+	const string path = Ktx2PathFor(filename);
+	const uint32_t format = alpha ? KTX2_FORMAT_BC3_UNORM : KTX2_FORMAT_BC1_RGB_UNORM;
+	if (!Ktx2Texture::Write(path, format, width, height, levels)) {
+		cout << "Failed to write " << path << endl;
 		return false;
 	}
 
-	glCompileShader(fragmentShaderId); // compile the fragment shader
+	size_t compressedBytes = 0;
+	for (const vector<unsigned char>& level : levels)
+		compressedBytes += level.size();
+	cout << "INFO: Encoded " << filename << " -> " << path << " (" << (alpha ? "BC3" : "BC1") << ", " << levels.size() << " levels, "
+		<< compressedBytes / 1024 << " KB, " << static_cast<size_t>(width) * height * 4 / 1024 << " KB uncompressed level 0)" << endl;
+	return true;
+}
+
+
+// Creates a batch of programs. Every cached binary is restored and every other program is compiled and linked
+// before any status is queried, so the compiles overlap (on driver threads with GL_KHR_parallel_shader_compile)
+bool UCreateShaderPrograms(const ShaderProgramSource sources[], int count) {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	// Let the driver use as many compiler threads as it wants
+	const bool parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	// 1. Submit everything. A binary saved by an earlier run skips compiling; its key changes with the sources and the driver
+	struct PendingProgram {
+		GLuint programId;
+		GLuint shaderIds[2];    // 0 when the program came from the cache
+		uint64_t cacheKey;
+	};
+	const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	const bool useCache = gProgramCacheEnabled && gProgramCache.Supported();
+	vector<PendingProgram> pending(count);
+	vector<int> compiling;
+	for (int i = 0; i < count; ++i) {
+		PendingProgram& program = pending[i];
+		const char* const stageSources[] = { sources[i].vertexSource, sources[i].fragmentSource };
+		program.programId = glCreateProgram();
+		program.shaderIds[0] = program.shaderIds[1] = 0;
+		program.cacheKey = useCache ? gProgramCache.Key(stageSources, 2) : 0;
+		if (useCache) {
+			if (gProgramCache.Load(program.cacheKey, program.programId))
+				continue;
+			// missing, corrupt, or rejected by the driver: compile into a fresh program object
+			glDeleteProgram(program.programId);
+			program.programId = glCreateProgram();
+			glProgramParameteri(program.programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+
+		for (int stage = 0; stage < 2; ++stage) {
+			program.shaderIds[stage] = glCreateShader(stages[stage]);
+			glShaderSource(program.shaderIds[stage], 1, &stageSources[stage], NULL);
+			glCompileShader(program.shaderIds[stage]);
+			glAttachShader(program.programId, program.shaderIds[stage]);
+		}
+		glLinkProgram(program.programId);
+		compiling.push_back(i);
+	}
+	const int cached = count - static_cast<int>(compiling.size());
+
+	// 2. Collect the compiled programs, whichever finished first (a status query waits for its program)
+	bool success = true;
+	while (!compiling.empty()) {
+		size_t next = 0;
+		for (size_t i = 0; parallel && i < compiling.size(); ++i) {
+			GLint completed = GL_FALSE;
+			glGetProgramiv(pending[compiling[i]].programId, GL_COMPLETION_STATUS_KHR, &completed);
+			if (completed) {
+				next = i;
+				break;
+			}
+		}
+		PendingProgram& program = pending[compiling[next]];
+		compiling.erase(compiling.begin() + next);
+
+		// Linking fails when a stage failed to compile, so the stages are only checked then
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program.programId, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			char infoLog[512];
+			const char* const stageNames[] = { "VERTEX", "FRAGMENT" };
+			bool compiled = true;
+			for (int stage = 0; stage < 2; ++stage) {
+				GLint status = GL_FALSE;
+				glGetShaderiv(program.shaderIds[stage], GL_COMPILE_STATUS, &status);
+				if (!status) {
+					glGetShaderInfoLog(program.shaderIds[stage], sizeof(infoLog), NULL, infoLog);
+					std::cout << "ERROR::SHADER::" << stageNames[stage] << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+					compiled = false;
+				}
+			}
+			if (compiled) {
+				glGetProgramInfoLog(program.programId, sizeof(infoLog), NULL, infoLog);
+				std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			}
+			success = false;
+		}
 
-	// check for shader compile errors
-	glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
+		// The linked program keeps what it needs, the shader objects go away with it
+		for (int stage = 0; stage < 2; ++stage)
+			glDeleteShader(program.shaderIds[stage]);
+
+		// a binary that cannot be saved only costs the next start its compile
+		if (linked && useCache && !gProgramCache.Save(program.cacheKey, program.programId))
+			cout << "INFO: Could not save program " << gProgramCache.PathFor(program.cacheKey) << endl;
+	}
 	if (!success) {
-		glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		for (const PendingProgram& program : pending)
+			glDeleteProgram(program.programId);
 		return false;
 	}
 
-	// Attached compiled shaders to the shader program
-	glAttachShader(programId, vertexShaderId);
-	glAttachShader(programId, fragmentShaderId);
+	// Enumerate the active uniforms once, so rendering never looks them up by name
+	for (int i = 0; i < count; ++i)
+		sources[i].program->Reflect(pending[i].programId);
+
+	double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "INFO: Created " << count << " shader programs (" << cached << " from the binary cache) in " << elapsedMs << " ms"
+		<< (parallel ? " with parallel compilation" : "") << endl;
+	return true;
+}
 
-	glLinkProgram(programId);   // links the shader program
 
-	// check for linking errors
-	glGetProgramiv(programId, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+// Reads every program's GLSL files and creates the programs in one batch
+bool ULoadShaderPrograms() {
+	vector<string> sources(2 * SHADER_PROGRAM_COUNT);
+	vector<ShaderProgramSource> programs;
+	for (int i = 0; i < SHADER_PROGRAM_COUNT; ++i) {
+		const ShaderProgramFiles& files = SHADER_PROGRAM_FILES[i];
+		if (!LoadShaderSource(files.vertexPath, sources[2 * i]) || !LoadShaderSource(files.fragmentPath, sources[2 * i + 1])) {
+			cout << "Failed to load shader " << files.vertexPath << " or " << files.fragmentPath << endl;
+			return false;
+		}
+		programs.push_back({ sources[2 * i].c_str(), sources[2 * i + 1].c_str(), files.program });
+	}
+	if (!UCreateShaderPrograms(programs.data(), SHADER_PROGRAM_COUNT))
+		return false;
+
+	for (int i = 0; i < COMPUTE_PROGRAM_COUNT; ++i) {
+		if (!UCreateComputeProgram(COMPUTE_PROGRAM_FILES[i].path, *COMPUTE_PROGRAM_FILES[i].program))
+			return false;
+	}
+	return true;
+}
+
+
+// Compiles and links a compute program from its GLSL file
+bool UCreateComputeProgram(const char* path, ShaderProgram &program) {
+	string source;
+	if (!LoadShaderSource(path, source)) {
+		cout << "Failed to load shader " << path << endl;
+		return false;
+	}
+
+	const char* text = source.c_str();
+	GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shaderId, 1, &text, NULL);
+	glCompileShader(shaderId);
+	GLuint programId = glCreateProgram();
+	glAttachShader(programId, shaderId);
+	glLinkProgram(programId);
+
+	// Linking fails when the stage failed to compile, so the stage is only checked then
+	GLint linked = GL_FALSE;
+	glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char infoLog[512];
+		GLint compiled = GL_FALSE;
+		glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+			glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+			cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << endl;
+		}
+		else {
+			glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+			cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+		}
+		glDeleteShader(shaderId);
+		glDeleteProgram(programId);
 		return false;
 	}
 
-	glUseProgram(programId);    // Uses the shader program
+	glDeleteShader(shaderId);
+	program.Reflect(programId);
 	return true;
 }
 
 
-void UDestroyShaderProgram(GLuint programId) {
-	glDeleteProgram(programId);
+// Resolves the uniform handles once instead of looking names up every frame (again whenever a program is reloaded)
+void UResolveUniforms() {
+	gMvpUniform = gProgram.GetUniform<glm::mat4>("mvp");
+	gCubeModelUniform = gCubeProgram.GetUniform<glm::mat4>("model");
+	gCubeMvpUniform = gCubeProgram.GetUniform<glm::mat4>("mvp");
+	gCubeNormalUniform = gCubeProgram.GetUniform<glm::mat3>("normalMatrix");
+	gObjectColorUniform = gCubeProgram.GetUniform<glm::vec3>("objectColor");
+	gLightColorUniform = gCubeProgram.GetUniform<glm::vec3>("lightColor");
+	gLightPositionUniform = gCubeProgram.GetUniform<glm::vec3>("lightPos");
+	gLampMvpUniform = gLampProgram.GetUniform<glm::mat4>("mvp");
+
+	// set texture as texture unit
+	gProgram.Set(gProgram.GetUniform<int>("textures"), 0);
+	gInstancedProgram.Set(gInstancedProgram.GetUniform<int>("textures"), 0);
+
+	// the depth pyramid is read on its own texture unit
+	gCullPhaseUniform = gCullProgram.GetUniform<int>("cullPhase");
+	gHizLevelUniform = gHizProgram.GetUniform<int>("sourceLevel");
+	gCullProgram.Set(gCullProgram.GetUniform<int>("depthPyramid"), static_cast<int>(DEPTH_PYRAMID_TEXTURE_UNIT));
+	gHizProgram.Set(gHizProgram.GetUniform<int>("sourceDepth"), static_cast<int>(DEPTH_PYRAMID_TEXTURE_UNIT));
+}
+
+
+// Starts watching the GLSL files; programs are rebuilt on a hidden context sharing objects with the window's
+bool UStartShaderReload() {
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	gReloadContext = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, gWindow);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (gReloadContext == nullptr) {
+		cout << "INFO: Shader hot reload disabled: no shared context" << endl;
+		return false;
+	}
+
+	for (int i = 0; i < SHADER_PROGRAM_COUNT; ++i)
+		gShaderReloader.Watch(SHADER_PROGRAM_FILES[i].vertexPath, SHADER_PROGRAM_FILES[i].fragmentPath);
+	if (!gShaderReloader.Start(gReloadContext, gProgramCache, gProgramCacheEnabled && gProgramCache.Supported())) {
+		cout << "INFO: Shader hot reload disabled: cannot watch the shader files" << endl;
+		glfwDestroyWindow(gReloadContext);
+		gReloadContext = nullptr;
+		return false;
+	}
+	cout << "INFO: Watching " << 2 * SHADER_PROGRAM_COUNT << " shader files for changes" << endl;
+	return true;
+}
+
+
+// Swaps finished rebuilds in between frames; a failed build keeps the program that is running
+void UApplyShaderReloads() {
+	ShaderReloader::Result result;
+	while (gShaderReloader.TakeResult(result)) {
+		const ShaderProgramFiles& files = SHADER_PROGRAM_FILES[result.Program];
+		if (result.ProgramId == 0) {
+			cout << "Shader reload failed, keeping the previous program:\n" << result.Log << endl;
+			continue;
+		}
+
+		GLuint previous = files.program->Id;
+		files.program->Reflect(result.ProgramId);
+		glDeleteProgram(previous);
+		UResolveUniforms();
+		cout << "INFO: Reloaded " << files.vertexPath << " + " << files.fragmentPath << " (built in " << result.BuildMs << " ms)" << endl;
+	}
+}
+
+
+void UStopShaderReload() {
+	if (gReloadContext == nullptr)
+		return;
+	gShaderReloader.Stop();
+	glfwDestroyWindow(gReloadContext);
+	gReloadContext = nullptr;
+}
+
+
+void UDestroyShaderProgram(ShaderProgram &program) {
+	glDeleteProgram(program.Id);
+	program.Id = 0;
 }
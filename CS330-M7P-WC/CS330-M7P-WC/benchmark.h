@@ -0,0 +1,139 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+// Collects per-frame CPU and GPU timings, draw call counts and culling results, and reports them as percentiles.
+// Runs that alternate a feature on and off also record the GPU time of the frames without it (the baseline), and
+// the report then shows the mean time the feature saved.
+class FrameStats
+{
+public:
+	// adds one CPU frame time in milliseconds
+	void RecordCpu(double milliseconds)
+	{
+		cpuTimes.push_back(milliseconds);
+	}
+
+	// adds the CPU time in milliseconds one frame spent on per-object work (matrices, culling, per-draw data)
+	void RecordObjectTime(double milliseconds)
+	{
+		objectTimes.push_back(milliseconds);
+	}
+
+	// adds one GPU frame time in milliseconds (from a GL_TIME_ELAPSED query)
+	void RecordGpu(double milliseconds)
+	{
+		gpuTimes.push_back(milliseconds);
+	}
+
+	// adds one GPU frame time in milliseconds of a frame rendered without the feature being measured
+	void RecordGpuBaseline(double milliseconds)
+	{
+		gpuBaselineTimes.push_back(milliseconds);
+	}
+
+	// adds the number of draw calls one frame issued
+	void RecordDrawCalls(unsigned int calls)
+	{
+		drawCalls.push_back(calls);
+	}
+
+	// adds how many GL binds one frame issued and how many redundant ones it skipped
+	void RecordStateChanges(unsigned int changes, unsigned int skipped)
+	{
+		stateChanges.push_back(changes);
+		skippedStateChanges.push_back(skipped);
+	}
+
+	// adds how many objects one frame drew and how many it culled
+	void RecordCulling(size_t visible, size_t culled)
+	{
+		visibleObjects.push_back(static_cast<double>(visible));
+		culledObjects.push_back(static_cast<double>(culled));
+	}
+
+	// adds how many of the objects one frame culled were hidden behind others (occlusion culling)
+	void RecordOccluded(size_t occluded)
+	{
+		occludedObjects.push_back(static_cast<double>(occluded));
+	}
+
+	// writes the summary as a single JSON object
+	void WriteJson(std::ostream& out, int frames) const
+	{
+		out << "{\n";
+		out << "  \"frames\": " << frames << ",\n";
+		out << "  \"cpu_ms\": ";
+		writeSummary(out, cpuTimes);
+		out << ",\n  \"object_ms\": ";
+		writeSummary(out, objectTimes);
+		out << ",\n  \"gpu_ms\": ";
+		writeSummary(out, gpuTimes);
+		out << ",\n  \"draw_calls\": ";
+		writeSummary(out, drawCalls);
+		out << ",\n  \"state_changes\": ";
+		writeSummary(out, stateChanges);
+		out << ",\n  \"state_changes_avoided\": ";
+		writeSummary(out, skippedStateChanges);
+		out << ",\n  \"visible_objects\": ";
+		writeSummary(out, visibleObjects);
+		out << ",\n  \"culled_objects\": ";
+		writeSummary(out, culledObjects);
+		if (!occludedObjects.empty()) {
+			out << ",\n  \"occluded_objects\": ";
+			writeSummary(out, occludedObjects);
+		}
+		if (!gpuBaselineTimes.empty()) {
+			out << ",\n  \"gpu_baseline_ms\": ";
+			writeSummary(out, gpuBaselineTimes);
+			out << ",\n  \"gpu_saved_ms\": " << mean(gpuBaselineTimes) - mean(gpuTimes);
+		}
+		out << "\n}" << std::endl;
+	}
+
+private:
+	std::vector<double> cpuTimes;
+	std::vector<double> objectTimes;
+	std::vector<double> gpuTimes;
+	std::vector<double> drawCalls;
+	std::vector<double> stateChanges;
+	std::vector<double> skippedStateChanges;
+	std::vector<double> visibleObjects;
+	std::vector<double> culledObjects;
+	std::vector<double> gpuBaselineTimes;
+	std::vector<double> occludedObjects;
+
+	static double mean(const std::vector<double>& samples)
+	{
+		double sum = 0.0;
+		for (double sample : samples)
+			sum += sample;
+		return samples.empty() ? 0.0 : sum / samples.size();
+	}
+
+	// nearest-rank percentile of an already sorted sample set
+	static double percentile(const std::vector<double>& sorted, double p)
+	{
+		if (sorted.empty())
+			return 0.0;
+		size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.5);
+		rank = std::min(std::max(rank, static_cast<size_t>(1)), sorted.size());
+		return sorted[rank - 1];
+	}
+
+	static void writeSummary(std::ostream& out, const std::vector<double>& samples)
+	{
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+
+		out << "{ \"samples\": " << sorted.size()
+			<< ", \"mean\": " << mean(sorted)
+			<< ", \"p50\": " << percentile(sorted, 50.0)
+			<< ", \"p95\": " << percentile(sorted, 95.0)
+			<< ", \"p99\": " << percentile(sorted, 99.0)
+			<< ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " }";
+	}
+};
+#endif
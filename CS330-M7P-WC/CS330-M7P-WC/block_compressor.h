@@ -0,0 +1,257 @@
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "worker_pool.h"
+
+// BC1 (DXT1, 8 bytes per 4x4 block) and BC3 (DXT5, 16 bytes: BC4-style alpha block + BC1 color block)
+// encoders for the offline texture compressor. Colors are fitted along the principal axis of each block
+// and then refined once by least squares; BC1 blocks are always written in 4-color mode, so they can be
+// promoted to BC3 by prepending an opaque alpha block.
+class BlockCompressor
+{
+public:
+	static const int BC1_BLOCK_BYTES = 8;
+	static const int BC3_BLOCK_BYTES = 16;
+
+	// compresses one 4x4 block of RGBA pixels (row-major, 64 bytes)
+	static void EncodeBc1(const unsigned char* block, unsigned char* out)
+	{
+		float mean[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 3; ++c)
+				mean[c] += block[i * 4 + c] / 16.0f;
+
+		// covariance of the block colors; its dominant eigenvector is the line the palette lies on
+		float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i) {
+			float r = block[i * 4 + 0] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+			covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+			covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+		}
+		float axis[3] = { 0.57735f, 0.57735f, 0.57735f };
+		for (int iteration = 0; iteration < 4; ++iteration) {
+			float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+			float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+			float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+			float length = std::sqrt(x * x + y * y + z * z);
+			if (length < 1e-6f)
+				break;
+			axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+		}
+
+		float lowest = 0.0f, highest = 0.0f;
+		for (int i = 0; i < 16; ++i) {
+			float t = (block[i * 4 + 0] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+			lowest = std::min(lowest, t);
+			highest = std::max(highest, t);
+		}
+		float endpoint0[3], endpoint1[3];
+		for (int c = 0; c < 3; ++c) {
+			endpoint0[c] = mean[c] + axis[c] * highest;
+			endpoint1[c] = mean[c] + axis[c] * lowest;
+		}
+
+		uint16_t color0 = pack565(endpoint0), color1 = pack565(endpoint1);
+		uint32_t indices;
+		uint32_t error = fitIndices(block, color0, color1, indices);
+
+		// least-squares endpoints for the chosen indices, kept only when they lower the error
+		uint16_t refined0, refined1;
+		if (refineEndpoints(block, indices, refined0, refined1)) {
+			uint32_t refinedIndices;
+			uint32_t refinedError = fitIndices(block, refined0, refined1, refinedIndices);
+			if (refinedError < error) {
+				color0 = refined0;
+				color1 = refined1;
+				indices = refinedIndices;
+			}
+		}
+
+		out[0] = static_cast<unsigned char>(color0 & 0xFF);
+		out[1] = static_cast<unsigned char>(color0 >> 8);
+		out[2] = static_cast<unsigned char>(color1 & 0xFF);
+		out[3] = static_cast<unsigned char>(color1 >> 8);
+		for (int b = 0; b < 4; ++b)
+			out[4 + b] = static_cast<unsigned char>(indices >> (b * 8));
+	}
+
+	static void EncodeBc3(const unsigned char* block, unsigned char* out)
+	{
+		encodeAlpha(block, out);
+		EncodeBc1(block, out + 8);
+	}
+
+	// compresses a whole RGBA image, rows in memory order, splitting the block rows across threads;
+	// partial blocks at the right/top edge repeat the last column/row
+	static std::vector<unsigned char> Compress(const unsigned char* rgba, int width, int height, bool alpha)
+	{
+		const int blocksWide = (width + 3) / 4;
+		const int blocksHigh = (height + 3) / 4;
+		const int blockBytes = alpha ? BC3_BLOCK_BYTES : BC1_BLOCK_BYTES;
+		std::vector<unsigned char> compressed(static_cast<size_t>(blocksWide) * blocksHigh * blockBytes);
+
+		unsigned int threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), static_cast<unsigned int>(blocksHigh)));
+		auto worker = [&](unsigned int index) {
+			unsigned char block[64];
+			for (int by = index; by < blocksHigh; by += threadCount) {
+				for (int bx = 0; bx < blocksWide; ++bx) {
+					for (int y = 0; y < 4; ++y) {
+						const int row = std::min(by * 4 + y, height - 1);
+						for (int x = 0; x < 4; ++x) {
+							const int column = std::min(bx * 4 + x, width - 1);
+							std::memcpy(block + (y * 4 + x) * 4, rgba + (static_cast<size_t>(row) * width + column) * 4, 4);
+						}
+					}
+					unsigned char* out = compressed.data() + (static_cast<size_t>(by) * blocksWide + bx) * blockBytes;
+					if (alpha)
+						EncodeBc3(block, out);
+					else
+						EncodeBc1(block, out);
+				}
+			}
+		};
+		ParallelFor(threadCount, worker);
+		return compressed;
+	}
+
+	// BC3 blocks from 4-color-mode BC1 blocks: an opaque alpha block followed by the unchanged color block
+	static void PromoteBc1ToBc3(const unsigned char* bc1, size_t blocks, unsigned char* bc3)
+	{
+		static const unsigned char opaque[8] = { 255, 255, 0, 0, 0, 0, 0, 0 };
+		for (size_t i = 0; i < blocks; ++i) {
+			std::memcpy(bc3 + i * BC3_BLOCK_BYTES, opaque, 8);
+			std::memcpy(bc3 + i * BC3_BLOCK_BYTES + 8, bc1 + i * BC1_BLOCK_BYTES, BC1_BLOCK_BYTES);
+		}
+	}
+
+private:
+	static uint16_t pack565(const float color[3])
+	{
+		int r = static_cast<int>(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = static_cast<int>(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = static_cast<int>(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	static void unpack565(uint16_t packed, int color[3])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// orders the endpoints for 4-color mode and picks the nearest palette entry per pixel; returns the squared error
+	static uint32_t fitIndices(const unsigned char* block, uint16_t& color0, uint16_t& color1, uint32_t& indices)
+	{
+		if (color0 < color1)
+			std::swap(color0, color1);
+		indices = 0;
+		// equal endpoints are 3-color mode in BC1, but index 0 is color0 in both modes
+		if (color0 == color1) {
+			int color[3];
+			unpack565(color0, color);
+			uint32_t error = 0;
+			for (int i = 0; i < 16; ++i)
+				for (int c = 0; c < 3; ++c)
+					error += (block[i * 4 + c] - color[c]) * (block[i * 4 + c] - color[c]);
+			return error;
+		}
+
+		int palette[4][3];
+		unpack565(color0, palette[0]);
+		unpack565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t error = 0;
+		for (int i = 0; i < 16; ++i) {
+			uint32_t best = UINT32_MAX;
+			uint32_t bestIndex = 0;
+			for (uint32_t p = 0; p < 4; ++p) {
+				uint32_t distance = 0;
+				for (int c = 0; c < 3; ++c)
+					distance += (block[i * 4 + c] - palette[p][c]) * (block[i * 4 + c] - palette[p][c]);
+				if (distance < best) {
+					best = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= bestIndex << (i * 2);
+			error += best;
+		}
+		return error;
+	}
+
+	// solves for the endpoints that minimize the error of the given 4-color-mode indices
+	static bool refineEndpoints(const unsigned char* block, uint32_t indices, uint16_t& color0, uint16_t& color1)
+	{
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i) {
+			float a = weights[(indices >> (i * 2)) & 3];
+			float b = 1.0f - a;
+			aa += a * a; ab += a * b; bb += b * b;
+			for (int c = 0; c < 3; ++c) {
+				ax[c] += a * block[i * 4 + c];
+				bx[c] += b * block[i * 4 + c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return false;
+
+		float endpoint0[3], endpoint1[3];
+		for (int c = 0; c < 3; ++c) {
+			endpoint0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+			endpoint1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+		}
+		color0 = pack565(endpoint0);
+		color1 = pack565(endpoint1);
+		return true;
+	}
+
+	// 8-value alpha palette between the block's extremes, 3-bit index per pixel
+	static void encodeAlpha(const unsigned char* block, unsigned char* out)
+	{
+		int highest = 0, lowest = 255;
+		for (int i = 0; i < 16; ++i) {
+			highest = std::max(highest, static_cast<int>(block[i * 4 + 3]));
+			lowest = std::min(lowest, static_cast<int>(block[i * 4 + 3]));
+		}
+		out[0] = static_cast<unsigned char>(highest);
+		out[1] = static_cast<unsigned char>(lowest);
+
+		int palette[8] = { highest, lowest };
+		for (int p = 1; p < 7; ++p)
+			palette[p + 1] = ((7 - p) * highest + p * lowest) / 7;
+
+		uint64_t indices = 0;
+		if (highest != lowest) {
+			for (int i = 0; i < 16; ++i) {
+				int alpha = block[i * 4 + 3];
+				uint64_t bestIndex = 0;
+				int best = 256;
+				for (int p = 0; p < 8; ++p) {
+					int distance = std::abs(alpha - palette[p]);
+					if (distance < best) {
+						best = distance;
+						bestIndex = p;
+					}
+				}
+				indices |= bestIndex << (i * 3);
+			}
+		}
+		for (int b = 0; b < 6; ++b)
+			out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+	}
+};
+#endif
@@ -0,0 +1,548 @@
+#ifndef BVH_H
+#define BVH_H
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "transform_system.h"
+
+// Axis-aligned box; the default box is empty (Min > Max), so growing it by anything gives exactly that thing
+struct Aabb
+{
+	glm::vec3 Min = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	glm::vec3 Max = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	void Grow(const glm::vec3& point) { Min = glm::min(Min, point); Max = glm::max(Max, point); }
+	void Grow(const Aabb& box) { Min = glm::min(Min, box.Min); Max = glm::max(Max, box.Max); }
+	glm::vec3 Center() const { return (Min + Max) * 0.5f; }
+	bool Empty() const { return Min.x > Max.x; }
+
+	// half the surface area, which is all the SAH needs
+	float HalfArea() const
+	{
+		if (Empty())
+			return 0.0f;
+		glm::vec3 size = Max - Min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+};
+
+// A ray with its reciprocal direction precomputed for the slab tests
+struct Ray
+{
+	glm::vec3 Origin;
+	glm::vec3 Direction;
+	glm::vec3 InverseDirection;
+
+	Ray(const glm::vec3& origin, const glm::vec3& direction)
+		: Origin(origin), Direction(direction), InverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z) {}
+};
+
+// distance at which the ray enters the box, or FLT_MAX when it misses it or enters beyond maxDistance
+inline float IntersectAabb(const Ray& ray, const Aabb& box, float maxDistance)
+{
+	glm::vec3 t0 = (box.Min - ray.Origin) * ray.InverseDirection;
+	glm::vec3 t1 = (box.Max - ray.Origin) * ray.InverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+// Bounding volume hierarchy over any primitives given by their boxes, built with a binned surface area heuristic.
+// Children of a node are stored next to each other, always after their parent, so Refit can update every box
+// in one backward pass when the primitives move without changing the tree.
+class Bvh
+{
+public:
+	struct Node
+	{
+		Aabb Box;
+		uint32_t First;		// leaf: first entry of Indices; inner node: left child (the right one follows it)
+		uint32_t Count;		// primitives of a leaf, 0 for inner nodes
+	};
+
+	static constexpr uint32_t BINS = 12;
+	static constexpr uint32_t MAX_LEAF_SIZE = 8;
+	static constexpr float TRAVERSAL_COST = 1.0f;	// cost of a box test relative to a primitive test
+	static constexpr int MAX_DEPTH = 60;		// keeps the traversal stacks below fixed sizes
+
+	void Build(const std::vector<Aabb>& bounds)
+	{
+		nodes.clear();
+		indices.resize(bounds.size());
+		references.resize(bounds.size());
+		Node root;
+		root.First = 0;
+		root.Count = static_cast<uint32_t>(bounds.size());
+		Aabb rootCentroids;
+		for (size_t i = 0; i < bounds.size(); ++i) {
+			references[i].Box = bounds[i];
+			references[i].Centroid = bounds[i].Center();
+			references[i].Primitive = static_cast<uint32_t>(i);
+			root.Box.Grow(bounds[i]);
+			rootCentroids.Grow(references[i].Centroid);
+		}
+		if (bounds.empty())
+			return;
+
+		nodes.reserve(bounds.size() * 2);
+		nodes.push_back(root);
+
+		// every pending node carries the box of its primitives' centroids, which its split bins across
+		struct Pending { uint32_t Node; int Depth; Aabb Centroids; };
+		std::vector<Pending> pending(1, Pending{ 0, 0, rootCentroids });
+		while (!pending.empty()) {
+			Pending current = pending.back();
+			pending.pop_back();
+			Aabb childCentroids[2];
+			if (split(current.Node, current.Depth, current.Centroids, childCentroids)) {
+				pending.push_back(Pending{ nodes[current.Node].First, current.Depth + 1, childCentroids[0] });
+				pending.push_back(Pending{ nodes[current.Node].First + 1, current.Depth + 1, childCentroids[1] });
+			}
+		}
+		for (size_t i = 0; i < references.size(); ++i)
+			indices[i] = references[i].Primitive;
+		references.clear();
+		references.shrink_to_fit();
+		buildCost = Cost();
+	}
+
+	// recomputes every node box from the primitives' new boxes; the tree shape stays as built
+	void Refit(const std::vector<Aabb>& bounds)
+	{
+		for (size_t n = nodes.size(); n-- > 0;) {
+			Node& node = nodes[n];
+			Aabb box;
+			if (node.Count > 0) {
+				for (uint32_t i = 0; i < node.Count; ++i)
+					box.Grow(bounds[indices[node.First + i]]);
+			}
+			else {
+				box.Grow(nodes[node.First].Box);
+				box.Grow(nodes[node.First + 1].Box);
+			}
+			node.Box = box;
+		}
+	}
+
+	// SAH cost of the tree relative to its root box; refitting moved primitives makes it grow
+	float Cost() const
+	{
+		if (nodes.empty() || nodes[0].Box.HalfArea() <= 0.0f)
+			return 0.0f;
+		float cost = 0.0f;
+		for (const Node& node : nodes)
+			cost += node.Box.HalfArea() * (node.Count > 0 ? node.Count : 1.0f);
+		return cost / nodes[0].Box.HalfArea();
+	}
+	float BuildCost() const { return buildCost; }
+
+	// calls intersect(primitive, maxDistance) for the primitives whose leaves the ray reaches, nearest leaf first;
+	// intersect shortens maxDistance when it finds a hit, which prunes the rest of the walk
+	template <typename Intersect>
+	void Traverse(const Ray& ray, float& maxDistance, Intersect intersect) const
+	{
+		if (nodes.empty() || IntersectAabb(ray, nodes[0].Box, maxDistance) == FLT_MAX)
+			return;
+		uint32_t stack[MAX_DEPTH + 4];
+		int size = 0;
+		uint32_t current = 0;
+		for (;;) {
+			const Node& node = nodes[current];
+			if (node.Count > 0) {
+				for (uint32_t i = 0; i < node.Count; ++i)
+					intersect(indices[node.First + i], maxDistance);
+			}
+			else {
+				uint32_t nearChild = node.First;
+				uint32_t farChild = node.First + 1;
+				float nearDistance = IntersectAabb(ray, nodes[nearChild].Box, maxDistance);
+				float farDistance = IntersectAabb(ray, nodes[farChild].Box, maxDistance);
+				if (farDistance < nearDistance) {
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+				if (nearDistance != FLT_MAX) {
+					if (farDistance != FLT_MAX)
+						stack[size++] = farChild;
+					current = nearChild;
+					continue;
+				}
+			}
+			// pop, skipping nodes a closer hit has made unreachable
+			for (;;) {
+				if (size == 0)
+					return;
+				current = stack[--size];
+				if (IntersectAabb(ray, nodes[current].Box, maxDistance) != FLT_MAX)
+					break;
+			}
+		}
+	}
+
+	// walks the tree top down: classify(box) returns -1 to skip a subtree, 1 to take all of it, 0 to look inside;
+	// take(primitive, tested) gets every primitive reached, tested false when its whole subtree was taken
+	template <typename Classify, typename Take>
+	void Query(Classify classify, Take take) const
+	{
+		if (nodes.empty())
+			return;
+		struct Entry { uint32_t Node; bool Inside; };
+		Entry stack[MAX_DEPTH + 4];
+		int size = 0;
+		stack[size++] = Entry{ 0, false };
+		while (size > 0) {
+			Entry entry = stack[--size];
+			const Node& node = nodes[entry.Node];
+			bool inside = entry.Inside;
+			if (!inside) {
+				int result = classify(node.Box);
+				if (result < 0)
+					continue;
+				inside = result > 0;
+			}
+			if (node.Count > 0) {
+				for (uint32_t i = 0; i < node.Count; ++i)
+					take(indices[node.First + i], !inside);
+			}
+			else {
+				stack[size++] = Entry{ node.First + 1, inside };
+				stack[size++] = Entry{ node.First, inside };
+			}
+		}
+	}
+
+	const std::vector<Node>& Nodes() const { return nodes; }
+	const std::vector<uint32_t>& Indices() const { return indices; }
+
+private:
+	std::vector<Node> nodes;
+	std::vector<uint32_t> indices;
+	float buildCost = 0.0f;
+
+	// a primitive while building; the build sorts these in place, so every node reads a contiguous range
+	struct Reference
+	{
+		Aabb Box;
+		glm::vec3 Centroid;
+		uint32_t Primitive;
+	};
+	std::vector<Reference> references;
+
+	// splits a node in two where the binned SAH is cheapest; false when it stays a leaf. The children's boxes
+	// come from the bins and their centroid boxes from the partition, so a split reads its primitives twice.
+	bool split(uint32_t nodeIndex, int depth, const Aabb& centroidBox, Aabb childCentroids[2])
+	{
+		const uint32_t first = nodes[nodeIndex].First;
+		const uint32_t count = nodes[nodeIndex].Count;
+		if (count <= 2 || depth >= MAX_DEPTH)
+			return false;
+
+		glm::vec3 low = centroidBox.Min;
+		glm::vec3 extent = centroidBox.Max - centroidBox.Min;
+		glm::vec3 scale(extent.x > 0.0f ? BINS / extent.x : 0.0f, extent.y > 0.0f ? BINS / extent.y : 0.0f, extent.z > 0.0f ? BINS / extent.z : 0.0f);
+
+		// one pass bins the primitives along all three axes
+		Aabb binBoxes[3][BINS];
+		uint32_t binCounts[3][BINS] = {};
+		for (uint32_t i = 0; i < count; ++i) {
+			const Reference& reference = references[first + i];
+			for (int axis = 0; axis < 3; ++axis) {
+				uint32_t bin = std::min(BINS - 1, static_cast<uint32_t>((reference.Centroid[axis] - low[axis]) * scale[axis]));
+				binCounts[axis][bin]++;
+				binBoxes[axis][bin].Grow(reference.Box);
+			}
+		}
+
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+		float bestCost = FLT_MAX;
+		Aabb bestLeft, bestRight;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (scale[axis] == 0.0f)
+				continue;
+			// right-to-left sweep first, then evaluate every boundary on the way back
+			Aabb rightBoxes[BINS];
+			uint32_t rightCounts[BINS];
+			Aabb right;
+			uint32_t rightCount = 0;
+			for (uint32_t b = BINS - 1; b > 0; --b) {
+				right.Grow(binBoxes[axis][b]);
+				rightCount += binCounts[axis][b];
+				rightBoxes[b] = right;
+				rightCounts[b] = rightCount;
+			}
+			Aabb left;
+			uint32_t leftCount = 0;
+			for (uint32_t b = 1; b < BINS; ++b) {
+				left.Grow(binBoxes[axis][b - 1]);
+				leftCount += binCounts[axis][b - 1];
+				if (leftCount == 0 || rightCounts[b] == 0)
+					continue;
+				float cost = left.HalfArea() * leftCount + rightBoxes[b].HalfArea() * rightCounts[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+					bestLeft = left;
+					bestRight = rightBoxes[b];
+				}
+			}
+		}
+
+		// splitting costs one more box test per ray; a leaf is kept when that makes it cheaper, unless it is too large
+		float area = nodes[nodeIndex].Box.HalfArea();
+		if (bestAxis < 0 || (bestCost + TRAVERSAL_COST * area >= area * count && count <= MAX_LEAF_SIZE))
+			return false;
+
+		uint32_t i = first;
+		uint32_t end = first + count;
+		while (i < end) {
+			const Reference& reference = references[i];
+			if (std::min(BINS - 1, static_cast<uint32_t>((reference.Centroid[bestAxis] - low[bestAxis]) * scale[bestAxis])) < bestSplit) {
+				childCentroids[0].Grow(reference.Centroid);
+				++i;
+			}
+			else {
+				childCentroids[1].Grow(reference.Centroid);
+				std::swap(references[i], references[--end]);
+			}
+		}
+		uint32_t leftCount = i - first;
+
+		uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node{ bestLeft, first, leftCount });
+		nodes.push_back(Node{ bestRight, i, count - leftCount });
+		nodes[nodeIndex].First = leftChild;
+		nodes[nodeIndex].Count = 0;
+		return true;
+	}
+};
+
+// Triangle BVH of one mesh in model space, shared by every object that draws the mesh
+class MeshBvh
+{
+public:
+	// positions are the first three floats of every vertex; indices are a triangle list of 16 or 32-bit values
+	template <typename Index>
+	void Build(const float* vertices, size_t vertexCount, unsigned int floatsPerVertex, const Index* indices, size_t indexCount)
+	{
+		positions.resize(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+			positions[v] = glm::vec3(vertices[v * floatsPerVertex], vertices[v * floatsPerVertex + 1], vertices[v * floatsPerVertex + 2]);
+		triangles.assign(indices, indices + indexCount - indexCount % 3);
+
+		std::vector<Aabb> bounds(triangles.size() / 3);
+		for (size_t t = 0; t < bounds.size(); ++t)
+			for (int corner = 0; corner < 3; ++corner)
+				bounds[t].Grow(positions[triangles[t * 3 + corner]]);
+		tree.Build(bounds);
+	}
+
+	// nearest triangle the ray hits closer than distance; distance and triangle are updated on a hit
+	bool Intersect(const Ray& ray, float& distance, int32_t& triangle) const
+	{
+		bool hit = false;
+		tree.Traverse(ray, distance, [&](uint32_t t, float& maxDistance) {
+			float d = maxDistance;
+			if (intersectTriangle(ray, t, d) && d < maxDistance) {
+				maxDistance = d;
+				triangle = static_cast<int32_t>(t);
+				hit = true;
+			}
+		});
+		return hit;
+	}
+
+	// the same test against every triangle, as a reference for the tree
+	bool IntersectAll(const Ray& ray, float& distance, int32_t& triangle) const
+	{
+		bool hit = false;
+		for (uint32_t t = 0; t < TriangleCount(); ++t) {
+			float d = distance;
+			if (intersectTriangle(ray, t, d) && d < distance) {
+				distance = d;
+				triangle = static_cast<int32_t>(t);
+				hit = true;
+			}
+		}
+		return hit;
+	}
+
+	uint32_t TriangleCount() const { return static_cast<uint32_t>(triangles.size() / 3); }
+	const Bvh& Tree() const { return tree; }
+
+private:
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> triangles;
+	Bvh tree;
+
+	// Moller-Trumbore, both faces
+	bool intersectTriangle(const Ray& ray, uint32_t t, float& distance) const
+	{
+		const glm::vec3& v0 = positions[triangles[t * 3]];
+		glm::vec3 edge1 = positions[triangles[t * 3 + 1]] - v0;
+		glm::vec3 edge2 = positions[triangles[t * 3 + 2]] - v0;
+		glm::vec3 p = glm::cross(ray.Direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::fabs(determinant) < 1.0e-12f)
+			return false;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = ray.Origin - v0;
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(ray.Direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		float d = glm::dot(edge2, q) * inverse;
+		if (d < 0.0f)
+			return false;
+		distance = d;
+		return true;
+	}
+};
+
+// Object-level BVH over the world bounds of a TransformSystem, with an optional MeshBvh per object for exact
+// ray hits. Moving objects only refit the tree; it is rebuilt when refitting has made it too much worse.
+class SceneBvh
+{
+public:
+	static constexpr float REBUILD_FACTOR = 1.5f;	// refit cost over build cost that triggers a rebuild
+
+	struct Hit
+	{
+		TransformSystem::Handle Object = -1;
+		int32_t Triangle = -1;		// -1 for objects without a MeshBvh, which are hit by their box
+		float Distance = FLT_MAX;	// along the ray direction as given (world units if it is normalized)
+	};
+
+	// objects have no mesh (box hits only) until one is set; the MeshBvh must outlive the scene
+	void SetMesh(TransformSystem::Handle object, const MeshBvh* mesh)
+	{
+		if (meshes.size() <= static_cast<size_t>(object))
+			meshes.resize(object + 1, nullptr);
+		meshes[object] = mesh;
+	}
+
+	// updates the tree after transforms.Update: builds it when objects were added, refits it otherwise
+	void Update(const TransformSystem& transforms)
+	{
+		gatherBounds(transforms);
+		if (treeObjects.size() != builtObjects || transforms.Count() != builtCount) {
+			rebuild(transforms);
+			return;
+		}
+		tree.Refit(bounds);
+		refits++;
+		if (tree.Cost() > tree.BuildCost() * REBUILD_FACTOR)
+			rebuild(transforms);
+	}
+
+	// nearest object, and triangle, the ray hits; the transforms must be the ones the tree was last updated with
+	bool Raycast(const TransformSystem& transforms, const glm::vec3& origin, const glm::vec3& direction, Hit& hit) const
+	{
+		Ray ray(origin, direction);
+		float distance = FLT_MAX;
+		tree.Traverse(ray, distance, [&](uint32_t primitive, float& maxDistance) {
+			TransformSystem::Handle object = treeObjects[primitive];
+			const MeshBvh* mesh = static_cast<size_t>(object) < meshes.size() ? meshes[object] : nullptr;
+			if (mesh == nullptr) {
+				float d = IntersectAabb(ray, bounds[primitive], maxDistance);
+				if (d < maxDistance) {
+					maxDistance = d;
+					hit.Object = object;
+					hit.Triangle = -1;
+				}
+				return;
+			}
+			// the model-space ray keeps the same parameter, since the direction is transformed without normalizing
+			glm::mat4 toModel = glm::inverse(transforms.World(object));
+			Ray modelRay(glm::vec3(toModel * glm::vec4(origin, 1.0f)), glm::vec3(toModel * glm::vec4(direction, 0.0f)));
+			int32_t triangle = -1;
+			if (mesh->Intersect(modelRay, maxDistance, triangle)) {
+				hit.Object = object;
+				hit.Triangle = triangle;
+			}
+		});
+		hit.Distance = distance;
+		return hit.Object >= 0;
+	}
+
+	// every object whose world box is not entirely behind one of the planes (unit normals pointing inside)
+	void QueryFrustum(const glm::vec4 planes[6], std::vector<TransformSystem::Handle>& visible) const
+	{
+		visible.assign(unbounded.begin(), unbounded.end());
+		auto classify = [&](const Aabb& box) {
+			glm::vec3 center = box.Center();
+			glm::vec3 extent = box.Max - center;
+			int result = 1;
+			for (int p = 0; p < 6; ++p) {
+				glm::vec3 normal(planes[p]);
+				float distance = glm::dot(normal, center) + planes[p].w;
+				float radius = glm::dot(glm::abs(normal), extent);
+				if (distance + radius < 0.0f)
+					return -1;
+				if (distance - radius < 0.0f)
+					result = 0;
+			}
+			return result;
+		};
+		tree.Query(classify, [&](uint32_t primitive, bool tested) {
+			if (!tested || classify(bounds[primitive]) >= 0)
+				visible.push_back(treeObjects[primitive]);
+		});
+	}
+
+	size_t Rebuilds() const { return rebuilds; }
+	size_t Refits() const { return refits; }
+	const Bvh& Tree() const { return tree; }
+
+private:
+	Bvh tree;
+	std::vector<const MeshBvh*> meshes;
+	std::vector<Aabb> bounds;						// world box of every tree primitive
+	std::vector<TransformSystem::Handle> treeObjects;	// object of every tree primitive
+	std::vector<TransformSystem::Handle> unbounded;	// objects without bounds stay out of the tree and are always visible
+	size_t builtObjects = 0;
+	size_t builtCount = 0;
+	size_t rebuilds = 0;
+	size_t refits = 0;
+
+	void gatherBounds(const TransformSystem& transforms)
+	{
+		bounds.clear();
+		treeObjects.clear();
+		unbounded.clear();
+		const float* center[3] = { transforms.BoundsCenter(0), transforms.BoundsCenter(1), transforms.BoundsCenter(2) };
+		const float* extent[3] = { transforms.BoundsExtent(0), transforms.BoundsExtent(1), transforms.BoundsExtent(2) };
+		for (size_t i = 0; i < transforms.Count(); ++i) {
+			TransformSystem::Handle object = static_cast<TransformSystem::Handle>(i);
+			glm::vec3 c(center[0][i], center[1][i], center[2][i]);
+			glm::vec3 e(extent[0][i], extent[1][i], extent[2][i]);
+			if (std::max(e.x, std::max(e.y, e.z)) >= TRANSFORM_UNBOUNDED * 0.5f) {
+				unbounded.push_back(object);
+				continue;
+			}
+			Aabb box;
+			box.Min = c - e;
+			box.Max = c + e;
+			bounds.push_back(box);
+			treeObjects.push_back(object);
+		}
+	}
+
+	void rebuild(const TransformSystem& transforms)
+	{
+		tree.Build(bounds);
+		builtObjects = treeObjects.size();
+		builtCount = transforms.Count();
+		rebuilds++;
+	}
+};
+#endif
@@ -97,6 +97,22 @@ public:
 		}
 	}
 
+	// frustum planes (left, right, bottom, top, near, far) of projection * view, extracted from the rows of that
+	// matrix and normalized: xyz is the unit normal pointing inside, w the distance, so a point p is inside when
+	// dot(plane, vec4(p, 1)) >= 0 for all six
+	void GetFrustumPlanes(const glm::mat4& projection, glm::vec4 planes[6]) const
+	{
+		glm::mat4 viewProjection = projection * GetViewMatrix();
+		glm::vec4 rowW(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+		for (int axis = 0; axis < 3; ++axis) {
+			glm::vec4 row(viewProjection[0][axis], viewProjection[1][axis], viewProjection[2][axis], viewProjection[3][axis]);
+			planes[axis * 2] = rowW + row;
+			planes[axis * 2 + 1] = rowW - row;
+		}
+		for (int p = 0; p < 6; ++p)
+			planes[p] = planes[p] / glm::length(glm::vec3(planes[p]));
+	}
+
 	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
@@ -122,6 +138,15 @@ public:
 		OrthographicView = !OrthographicView;
 	}
 
+	// places the camera directly, used by scripted camera paths that do not come from an input system
+	void SetPose(glm::vec3 position, float yaw, float pitch)
+	{
+		Position = position;
+		Yaw = yaw;
+		Pitch = pitch;
+		updateCameraVectors();
+	}
+
 	// processes input received from a mouse input system. Expects the offset value in both the x and y direction.
 	void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
 	{
@@ -0,0 +1,29 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+#include <cstdint>
+#include <cstring>
+
+// Fast 64-bit content hash (word-at-a-time multiply/xorshift), used to detect a changed source (model, image or shader)
+inline uint64_t HashBytes(const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	const uint64_t multiplier = 0xFF51AFD7ED558CCDull;
+	uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * multiplier;
+		hash ^= hash >> 32;
+	}
+	uint64_t tail = 0;
+	if (i < size)
+		std::memcpy(&tail, bytes + i, size - i);
+	hash = (hash ^ tail) * multiplier;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+#endif
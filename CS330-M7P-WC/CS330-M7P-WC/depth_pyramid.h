@@ -0,0 +1,63 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+#include <GL/glew.h>
+#include <algorithm>
+
+// Texture unit the culling programs read depth from (unit 0 holds the texture array)
+const GLuint DEPTH_PYRAMID_TEXTURE_UNIT = 1;
+const GLuint DEPTH_PYRAMID_GROUP_SIZE = 8;	// local_size_x and local_size_y of hiz.comp
+
+// Hierarchical depth of one frame: a copy of its depth buffer, and an R32F mip chain where every texel holds
+// the farthest depth of the screen region it covers. Level 0 has the framebuffer's size and every level halves
+// it (rounding down; hiz.comp folds the odd row or column into the smaller level so no depth is ever lost).
+class DepthPyramid
+{
+public:
+	GLuint DepthTexture = 0;	// the frame's depth, copied from the read framebuffer
+	GLuint Pyramid = 0;
+	int Width = 0;
+	int Height = 0;
+	int Levels = 0;
+
+	void Create(int width, int height)
+	{
+		Width = width;
+		Height = height;
+		Levels = 1;
+		while ((std::max(Width, Height) >> Levels) > 0)
+			++Levels;
+
+		glGenTextures(1, &DepthTexture);
+		glBindTexture(GL_TEXTURE_2D, DepthTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, Width, Height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenTextures(1, &Pyramid);
+		glBindTexture(GL_TEXTURE_2D, Pyramid);
+		glTexStorage2D(GL_TEXTURE_2D, Levels, GL_R32F, Width, Height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// copies the depth buffer of the bound read framebuffer (depth to depth, so the formats need not match)
+	void CopyDepth() const
+	{
+		glBindTexture(GL_TEXTURE_2D, DepthTexture);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, Width, Height);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	int LevelWidth(int level) const { return std::max(1, Width >> level); }
+	int LevelHeight(int level) const { return std::max(1, Height >> level); }
+
+	void Destroy()
+	{
+		glDeleteTextures(1, &DepthTexture);
+		glDeleteTextures(1, &Pyramid);
+		DepthTexture = Pyramid = 0;
+		Width = Height = Levels = 0;
+	}
+};
+#endif
@@ -0,0 +1,129 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+	#include <poll.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#else
+	#include <filesystem>
+#endif
+
+// Reports watched files that were written. On Linux this is inotify on the files' directories rather than
+// on the files, because editors often save by writing a new file and renaming it over the old one; other
+// platforms poll the modification times
+class FileWatcher
+{
+public:
+	FileWatcher() {}
+	~FileWatcher() { Close(); }
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	bool Add(const std::string& path)
+	{
+		if (std::find(paths.begin(), paths.end(), path) != paths.end())
+			return true;
+		paths.push_back(path);
+#ifdef __linux__
+		if (descriptor < 0) {
+			descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (descriptor < 0)
+				return false;
+		}
+		size_t slash = path.find_last_of('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		int watch = inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (watch < 0)
+			return false;
+		if (std::find(directories.begin(), directories.end(), Directory{ watch, directory }) == directories.end())
+			directories.push_back(Directory{ watch, directory });
+#else
+		std::error_code ignored;
+		times.push_back(std::filesystem::last_write_time(path, ignored));
+#endif
+		return true;
+	}
+
+	// waits up to timeoutMs for writes and returns the watched paths that changed, each once
+	std::vector<std::string> Wait(int timeoutMs)
+	{
+		std::vector<std::string> changed;
+#ifdef __linux__
+		if (descriptor < 0)
+			return changed;
+		pollfd request = { descriptor, POLLIN, 0 };
+		if (poll(&request, 1, timeoutMs) <= 0)
+			return changed;
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(descriptor, buffer, sizeof(buffer))) > 0) {
+			for (ssize_t offset = 0; offset < length;) {
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+				if (event->len == 0)
+					continue;
+				for (const Directory& directory : directories) {
+					if (directory.Watch != event->wd)
+						continue;
+					std::string path = directory.Path + "/" + event->name;
+					if (std::find(paths.begin(), paths.end(), path) != paths.end() && std::find(changed.begin(), changed.end(), path) == changed.end())
+						changed.push_back(path);
+				}
+			}
+		}
+#else
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+		for (;;) {
+			for (size_t i = 0; i < paths.size(); ++i) {
+				std::error_code error;
+				std::filesystem::file_time_type time = std::filesystem::last_write_time(paths[i], error);
+				if (!error && time != times[i]) {
+					times[i] = time;
+					changed.push_back(paths[i]);
+				}
+			}
+			if (!changed.empty() || std::chrono::steady_clock::now() >= deadline)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+#endif
+		return changed;
+	}
+
+	void Close()
+	{
+#ifdef __linux__
+		if (descriptor >= 0)
+			close(descriptor);
+		descriptor = -1;
+		directories.clear();
+#else
+		times.clear();
+#endif
+		paths.clear();
+	}
+
+private:
+	std::vector<std::string> paths;
+#ifdef __linux__
+	struct Directory
+	{
+		int Watch;
+		std::string Path;
+		bool operator==(const Directory& other) const { return Watch == other.Watch; }
+	};
+	int descriptor = -1;
+	std::vector<Directory> directories;
+#else
+	std::vector<std::filesystem::file_time_type> times;
+#endif
+};
+#endif
@@ -0,0 +1,108 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "transform_system.h"
+
+// Tests the world-space bounds of every object of a TransformSystem against six frustum planes, four objects
+// per batch. An object is culled when its sphere or its world-space box (the axis-aligned box around its
+// transformed model box) lies entirely behind one plane; testing against the smaller of the two radii along the
+// plane normal gets the tighter answer of both in one comparison. Like TransformSystem::Update, a cull can be
+// split across threads (BeginCull, CullBatches on disjoint ranges, EndCull).
+class FrustumCuller
+{
+public:
+	// planes as (unit normal, distance) with the normals pointing inside (see Camera::GetFrustumPlanes). Only the
+	// first limit objects are tested; the others, culled elsewhere (e.g. on the GPU), stay flagged visible and
+	// are left out of the counts.
+	void Cull(const TransformSystem& transforms, const glm::vec4 planes[6], size_t limit = SIZE_MAX)
+	{
+		BeginCull(transforms, limit);
+		EndCull(CullBatches(transforms, planes, 0, Batches()));
+	}
+
+	// first step of a cull: sizes the flags, every object visible
+	void BeginCull(const TransformSystem& transforms, size_t limit = SIZE_MAX)
+	{
+		tested = std::min(limit, transforms.Count());
+		visible.assign(transforms.Batches() * TransformSystem::BATCH, 1);
+	}
+
+	// batches holding the objects a cull tests
+	size_t Batches() const { return (tested + TransformSystem::BATCH - 1) / TransformSystem::BATCH; }
+
+	// tests the batches [first, last) (clamped to Batches()) and returns how many of their objects are visible;
+	// safe to call from several threads at once on disjoint ranges
+	size_t CullBatches(const TransformSystem& transforms, const glm::vec4 planes[6], size_t first, size_t last)
+	{
+		using namespace transform_lanes;
+		const size_t count = tested;
+		size_t visibleInRange = 0;
+
+		const float* centerX = transforms.BoundsCenter(0);
+		const float* centerY = transforms.BoundsCenter(1);
+		const float* centerZ = transforms.BoundsCenter(2);
+		const float* extentX = transforms.BoundsExtent(0);
+		const float* extentY = transforms.BoundsExtent(1);
+		const float* extentZ = transforms.BoundsExtent(2);
+		const float* radius = transforms.BoundsRadius();
+
+		for (size_t batch = first; batch < std::min(last, Batches()); ++batch) {
+			const size_t object = batch * TransformSystem::BATCH;
+			Lanes x = Load(&centerX[object]), y = Load(&centerY[object]), z = Load(&centerZ[object]);
+			Lanes ex = Load(&extentX[object]), ey = Load(&extentY[object]), ez = Load(&extentZ[object]);
+			Lanes r = Load(&radius[object]);
+
+			int outside = 0;
+			for (int p = 0; p < 6; ++p) {
+				Lanes distance = Plus(Plus(Times(Splat(planes[p].x), x), Times(Splat(planes[p].y), y)), Plus(Times(Splat(planes[p].z), z), Splat(planes[p].w)));
+				Lanes boxRadius = Plus(Plus(Times(Splat(std::fabs(planes[p].x)), ex), Times(Splat(std::fabs(planes[p].y)), ey)), Times(Splat(std::fabs(planes[p].z)), ez));
+				outside |= NegativeMask(Plus(distance, Min(r, boxRadius)));
+			}
+
+			for (size_t lane = 0; lane < TransformSystem::BATCH && object + lane < count; ++lane) {
+				visible[object + lane] = (outside >> lane & 1) == 0;
+				visibleInRange += visible[object + lane];
+			}
+		}
+		return visibleInRange;
+	}
+
+	// a cull decided elsewhere (e.g. by a BVH query): the objects listed are visible, every other tested object is
+	// culled; objects past the limit are ignored like in Cull
+	void SetVisible(const TransformSystem& transforms, const std::vector<TransformSystem::Handle>& objects, size_t limit = SIZE_MAX)
+	{
+		BeginCull(transforms, limit);
+		std::fill(visible.begin(), visible.begin() + tested, static_cast<uint8_t>(0));
+		size_t visibleObjects = 0;
+		for (TransformSystem::Handle object : objects) {
+			if (static_cast<size_t>(object) < tested) {
+				visible[object] = 1;
+				++visibleObjects;
+			}
+		}
+		EndCull(visibleObjects);
+	}
+
+	// last step of a cull, with the counts of every CullBatches call summed
+	void EndCull(size_t visibleObjects)
+	{
+		visibleCount = visibleObjects;
+		culledCount = tested - visibleObjects;
+	}
+
+	bool Visible(TransformSystem::Handle handle) const { return visible[handle] != 0; }
+	// one flag per object (padded to whole batches)
+	const uint8_t* VisibleFlags() const { return visible.data(); }
+	size_t VisibleCount() const { return visibleCount; }
+	size_t CulledCount() const { return culledCount; }
+
+private:
+	std::vector<uint8_t> visible;
+	size_t tested = 0;			// objects the current cull tests (the first ones)
+	size_t visibleCount = 0;
+	size_t culledCount = 0;
+};
+#endif
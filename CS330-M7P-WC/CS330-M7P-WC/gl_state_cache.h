@@ -0,0 +1,98 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+#include <GL/glew.h>
+
+const GLuint STATE_CACHE_TEXTURE_UNITS = 8;		// units whose texture bindings are shadowed
+const GLuint STATE_CACHE_STORAGE_BINDINGS = 8;	// shader storage binding points whose buffers are shadowed
+
+// Shadow copy of the GL bindings draws change: program, vertex array, active texture unit, textures, shader
+// storage buffers and the indirect draw buffers. Every bind goes through here and reaches GL only when the value
+// differs from the shadow. Code that binds behind its back has to call Invalidate() before the cache is used
+// again, which makes the next bind of every kind go through.
+class GLStateCache
+{
+public:
+	// statistics since the last ResetCounters(): binds issued to GL and redundant binds skipped
+	unsigned int ChangeCount = 0;
+	unsigned int SkippedCount = 0;
+
+	GLStateCache() { Invalidate(); }
+
+	// forgets every binding
+	void Invalidate()
+	{
+		program = vertexArray = activeUnit = UNKNOWN;
+		for (GLuint unit = 0; unit < STATE_CACHE_TEXTURE_UNITS; ++unit)
+			textures[unit][0] = textures[unit][1] = UNKNOWN;
+		for (GLuint index = 0; index < STATE_CACHE_STORAGE_BINDINGS; ++index)
+			storageBuffers[index] = UNKNOWN;
+		indirectBuffer = parameterBuffer = UNKNOWN;
+	}
+
+	void ResetCounters() { ChangeCount = SkippedCount = 0; }
+
+	void UseProgram(GLuint id)
+	{
+		if (change(program, id))
+			glUseProgram(id);
+	}
+
+	void BindVertexArray(GLuint vao)
+	{
+		if (change(vertexArray, vao))
+			glBindVertexArray(vao);
+	}
+
+	// binds a GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY texture to a unit, switching the active unit only when needed
+	void BindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		if (!change(textures[unit][target == GL_TEXTURE_2D_ARRAY ? 1 : 0], texture))
+			return;
+		if (change(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+	}
+
+	// binds a whole buffer to a shader storage binding point
+	void BindStorageBuffer(GLuint index, GLuint buffer)
+	{
+		if (change(storageBuffers[index], buffer))
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer);
+	}
+
+	void BindIndirectBuffer(GLuint buffer)
+	{
+		if (change(indirectBuffer, buffer))
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+	}
+
+	void BindParameterBuffer(GLuint buffer)
+	{
+		if (change(parameterBuffer, buffer))
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, buffer);
+	}
+
+private:
+	static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;	// never a GL name, so the next bind always goes through
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLuint textures[STATE_CACHE_TEXTURE_UNITS][2];	// GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY
+	GLuint storageBuffers[STATE_CACHE_STORAGE_BINDINGS];
+	GLuint indirectBuffer;
+	GLuint parameterBuffer;
+
+	// stores the new value and counts the outcome; false when it was already current
+	bool change(GLuint& current, GLuint value)
+	{
+		if (current == value) {
+			++SkippedCount;
+			return false;
+		}
+		current = value;
+		++ChangeCount;
+		return true;
+	}
+};
+#endif
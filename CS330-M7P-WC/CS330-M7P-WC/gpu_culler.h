@@ -0,0 +1,138 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "indirect_draws.h"
+
+// Storage block bindings of the culling compute shader; it reads the draw data at DRAW_DATA_BINDING
+const GLuint CULL_BOUNDS_BINDING = 2;
+const GLuint CULL_COMMANDS_BINDING = 3;
+const GLuint CULL_VISIBLE_COMMANDS_BINDING = 4;
+const GLuint CULL_COUNT_BINDING = 5;
+const GLuint CULL_VISIBILITY_BINDING = 6;
+const GLuint CULL_GROUP_SIZE = 64;	// local_size_x of cull.comp
+
+// Passes of cull.comp (its cullPhase uniform). With occlusion culling a frame runs two: the early pass before
+// anything is drawn, and the late pass once the depth pyramid holds what the early draws and the rest of the
+// frame left in the depth buffer.
+const int CULL_PHASE_ALL = 0;		// frustum test only
+const int CULL_PHASE_EARLY = 1;		// frustum test, keeping the draws the last occlusion test found visible
+const int CULL_PHASE_LATE = 2;		// frustum and occlusion test, keeping the visible draws the early pass left out
+
+// Model-space bounds of one draw, matching the std430 DrawBounds struct of cull.comp
+struct DrawBounds
+{
+	glm::vec4 CenterRadius;	// bounding sphere; a radius of 0 or less means unbounded (never culled)
+	glm::vec4 Extents;		// half size of the axis-aligned box around the center
+};
+
+// Buffers of GPU frustum culling for one IndirectDrawList. A compute pass tests every draw's bounds, placed by
+// its DrawData world matrix, and appends the commands of the visible ones to VisibleCommands while counting
+// them in CountBuffer. glMultiDrawElementsIndirectCount then draws exactly that many without the CPU ever
+// seeing the result; without ARB_indirect_parameters the whole buffer is drawn instead, and the slots past the
+// count hold commands cleared to zero, which draw nothing. Compacted commands keep their BaseInstance, so every
+// draw still finds its own DrawData. The late pass of occlusion culling writes its own commands and counts, so
+// it never overwrites what the early draw reads, and keeps every draw's occlusion result for the next frame.
+class GpuCuller
+{
+public:
+	GLuint BoundsBuffer = 0;		// shader storage buffer of DrawBounds
+	GLuint VisibleCommands = 0;		// written by the compute pass, read as the GL_DRAW_INDIRECT_BUFFER
+	GLuint CountBuffer = 0;			// visible draws (read as the GL_PARAMETER_BUFFER of the count draw), then occluded draws
+	GLuint LateCommands = 0;		// the same two for the late pass
+	GLuint LateCountBuffer = 0;
+	GLuint VisibilityBuffer = 0;	// one uint per draw: it passed the last occlusion test (all of them at first)
+	std::vector<DrawBounds> Bounds;	// one per draw, in the draw list's order
+
+	void Create()
+	{
+		GLuint buffers[6];
+		glGenBuffers(6, buffers);
+		BoundsBuffer = buffers[0];
+		VisibleCommands = buffers[1];
+		CountBuffer = buffers[2];
+		LateCommands = buffers[3];
+		LateCountBuffer = buffers[4];
+		VisibilityBuffer = buffers[5];
+	}
+
+	// appends the bounds of the next draw of the list
+	void Add(const PoolMesh& mesh)
+	{
+		DrawBounds bounds;
+		bounds.CenterRadius = glm::vec4(mesh.Center, mesh.Radius);
+		bounds.Extents = glm::vec4(mesh.Extents, 0.0f);
+		Bounds.push_back(bounds);
+	}
+
+	// sends the bounds and sizes the output buffers; the bounds are in model space, so they never change
+	void Upload()
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, BoundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, Bounds.size() * sizeof(DrawBounds), Bounds.data(), GL_STATIC_DRAW);
+		for (bool late : { false, true }) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, Commands(late));
+			glBufferData(GL_SHADER_STORAGE_BUFFER, Bounds.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, Counts(late));
+			glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		}
+		const std::vector<GLuint> visible(Bounds.size(), 1);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, VisibilityBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, visible.size() * sizeof(GLuint), visible.data(), GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// output buffers of the early (or only) pass, or of the late pass
+	GLuint Commands(bool late) const { return late ? LateCommands : VisibleCommands; }
+	GLuint Counts(bool late) const { return late ? LateCountBuffer : CountBuffer; }
+
+	// zeroes the counts, and the output commands too when they are all drawn (fixed count), before a dispatch
+	void Clear(bool clearCommands, bool late = false) const
+	{
+		const GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, Counts(late));
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		if (clearCommands) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, Commands(late));
+			glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// binds everything the compute pass reads and writes
+	void Bind(const IndirectDrawList& draws, bool late = false) const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, draws.DrawBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_BOUNDS_BINDING, BoundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, draws.CommandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBLE_COMMANDS_BINDING, Commands(late));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COUNT_BINDING, Counts(late));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBILITY_BINDING, VisibilityBuffer);
+	}
+
+	GLuint GroupCount() const { return static_cast<GLuint>((Bounds.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE); }
+	GLsizei Count() const { return static_cast<GLsizei>(Bounds.size()); }
+
+	// reads the numbers of visible and occluded draws back, which waits for the compute pass: for statistics only
+	void ReadCounts(GLuint& visible, GLuint& occluded, bool late = false) const
+	{
+		GLuint counts[2] = { 0, 0 };
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, Counts(late));
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		visible = counts[0];
+		occluded = counts[1];
+	}
+
+	void Destroy()
+	{
+		GLuint buffers[6] = { BoundsBuffer, VisibleCommands, CountBuffer, LateCommands, LateCountBuffer, VisibilityBuffer };
+		glDeleteBuffers(6, buffers);
+		BoundsBuffer = VisibleCommands = CountBuffer = LateCommands = LateCountBuffer = VisibilityBuffer = 0;
+		Bounds.clear();
+	}
+};
+#endif
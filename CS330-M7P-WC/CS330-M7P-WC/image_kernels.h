@@ -0,0 +1,665 @@
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMAGE_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define IMAGE_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit SSE4/AVX2 instructions inside functions compiled for those targets;
+// MSVC accepts the intrinsics anywhere. Either way they only run after the CPU check below.
+#if defined(IMAGE_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define IMAGE_KERNELS_SSE4_TARGET __attribute__((target("ssse3,sse4.1")))
+#define IMAGE_KERNELS_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define IMAGE_KERNELS_SSE4_TARGET
+#define IMAGE_KERNELS_AVX2_TARGET
+#endif
+
+// One implementation of every image kernel. All images are 8 bits per channel with tightly packed rows;
+// every implementation produces bit-identical results to the scalar one.
+struct ImageKernels
+{
+	const char* Name;
+	// reverses the row order in place (images are loaded top row first, OpenGL wants the bottom row first)
+	void (*FlipRows)(unsigned char* image, size_t rowBytes, int height);
+	// 1, 2 and 3 channel pixels to RGBA; alpha is 255 unless the source has one
+	void (*RgbToRgba)(const unsigned char* source, unsigned char* destination, size_t pixels);
+	void (*GrayToRgba)(const unsigned char* source, unsigned char* destination, size_t pixels);
+	void (*GrayAlphaToRgba)(const unsigned char* source, unsigned char* destination, size_t pixels);
+	// color = round(color * alpha / 255), alpha unchanged
+	void (*PremultiplyAlpha)(unsigned char* rgba, size_t pixels);
+	// RGBA sRGB8 to RGBA linear16 and back; alpha is linear in both and only rescaled
+	void (*SrgbToLinear)(const unsigned char* source, uint16_t* destination, size_t pixels);
+	void (*LinearToSrgb)(const uint16_t* source, unsigned char* destination, size_t pixels);
+	// 2x2 box filter of an RGBA image into max(1, width / 2) x max(1, height / 2); the last row/column
+	// is repeated when a dimension is 1, and an odd last row/column is dropped like GL's own mip chains
+	void (*DownsampleRgba)(const unsigned char* source, int width, int height, unsigned char* destination);
+	// the same 2x2 box filter on sRGB-encoded colors, averaged in linear light so mips do not darken
+	void (*DownsampleSrgbRgba)(const unsigned char* source, int width, int height, unsigned char* destination);
+
+	// converts one row of 1-4 channel pixels to RGBA
+	void ExpandToRgba(const unsigned char* source, int channels, unsigned char* destination, size_t pixels) const
+	{
+		switch (channels) {
+		case 1: GrayToRgba(source, destination, pixels); break;
+		case 2: GrayAlphaToRgba(source, destination, pixels); break;
+		case 3: RgbToRgba(source, destination, pixels); break;
+		default: std::memcpy(destination, source, pixels * 4); break;
+		}
+	}
+};
+
+// Lookup tables shared by every implementation: the sRGB curve is a table lookup per channel, which
+// keeps the SIMD versions bit-exact (and gathers are no faster than scalar loads before AVX-512), so
+// every implementation runs the scalar sRGB kernels
+class SrgbTables
+{
+public:
+	static const SrgbTables& Get()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	uint16_t ToLinear[256];			// sRGB8 -> linear16
+	unsigned char ToSrgb[4096];		// linear16 >> 4 -> sRGB8
+
+	static unsigned char AlphaToByte(uint16_t alpha) { return static_cast<unsigned char>((alpha * 255u + 32895u) >> 16); }
+	static uint16_t AlphaToWord(unsigned char alpha) { return static_cast<uint16_t>(alpha * 257u); }
+
+private:
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; ++i) {
+			double s = i / 255.0;
+			double linear = s <= 0.04045 ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4);
+			ToLinear[i] = static_cast<uint16_t>(linear * 65535.0 + 0.5);
+		}
+		// each entry covers 16 linear16 values and is evaluated at the middle of its range
+		for (int i = 0; i < 4096; ++i) {
+			double linear = (i * 16 + 7.5) / 65535.0;
+			double s = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+			ToSrgb[i] = static_cast<unsigned char>(std::min(255.0, s * 255.0 + 0.5));
+		}
+	}
+};
+
+// Reference implementation, and the tail of every vectorized loop
+struct ScalarImageKernels
+{
+	static void FlipRows(unsigned char* image, size_t rowBytes, int height)
+	{
+		for (int j = 0; j < height / 2; ++j) {
+			unsigned char* top = image + j * rowBytes;
+			unsigned char* bottom = image + (height - 1 - j) * rowBytes;
+			for (size_t i = 0; i < rowBytes; ++i)
+				std::swap(top[i], bottom[i]);
+		}
+	}
+
+	static void RgbToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i) {
+			destination[i * 4 + 0] = source[i * 3 + 0];
+			destination[i * 4 + 1] = source[i * 3 + 1];
+			destination[i * 4 + 2] = source[i * 3 + 2];
+			destination[i * 4 + 3] = 255;
+		}
+	}
+
+	static void GrayToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i) {
+			destination[i * 4 + 0] = destination[i * 4 + 1] = destination[i * 4 + 2] = source[i];
+			destination[i * 4 + 3] = 255;
+		}
+	}
+
+	static void GrayAlphaToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i) {
+			destination[i * 4 + 0] = destination[i * 4 + 1] = destination[i * 4 + 2] = source[i * 2];
+			destination[i * 4 + 3] = source[i * 2 + 1];
+		}
+	}
+
+	// (t + (t >> 8)) >> 8 with t = c * a + 128 is exactly round(c * a / 255) for 8-bit inputs
+	static unsigned char MultiplyByte(unsigned int color, unsigned int alpha)
+	{
+		unsigned int t = color * alpha + 128;
+		return static_cast<unsigned char>((t + (t >> 8)) >> 8);
+	}
+
+	static void PremultiplyAlpha(unsigned char* rgba, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i) {
+			unsigned char* pixel = rgba + i * 4;
+			pixel[0] = MultiplyByte(pixel[0], pixel[3]);
+			pixel[1] = MultiplyByte(pixel[1], pixel[3]);
+			pixel[2] = MultiplyByte(pixel[2], pixel[3]);
+		}
+	}
+
+	static void SrgbToLinear(const unsigned char* source, uint16_t* destination, size_t pixels)
+	{
+		const SrgbTables& tables = SrgbTables::Get();
+		for (size_t i = 0; i < pixels; ++i) {
+			destination[i * 4 + 0] = tables.ToLinear[source[i * 4 + 0]];
+			destination[i * 4 + 1] = tables.ToLinear[source[i * 4 + 1]];
+			destination[i * 4 + 2] = tables.ToLinear[source[i * 4 + 2]];
+			destination[i * 4 + 3] = SrgbTables::AlphaToWord(source[i * 4 + 3]);
+		}
+	}
+
+	static void LinearToSrgb(const uint16_t* source, unsigned char* destination, size_t pixels)
+	{
+		const SrgbTables& tables = SrgbTables::Get();
+		for (size_t i = 0; i < pixels; ++i) {
+			destination[i * 4 + 0] = tables.ToSrgb[source[i * 4 + 0] >> 4];
+			destination[i * 4 + 1] = tables.ToSrgb[source[i * 4 + 1] >> 4];
+			destination[i * 4 + 2] = tables.ToSrgb[source[i * 4 + 2] >> 4];
+			destination[i * 4 + 3] = SrgbTables::AlphaToByte(source[i * 4 + 3]);
+		}
+	}
+
+	// averages dst pixels [first, last) of one destination row
+	static void DownsampleRow(const unsigned char* row0, const unsigned char* row1, int width, int first, int last, unsigned char* destination)
+	{
+		for (int x = first; x < last; ++x) {
+			const int x0 = 2 * x * 4;
+			const int x1 = std::min(2 * x + 1, width - 1) * 4;
+			for (int c = 0; c < 4; ++c)
+				destination[x * 4 + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+
+	static void DownsampleRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		downsample(source, width, height, destination, DownsampleRow);
+	}
+
+	static void DownsampleSrgbRow(const unsigned char* row0, const unsigned char* row1, int width, int first, int last, unsigned char* destination)
+	{
+		const SrgbTables& tables = SrgbTables::Get();
+		for (int x = first; x < last; ++x) {
+			const int x0 = 2 * x * 4;
+			const int x1 = std::min(2 * x + 1, width - 1) * 4;
+			for (int c = 0; c < 3; ++c) {
+				unsigned int sum = tables.ToLinear[row0[x0 + c]] + tables.ToLinear[row0[x1 + c]] + tables.ToLinear[row1[x0 + c]] + tables.ToLinear[row1[x1 + c]];
+				destination[x * 4 + c] = tables.ToSrgb[((sum + 2) >> 2) >> 4];
+			}
+			destination[x * 4 + 3] = static_cast<unsigned char>((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+		}
+	}
+
+	static void DownsampleSrgbRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		downsample(source, width, height, destination, DownsampleSrgbRow);
+	}
+
+	// walks the destination rows, handing each one to a row kernel
+	template <typename RowKernel>
+	static void downsample(const unsigned char* source, int width, int height, unsigned char* destination, RowKernel rowKernel)
+	{
+		const int targetWidth = std::max(1, width / 2);
+		const int targetHeight = std::max(1, height / 2);
+		const size_t rowBytes = static_cast<size_t>(width) * 4;
+		for (int y = 0; y < targetHeight; ++y) {
+			const unsigned char* row0 = source + 2 * y * rowBytes;
+			const unsigned char* row1 = source + std::min(2 * y + 1, height - 1) * rowBytes;
+			rowKernel(row0, row1, width, 0, targetWidth, destination + static_cast<size_t>(y) * targetWidth * 4);
+		}
+	}
+};
+
+#ifdef IMAGE_KERNELS_X86
+// SSSE3 byte shuffles plus SSE4.1 blends, 16 bytes at a time
+struct Sse4ImageKernels
+{
+	IMAGE_KERNELS_SSE4_TARGET static void FlipRows(unsigned char* image, size_t rowBytes, int height)
+	{
+		for (int j = 0; j < height / 2; ++j) {
+			unsigned char* top = image + j * rowBytes;
+			unsigned char* bottom = image + (height - 1 - j) * rowBytes;
+			size_t i = 0;
+			for (; i + 16 <= rowBytes; i += 16) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(top + i), b);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(bottom + i), a);
+			}
+			for (; i < rowBytes; ++i)
+				std::swap(top[i], bottom[i]);
+		}
+	}
+
+	IMAGE_KERNELS_SSE4_TARGET static void RgbToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		size_t i = 0;
+		// each 16-byte load uses 12 bytes, so stop while the over-read still lands inside the source
+		for (; i + 6 <= pixels; i += 4) {
+			__m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+		}
+		ScalarImageKernels::RgbToRgba(source + i * 3, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_SSE4_TARGET static void GrayToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		const __m128i shuffle[4] = {
+			_mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1),
+			_mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1),
+			_mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1),
+			_mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1)
+		};
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			__m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+			for (int k = 0; k < 4; ++k)
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + (i + k * 4) * 4), _mm_or_si128(_mm_shuffle_epi8(gray, shuffle[k]), alpha));
+		}
+		ScalarImageKernels::GrayToRgba(source + i, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_SSE4_TARGET static void GrayAlphaToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m128i shuffleLow = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+		const __m128i shuffleHigh = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8) {
+			__m128i grayAlpha = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_shuffle_epi8(grayAlpha, shuffleLow));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4 + 16), _mm_shuffle_epi8(grayAlpha, shuffleHigh));
+		}
+		ScalarImageKernels::GrayAlphaToRgba(source + i * 2, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_SSE4_TARGET static void PremultiplyAlpha(unsigned char* rgba, size_t pixels)
+	{
+		// alpha of each pixel spread over its four 16-bit channels
+		const __m128i alphaLow = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+		const __m128i alphaHigh = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+		const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 4 <= pixels; i += 4) {
+			__m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+			__m128i low = multiply(_mm_unpacklo_epi8(pixel, zero), _mm_shuffle_epi8(pixel, alphaLow));
+			__m128i high = multiply(_mm_unpackhi_epi8(pixel, zero), _mm_shuffle_epi8(pixel, alphaHigh));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_blendv_epi8(_mm_packus_epi16(low, high), pixel, alphaMask));
+		}
+		ScalarImageKernels::PremultiplyAlpha(rgba + i * 4, pixels - i);
+	}
+
+	static void SrgbToLinear(const unsigned char* source, uint16_t* destination, size_t pixels)
+	{
+		ScalarImageKernels::SrgbToLinear(source, destination, pixels);
+	}
+
+	static void LinearToSrgb(const uint16_t* source, unsigned char* destination, size_t pixels)
+	{
+		ScalarImageKernels::LinearToSrgb(source, destination, pixels);
+	}
+
+	IMAGE_KERNELS_SSE4_TARGET static void DownsampleRow(const unsigned char* row0, const unsigned char* row1, int width, int first, int last, unsigned char* destination)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16(2);
+		int x = first;
+		// 8 source pixels of each row make 4 destination pixels; needs width >= 2 so 2x + 1 is in range
+		for (; width >= 2 && x + 4 <= last; x += 4) {
+			__m128 a0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8)));
+			__m128 a1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16)));
+			__m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8)));
+			__m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16)));
+			__m128i evenA = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i oddA = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+			__m128i evenB = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i oddB = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+			__m128i low = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(evenA, zero), _mm_unpacklo_epi8(oddA, zero)),
+				_mm_add_epi16(_mm_unpacklo_epi8(evenB, zero), _mm_unpacklo_epi8(oddB, zero)));
+			__m128i high = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(evenA, zero), _mm_unpackhi_epi8(oddA, zero)),
+				_mm_add_epi16(_mm_unpackhi_epi8(evenB, zero), _mm_unpackhi_epi8(oddB, zero)));
+			low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+			high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x * 4), _mm_packus_epi16(low, high));
+		}
+		ScalarImageKernels::DownsampleRow(row0, row1, width, x, last, destination);
+	}
+
+	static void DownsampleRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::downsample(source, width, height, destination, DownsampleRow);
+	}
+
+	static void DownsampleSrgbRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::DownsampleSrgbRgba(source, width, height, destination);
+	}
+
+	// 16-bit lanes: round(color * alpha / 255), the same formula as ScalarImageKernels::MultiplyByte
+	IMAGE_KERNELS_SSE4_TARGET static __m128i multiply(__m128i color, __m128i alpha)
+	{
+		__m128i t = _mm_add_epi16(_mm_mullo_epi16(color, alpha), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	}
+};
+
+// The SSE4 algorithms on 32-byte registers; AVX2 shuffles work per 128-bit lane, hence the permutes
+struct Avx2ImageKernels
+{
+	IMAGE_KERNELS_AVX2_TARGET static void FlipRows(unsigned char* image, size_t rowBytes, int height)
+	{
+		for (int j = 0; j < height / 2; ++j) {
+			unsigned char* top = image + j * rowBytes;
+			unsigned char* bottom = image + (height - 1 - j) * rowBytes;
+			size_t i = 0;
+			for (; i + 32 <= rowBytes; i += 32) {
+				__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+				__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(top + i), b);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(bottom + i), a);
+			}
+			for (; i < rowBytes; ++i)
+				std::swap(top[i], bottom[i]);
+		}
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static void RgbToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+		size_t i = 0;
+		// pixels 0-3 in the low lane, 4-7 in the high lane; the second load over-reads 4 bytes
+		for (; i + 10 <= pixels; i += 8) {
+			__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3));
+			__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3 + 12));
+			__m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha));
+		}
+		ScalarImageKernels::RgbToRgba(source + i * 3, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static void GrayToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+		const __m256i shuffleLow = _mm256_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1,
+			4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+		const __m256i shuffleHigh = _mm256_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1,
+			12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			__m256i gray = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(gray, shuffleLow), alpha));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4 + 32), _mm256_or_si256(_mm256_shuffle_epi8(gray, shuffleHigh), alpha));
+		}
+		ScalarImageKernels::GrayToRgba(source + i, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static void GrayAlphaToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		const __m256i shuffleLow = _mm256_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7,
+			0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+		const __m256i shuffleHigh = _mm256_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15,
+			8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			__m256i grayAlpha = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 2));
+			__m256i low = _mm256_shuffle_epi8(grayAlpha, shuffleLow);		// pixels 0-3 | 8-11
+			__m256i high = _mm256_shuffle_epi8(grayAlpha, shuffleHigh);	// pixels 4-7 | 12-15
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_permute2x128_si256(low, high, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4 + 32), _mm256_permute2x128_si256(low, high, 0x31));
+		}
+		ScalarImageKernels::GrayAlphaToRgba(source + i * 2, destination + i * 4, pixels - i);
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static void PremultiplyAlpha(unsigned char* rgba, size_t pixels)
+	{
+		const __m256i alphaLow = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+			3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+		const __m256i alphaHigh = _mm256_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1,
+			11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+		const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+		const __m256i zero = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8) {
+			__m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + i * 4));
+			__m256i low = multiply(_mm256_unpacklo_epi8(pixel, zero), _mm256_shuffle_epi8(pixel, alphaLow));
+			__m256i high = multiply(_mm256_unpackhi_epi8(pixel, zero), _mm256_shuffle_epi8(pixel, alphaHigh));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4), _mm256_blendv_epi8(_mm256_packus_epi16(low, high), pixel, alphaMask));
+		}
+		ScalarImageKernels::PremultiplyAlpha(rgba + i * 4, pixels - i);
+	}
+
+	static void SrgbToLinear(const unsigned char* source, uint16_t* destination, size_t pixels)
+	{
+		ScalarImageKernels::SrgbToLinear(source, destination, pixels);
+	}
+
+	static void LinearToSrgb(const uint16_t* source, unsigned char* destination, size_t pixels)
+	{
+		ScalarImageKernels::LinearToSrgb(source, destination, pixels);
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static void DownsampleRow(const unsigned char* row0, const unsigned char* row1, int width, int first, int last, unsigned char* destination)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i two = _mm256_set1_epi16(2);
+		int x = first;
+		for (; width >= 2 && x + 8 <= last; x += 8) {
+			__m256 a0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + x * 8)));
+			__m256 a1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + x * 8 + 32)));
+			__m256 b0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + x * 8)));
+			__m256 b1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + x * 8 + 32)));
+			// per lane: even/odd source pixels of destination pixels 0, 1, 4, 5 | 2, 3, 6, 7
+			__m256i evenA = _mm256_castps_si256(_mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m256i oddA = _mm256_castps_si256(_mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+			__m256i evenB = _mm256_castps_si256(_mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m256i oddB = _mm256_castps_si256(_mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+			__m256i low = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(evenA, zero), _mm256_unpacklo_epi8(oddA, zero)),
+				_mm256_add_epi16(_mm256_unpacklo_epi8(evenB, zero), _mm256_unpacklo_epi8(oddB, zero)));
+			__m256i high = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(evenA, zero), _mm256_unpackhi_epi8(oddA, zero)),
+				_mm256_add_epi16(_mm256_unpackhi_epi8(evenB, zero), _mm256_unpackhi_epi8(oddB, zero)));
+			low = _mm256_srli_epi16(_mm256_add_epi16(low, two), 2);
+			high = _mm256_srli_epi16(_mm256_add_epi16(high, two), 2);
+			__m256i packed = _mm256_packus_epi16(low, high);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+		Sse4ImageKernels::DownsampleRow(row0, row1, width, x, last, destination);
+	}
+
+	static void DownsampleRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::downsample(source, width, height, destination, DownsampleRow);
+	}
+
+	static void DownsampleSrgbRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::DownsampleSrgbRgba(source, width, height, destination);
+	}
+
+	IMAGE_KERNELS_AVX2_TARGET static __m256i multiply(__m256i color, __m256i alpha)
+	{
+		__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(color, alpha), _mm256_set1_epi16(128));
+		return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+};
+#endif
+
+#ifdef IMAGE_KERNELS_NEON
+// Structured loads/stores (vld2/3/4, vst4) do the channel (de)interleaving in hardware
+struct NeonImageKernels
+{
+	static void FlipRows(unsigned char* image, size_t rowBytes, int height)
+	{
+		for (int j = 0; j < height / 2; ++j) {
+			unsigned char* top = image + j * rowBytes;
+			unsigned char* bottom = image + (height - 1 - j) * rowBytes;
+			size_t i = 0;
+			for (; i + 16 <= rowBytes; i += 16) {
+				uint8x16_t a = vld1q_u8(top + i);
+				uint8x16_t b = vld1q_u8(bottom + i);
+				vst1q_u8(top + i, b);
+				vst1q_u8(bottom + i, a);
+			}
+			for (; i < rowBytes; ++i)
+				std::swap(top[i], bottom[i]);
+		}
+	}
+
+	static void RgbToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			uint8x16x3_t rgb = vld3q_u8(source + i * 3);
+			uint8x16x4_t rgba = { { rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(255) } };
+			vst4q_u8(destination + i * 4, rgba);
+		}
+		ScalarImageKernels::RgbToRgba(source + i * 3, destination + i * 4, pixels - i);
+	}
+
+	static void GrayToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			uint8x16_t gray = vld1q_u8(source + i);
+			uint8x16x4_t rgba = { { gray, gray, gray, vdupq_n_u8(255) } };
+			vst4q_u8(destination + i * 4, rgba);
+		}
+		ScalarImageKernels::GrayToRgba(source + i, destination + i * 4, pixels - i);
+	}
+
+	static void GrayAlphaToRgba(const unsigned char* source, unsigned char* destination, size_t pixels)
+	{
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			uint8x16x2_t grayAlpha = vld2q_u8(source + i * 2);
+			uint8x16x4_t rgba = { { grayAlpha.val[0], grayAlpha.val[0], grayAlpha.val[0], grayAlpha.val[1] } };
+			vst4q_u8(destination + i * 4, rgba);
+		}
+		ScalarImageKernels::GrayAlphaToRgba(source + i * 2, destination + i * 4, pixels - i);
+	}
+
+	static void PremultiplyAlpha(unsigned char* rgba, size_t pixels)
+	{
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			uint8x16x4_t pixel = vld4q_u8(rgba + i * 4);
+			for (int c = 0; c < 3; ++c)
+				pixel.val[c] = vcombine_u8(multiply(vget_low_u8(pixel.val[c]), vget_low_u8(pixel.val[3])),
+					multiply(vget_high_u8(pixel.val[c]), vget_high_u8(pixel.val[3])));
+			vst4q_u8(rgba + i * 4, pixel);
+		}
+		ScalarImageKernels::PremultiplyAlpha(rgba + i * 4, pixels - i);
+	}
+
+	static void SrgbToLinear(const unsigned char* source, uint16_t* destination, size_t pixels)
+	{
+		ScalarImageKernels::SrgbToLinear(source, destination, pixels);
+	}
+
+	static void LinearToSrgb(const uint16_t* source, unsigned char* destination, size_t pixels)
+	{
+		ScalarImageKernels::LinearToSrgb(source, destination, pixels);
+	}
+
+	static void DownsampleRow(const unsigned char* row0, const unsigned char* row1, int width, int first, int last, unsigned char* destination)
+	{
+		int x = first;
+		for (; width >= 2 && x + 4 <= last; x += 4) {
+			// vld2q_u32 splits 8 RGBA pixels into the even and the odd ones
+			uint32x4x2_t a = vld2q_u32(reinterpret_cast<const uint32_t*>(row0 + x * 8));
+			uint32x4x2_t b = vld2q_u32(reinterpret_cast<const uint32_t*>(row1 + x * 8));
+			uint8x16_t evenA = vreinterpretq_u8_u32(a.val[0]), oddA = vreinterpretq_u8_u32(a.val[1]);
+			uint8x16_t evenB = vreinterpretq_u8_u32(b.val[0]), oddB = vreinterpretq_u8_u32(b.val[1]);
+			uint16x8_t low = vaddq_u16(vaddl_u8(vget_low_u8(evenA), vget_low_u8(oddA)), vaddl_u8(vget_low_u8(evenB), vget_low_u8(oddB)));
+			uint16x8_t high = vaddq_u16(vaddl_u8(vget_high_u8(evenA), vget_high_u8(oddA)), vaddl_u8(vget_high_u8(evenB), vget_high_u8(oddB)));
+			// vrshrn adds the rounding 2 before shifting, matching the scalar (sum + 2) >> 2
+			vst1q_u8(destination + x * 4, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+		}
+		ScalarImageKernels::DownsampleRow(row0, row1, width, x, last, destination);
+	}
+
+	static void DownsampleRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::downsample(source, width, height, destination, DownsampleRow);
+	}
+
+	static void DownsampleSrgbRgba(const unsigned char* source, int width, int height, unsigned char* destination)
+	{
+		ScalarImageKernels::DownsampleSrgbRgba(source, width, height, destination);
+	}
+
+	static uint8x8_t multiply(uint8x8_t color, uint8x8_t alpha)
+	{
+		uint16x8_t t = vaddq_u16(vmull_u8(color, alpha), vdupq_n_u16(128));
+		return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+	}
+};
+#endif
+
+template <typename Kernels>
+ImageKernels MakeImageKernels(const char* name)
+{
+	ImageKernels kernels = { name, Kernels::FlipRows, Kernels::RgbToRgba, Kernels::GrayToRgba, Kernels::GrayAlphaToRgba,
+		Kernels::PremultiplyAlpha, Kernels::SrgbToLinear, Kernels::LinearToSrgb, Kernels::DownsampleRgba, Kernels::DownsampleSrgbRgba };
+	return kernels;
+}
+
+// Every implementation the running CPU supports, scalar first and the fastest last
+inline const std::vector<ImageKernels>& SupportedImageKernels()
+{
+	static const std::vector<ImageKernels> supported = [] {
+		std::vector<ImageKernels> kernels;
+		kernels.push_back(MakeImageKernels<ScalarImageKernels>("scalar"));
+#if defined(IMAGE_KERNELS_X86)
+		bool sse4, avx2;
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		sse4 = (info[2] & (1 << 9)) != 0 && (info[2] & (1 << 19)) != 0;
+		// AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+		bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		avx2 = osAvx && (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		sse4 = __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+		avx2 = __builtin_cpu_supports("avx2");
+#endif
+		if (sse4)
+			kernels.push_back(MakeImageKernels<Sse4ImageKernels>("sse4"));
+		if (sse4 && avx2)
+			kernels.push_back(MakeImageKernels<Avx2ImageKernels>("avx2"));
+#elif defined(IMAGE_KERNELS_NEON)
+		kernels.push_back(MakeImageKernels<NeonImageKernels>("neon"));
+#endif
+		return kernels;
+	}();
+	return supported;
+}
+
+// The fastest implementation for the running CPU, chosen once
+inline const ImageKernels& GetImageKernels()
+{
+	return SupportedImageKernels().back();
+}
+#endif
@@ -0,0 +1,173 @@
+#ifndef INDIRECT_DRAWS_H
+#define INDIRECT_DRAWS_H
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "mesh_pool.h"
+
+// Draw index attribute location and per-draw storage block binding of the indirect programs
+const GLuint DRAW_INDEX_LOCATION = 10;
+const GLuint DRAW_DATA_BINDING = 1;
+
+// Layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	uint32_t Count;
+	uint32_t InstanceCount;
+	uint32_t FirstIndex;
+	int32_t BaseVertex;
+	uint32_t BaseInstance;
+};
+
+// Per-draw data, matching the std430 DrawData struct of the shaders (96 bytes, 16-byte aligned)
+struct DrawData
+{
+	glm::mat4 World;
+	glm::vec4 Tint;
+	float Layer;		// texture array layer for the whole draw, or -1 to keep each vertex's own layer
+	float Padding[3];
+};
+
+// A list of pool meshes drawn by one glMultiDrawElementsIndirect call. Shaders find their DrawData through a
+// draw index attribute with divisor 1: every command's BaseInstance is its own index, so the single instance of
+// draw i reads element i of an 0, 1, 2, ... buffer. This does what gl_DrawID does on GL 4.6 without needing it.
+class IndirectDrawList
+{
+public:
+	GLuint Vao = 0;			// the pool's vertex and index buffers plus the draw index attribute
+	GLuint CommandBuffer = 0;
+	GLuint DrawBuffer = 0;	// shader storage buffer of DrawData
+	GLuint IndexBuffer = 0;	// 0, 1, 2, ... read through the draw index attribute
+	std::vector<DrawElementsIndirectCommand> Commands;
+	std::vector<DrawData> Draws;
+
+	void Create()
+	{
+		glGenVertexArrays(1, &Vao);
+		GLuint buffers[3];
+		glGenBuffers(3, buffers);
+		CommandBuffer = buffers[0];
+		DrawBuffer = buffers[1];
+		IndexBuffer = buffers[2];
+	}
+
+	// adds the draw index attribute to the currently bound vertex array
+	void EnableAttributes() const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, IndexBuffer);
+		glVertexAttribIPointer(DRAW_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+		glEnableVertexAttribArray(DRAW_INDEX_LOCATION);
+		glVertexAttribDivisor(DRAW_INDEX_LOCATION, 1);
+	}
+
+	// appends one draw of the mesh and returns its index
+	size_t Add(const PoolMesh& mesh, const glm::mat4& world, const glm::vec4& tint, float layer)
+	{
+		DrawElementsIndirectCommand command;
+		command.Count = mesh.IndexCount;
+		command.InstanceCount = 1;
+		command.FirstIndex = mesh.FirstIndex;
+		command.BaseVertex = mesh.BaseVertex;
+		command.BaseInstance = static_cast<uint32_t>(Commands.size());
+		Commands.push_back(command);
+
+		DrawData draw;
+		draw.World = world;
+		draw.Tint = tint;
+		draw.Layer = layer;
+		draw.Padding[0] = draw.Padding[1] = draw.Padding[2] = 0.0f;
+		Draws.push_back(draw);
+		return Commands.size() - 1;
+	}
+
+	// sends the commands, the draw data and the draw indices to the GPU
+	void Upload()
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		std::vector<uint32_t> indices(Commands.size());
+		for (size_t i = 0; i < indices.size(); ++i)
+			indices[i] = static_cast<uint32_t>(i);
+		glBindBuffer(GL_ARRAY_BUFFER, IndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		UploadDraws();
+	}
+
+	// maps the commands for writing, e.g. to rewrite their instance counts after culling (culled draws keep their
+	// place with a count of 0, so every draw index still finds its own DrawData). The old storage is orphaned, so
+	// every command has to be written before UnmapCommands; any thread may write them. Null if mapping failed.
+	DrawElementsIndirectCommand* MapCommands()
+	{
+		return static_cast<DrawElementsIndirectCommand*>(mapBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer, Commands.size() * sizeof(DrawElementsIndirectCommand)));
+	}
+
+	// false when the mapped contents were lost (which GL allows, e.g. on a display mode change): upload them again
+	bool UnmapCommands()
+	{
+		return unmapBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+	}
+
+	// the same for the draw data, after transforms or materials changed
+	DrawData* MapDraws()
+	{
+		return static_cast<DrawData*>(mapBuffer(GL_SHADER_STORAGE_BUFFER, DrawBuffer, Draws.size() * sizeof(DrawData)));
+	}
+
+	bool UnmapDraws()
+	{
+		return unmapBuffer(GL_SHADER_STORAGE_BUFFER, DrawBuffer);
+	}
+
+	// sends the commands from the CPU copy
+	void UploadCommands()
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// sends only the draw data, after transforms or materials changed (the storage is orphaned, not waited on)
+	void UploadDraws()
+	{
+		const GLsizeiptr bytes = static_cast<GLsizeiptr>(Draws.size() * sizeof(DrawData));
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, DrawBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, Draws.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	GLsizei Count() const { return static_cast<GLsizei>(Commands.size()); }
+
+	void Destroy()
+	{
+		GLuint buffers[3] = { CommandBuffer, DrawBuffer, IndexBuffer };
+		glDeleteVertexArrays(1, &Vao);
+		glDeleteBuffers(3, buffers);
+		Vao = CommandBuffer = DrawBuffer = IndexBuffer = 0;
+		Commands.clear();
+		Draws.clear();
+	}
+
+private:
+	static void* mapBuffer(GLenum target, GLuint buffer, size_t bytes)
+	{
+		glBindBuffer(target, buffer);
+		void* data = glMapBufferRange(target, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(target, 0);
+		return data;
+	}
+
+	static bool unmapBuffer(GLenum target, GLuint buffer)
+	{
+		glBindBuffer(target, buffer);
+		bool intact = glUnmapBuffer(target) == GL_TRUE;
+		glBindBuffer(target, 0);
+		return intact;
+	}
+};
+#endif
@@ -0,0 +1,97 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Attribute locations of the per-instance data; the mesh attributes use locations 0-3
+const GLuint INSTANCE_WORLD_LOCATION = 4;	// mat4, one location per column (4-7)
+const GLuint INSTANCE_TINT_LOCATION = 8;
+const GLuint INSTANCE_LAYER_LOCATION = 9;
+
+// Per-instance vertex attributes, read once per instance (divisor 1)
+struct InstanceData
+{
+	glm::mat4 World;
+	glm::vec4 Tint;		// multiplies the texture color
+	float Layer;		// texture array layer for the whole instance, or -1 to keep each vertex's own layer
+};
+
+// One GL buffer of InstanceData, drawn together with a mesh in a single glDrawElementsInstanced call.
+// Instances are edited on the CPU and uploaded as a whole when they changed, or only the visible ones after culling.
+class InstanceBuffer
+{
+public:
+	GLuint Vao = 0;			// the mesh's vertex and index buffers plus the instance attributes
+	GLuint Buffer = 0;
+	std::vector<InstanceData> Instances;
+
+	void Create()
+	{
+		glGenVertexArrays(1, &Vao);
+		glGenBuffers(1, &Buffer);
+	}
+
+	// adds the per-instance attributes to the currently bound vertex array
+	void EnableAttributes() const
+	{
+		const GLsizei stride = sizeof(InstanceData);
+		glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+		for (GLuint column = 0; column < 4; ++column) {
+			GLuint location = INSTANCE_WORLD_LOCATION + column;
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(InstanceData, World) + sizeof(glm::vec4) * column));
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+		}
+		glVertexAttribPointer(INSTANCE_TINT_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(InstanceData, Tint));
+		glEnableVertexAttribArray(INSTANCE_TINT_LOCATION);
+		glVertexAttribDivisor(INSTANCE_TINT_LOCATION, 1);
+		glVertexAttribPointer(INSTANCE_LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(InstanceData, Layer));
+		glEnableVertexAttribArray(INSTANCE_LAYER_LOCATION);
+		glVertexAttribDivisor(INSTANCE_LAYER_LOCATION, 1);
+	}
+
+	// sends Instances to the GPU, or only those whose visible flag is set; the old storage is orphaned so a draw
+	// still reading it never stalls the upload
+	void Upload(const uint8_t* visible = nullptr)
+	{
+		const InstanceData* data = Instances.data();
+		size_t count = Instances.size();
+		if (visible != nullptr) {
+			packed.clear();
+			for (size_t i = 0; i < Instances.size(); ++i)
+				if (visible[i])
+					packed.push_back(Instances[i]);
+			data = packed.data();
+			count = packed.size();
+		}
+
+		const GLsizeiptr bytes = static_cast<GLsizeiptr>(count * sizeof(InstanceData));
+		glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+		glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		uploaded = static_cast<GLsizei>(count);
+	}
+
+	// instances in the GPU buffer, which is what a draw covers
+	GLsizei Count() const { return uploaded; }
+
+	void Destroy()
+	{
+		glDeleteVertexArrays(1, &Vao);
+		glDeleteBuffers(1, &Buffer);
+		Vao = 0;
+		Buffer = 0;
+		Instances.clear();
+		packed.clear();
+		uploaded = 0;
+	}
+
+private:
+	std::vector<InstanceData> packed;	// the visible instances of the last upload
+	GLsizei uploaded = 0;
+};
+#endif
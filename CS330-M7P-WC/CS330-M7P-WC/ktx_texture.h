@@ -0,0 +1,256 @@
+#ifndef KTX_TEXTURE_H
+#define KTX_TEXTURE_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "block_compressor.h"
+
+// KTX2 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) for single 2D block-compressed
+// textures with a full mip chain. Rows are stored bottom row first (KTXorientation "ru"), the order OpenGL uploads.
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KTX2_MAX_LEVELS = 16;
+
+// Vulkan formats (the vkFormat field of KTX2) written and read here
+const uint32_t KTX2_FORMAT_BC1_RGB_UNORM = 131;
+const uint32_t KTX2_FORMAT_BC3_UNORM = 137;
+
+struct Ktx2Header
+{
+	unsigned char Identifier[12];
+	uint32_t VkFormat;
+	uint32_t TypeSize;
+	uint32_t PixelWidth;
+	uint32_t PixelHeight;
+	uint32_t PixelDepth;
+	uint32_t LayerCount;
+	uint32_t FaceCount;
+	uint32_t LevelCount;
+	uint32_t SupercompressionScheme;
+	uint32_t DfdByteOffset;
+	uint32_t DfdByteLength;
+	uint32_t KvdByteOffset;
+	uint32_t KvdByteLength;
+	uint64_t SgdByteOffset;
+	uint64_t SgdByteLength;
+};
+
+struct Ktx2LevelIndex
+{
+	uint64_t ByteOffset;
+	uint64_t ByteLength;
+	uint64_t UncompressedByteLength;
+};
+
+// A validated, memory-mapped .ktx2 file
+class Ktx2Texture
+{
+public:
+	bool Open(const std::string& path)
+	{
+		error.clear();
+		if (!file.Open(path.c_str()))
+			return fail("cannot open " + path);
+		if (file.Size() < sizeof(Ktx2Header))
+			return fail(path + " is too small");
+		std::memcpy(&header, file.Data(), sizeof(header));
+
+		if (std::memcmp(header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+			return fail(path + " is not a KTX2 file");
+		if (BlockBytes(header.VkFormat) == 0 || header.TypeSize != 1)
+			return fail(path + " uses unsupported format " + std::to_string(header.VkFormat));
+		if (header.PixelWidth == 0 || header.PixelHeight == 0 || header.PixelDepth != 0 || header.LayerCount != 0 || header.FaceCount != 1)
+			return fail(path + " is not a single 2D texture");
+		if (header.LevelCount == 0 || header.LevelCount > KTX2_MAX_LEVELS || header.SupercompressionScheme != 0)
+			return fail(path + " has no stored mip levels or is supercompressed");
+		if (sizeof(Ktx2Header) + header.LevelCount * sizeof(Ktx2LevelIndex) > file.Size())
+			return fail(path + " is truncated");
+		if (!bottomUp(path))
+			return false;
+
+		levels.resize(header.LevelCount);
+		std::memcpy(levels.data(), file.Data() + sizeof(Ktx2Header), header.LevelCount * sizeof(Ktx2LevelIndex));
+		for (uint32_t level = 0; level < header.LevelCount; ++level) {
+			const Ktx2LevelIndex& index = levels[level];
+			if (index.ByteLength != LevelBytes(header.VkFormat, LevelWidth(level), LevelHeight(level))
+				|| index.ByteOffset + index.ByteLength > file.Size())
+				return fail(path + " has a damaged level " + std::to_string(level));
+		}
+		return true;
+	}
+
+	uint32_t Format() const { return header.VkFormat; }
+	uint32_t Width() const { return header.PixelWidth; }
+	uint32_t Height() const { return header.PixelHeight; }
+	uint32_t LevelCount() const { return header.LevelCount; }
+	uint32_t LevelWidth(uint32_t level) const { return std::max(1u, header.PixelWidth >> level); }
+	uint32_t LevelHeight(uint32_t level) const { return std::max(1u, header.PixelHeight >> level); }
+	const unsigned char* LevelData(uint32_t level) const { return reinterpret_cast<const unsigned char*>(file.Data()) + levels[level].ByteOffset; }
+	size_t LevelSize(uint32_t level) const { return static_cast<size_t>(levels[level].ByteLength); }
+	const std::string& Error() const { return error; }
+
+	// bytes per 4x4 block, 0 for formats this loader does not handle
+	static uint32_t BlockBytes(uint32_t format)
+	{
+		if (format == KTX2_FORMAT_BC1_RGB_UNORM)
+			return BlockCompressor::BC1_BLOCK_BYTES;
+		if (format == KTX2_FORMAT_BC3_UNORM)
+			return BlockCompressor::BC3_BLOCK_BYTES;
+		return 0;
+	}
+
+	static uint64_t LevelBytes(uint32_t format, uint32_t width, uint32_t height)
+	{
+		return static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+	}
+
+	// writes levels[0] (full size) .. levels[n - 1]; the data of the smallest level comes first in the file,
+	// as the format requires. Written to a temporary file first so a crash never leaves a torn texture
+	static bool Write(const std::string& path, uint32_t format, uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char>>& levelData)
+	{
+		const uint32_t levelCount = static_cast<uint32_t>(levelData.size());
+		const uint32_t blockBytes = BlockBytes(format);
+		if (blockBytes == 0 || levelCount == 0 || levelCount > KTX2_MAX_LEVELS)
+			return false;
+
+		std::vector<unsigned char> dfd = dataFormatDescriptor(format);
+		std::vector<unsigned char> kvd;
+		appendKeyValue(kvd, "KTXorientation", "ru");
+		appendKeyValue(kvd, "KTXwriter", "CS330 texture encoder");
+
+		Ktx2Header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+		header.VkFormat = format;
+		header.TypeSize = 1;
+		header.PixelWidth = width;
+		header.PixelHeight = height;
+		header.FaceCount = 1;
+		header.LevelCount = levelCount;
+		header.DfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+		header.DfdByteLength = static_cast<uint32_t>(dfd.size());
+		header.KvdByteOffset = header.DfdByteOffset + header.DfdByteLength;
+		header.KvdByteLength = static_cast<uint32_t>(kvd.size());
+
+		// level data, smallest level first, each aligned to the block size
+		std::vector<Ktx2LevelIndex> index(levelCount);
+		uint64_t offset = header.KvdByteOffset + header.KvdByteLength;
+		for (uint32_t level = levelCount; level-- > 0;) {
+			offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+			index[level].ByteOffset = offset;
+			index[level].ByteLength = levelData[level].size();
+			index[level].UncompressedByteLength = levelData[level].size();
+			offset += levelData[level].size();
+		}
+
+		return WriteFileAtomically(path, [&](std::ofstream& out) {
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Ktx2LevelIndex));
+			out.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+			out.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+			uint64_t written = header.KvdByteOffset + header.KvdByteLength;
+			for (uint32_t level = levelCount; level-- > 0;) {
+				static const char zeros[BlockCompressor::BC3_BLOCK_BYTES] = {};
+				out.write(zeros, index[level].ByteOffset - written);
+				out.write(reinterpret_cast<const char*>(levelData[level].data()), levelData[level].size());
+				written = index[level].ByteOffset + index[level].ByteLength;
+			}
+		});
+	}
+
+private:
+	MappedFile file;
+	Ktx2Header header;
+	std::vector<Ktx2LevelIndex> levels;
+	std::string error;
+
+	bool fail(const std::string& message)
+	{
+		error = message;
+		return false;
+	}
+
+	// KTXorientation must say the rows go up; files without it default to "rd" (top row first)
+	bool bottomUp(const std::string& path)
+	{
+		uint64_t end = static_cast<uint64_t>(header.KvdByteOffset) + header.KvdByteLength;
+		if (end > file.Size())
+			return fail(path + " is truncated");
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(file.Data());
+		for (uint64_t offset = header.KvdByteOffset; offset + 4 <= end;) {
+			uint32_t length;
+			std::memcpy(&length, data + offset, sizeof(length));
+			if (offset + 4 + length > end)
+				break;
+			const char* entry = reinterpret_cast<const char*>(data + offset + 4);
+			const char key[] = "KTXorientation";
+			if (length > sizeof(key) + 1 && std::memcmp(entry, key, sizeof(key)) == 0) {
+				if (entry[sizeof(key) + 1] == 'u')
+					return true;
+				break;
+			}
+			offset += (4 + length + 3) / 4 * 4;
+		}
+		return fail(path + " is not stored bottom row first (KTXorientation \"ru\")");
+	}
+
+	static void appendKeyValue(std::vector<unsigned char>& kvd, const char* key, const char* value)
+	{
+		uint32_t length = static_cast<uint32_t>(std::strlen(key) + 1 + std::strlen(value) + 1);
+		appendWord(kvd, length);
+		kvd.insert(kvd.end(), key, key + std::strlen(key) + 1);
+		kvd.insert(kvd.end(), value, value + std::strlen(value) + 1);
+		while (kvd.size() % 4 != 0)
+			kvd.push_back(0);
+	}
+
+	static void appendWord(std::vector<unsigned char>& bytes, uint32_t word)
+	{
+		for (int b = 0; b < 4; ++b)
+			bytes.push_back(static_cast<unsigned char>(word >> (b * 8)));
+	}
+
+	// Khronos basic data format descriptor of a BC1 or BC3 block (linear transfer, BT.709 primaries)
+	static std::vector<unsigned char> dataFormatDescriptor(uint32_t format)
+	{
+		const bool bc3 = format == KTX2_FORMAT_BC3_UNORM;
+		const uint32_t sampleCount = bc3 ? 2 : 1;
+		const uint32_t blockSize = 24 + 16 * sampleCount;
+		const uint32_t colorModel = bc3 ? 130 : 128;	// KHR_DF_MODEL_BC3 / KHR_DF_MODEL_BC1A
+
+		std::vector<unsigned char> dfd;
+		appendWord(dfd, 4 + blockSize);						// dfdTotalSize
+		appendWord(dfd, 0);									// vendorId KHRONOS, descriptorType BASICFORMAT
+		appendWord(dfd, 2 | (blockSize << 16));				// versionNumber 1.3, descriptorBlockSize
+		appendWord(dfd, colorModel | (1 << 8) | (1 << 16));	// colorPrimaries BT709, transferFunction LINEAR, flags 0
+		appendWord(dfd, 3 | (3 << 8));						// 4x4x1x1 texel block
+		appendWord(dfd, BlockBytes(format));				// bytesPlane0
+		appendWord(dfd, 0);
+		// samples: BC3 alpha block (channel 15) in the first 64 bits, then the color block (channel 0)
+		if (bc3) {
+			appendWord(dfd, 0 | (63 << 16) | (15u << 24));
+			appendWord(dfd, 0);
+			appendWord(dfd, 0);
+			appendWord(dfd, 0xFFFFFFFFu);
+		}
+		appendWord(dfd, (bc3 ? 64 : 0) | (63 << 16));
+		appendWord(dfd, 0);
+		appendWord(dfd, 0);
+		appendWord(dfd, 0xFFFFFFFFu);
+		return dfd;
+	}
+};
+
+// The .ktx2 file the encoder writes for an image: the same path with the extension replaced
+inline std::string Ktx2PathFor(const std::string& imagePath)
+{
+	size_t dot = imagePath.find_last_of('.');
+	size_t slash = imagePath.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return imagePath + ".ktx2";
+	return imagePath.substr(0, dot) + ".ktx2";
+}
+#endif
@@ -0,0 +1,158 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#include <windows.h>
+	// windows.h defines these as empty macros, which breaks ordinary variable names (see Camera::GetViewMatrix)
+	#undef near
+	#undef far
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// maps the file; an empty file opens successfully with Size() == 0
+	bool Open(const char* filename)
+	{
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize)) {
+			Close();
+			return false;
+		}
+		size = static_cast<size_t>(fileSize.QuadPart);
+		if (size == 0)
+			return true;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			Close();
+			return false;
+		}
+		data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		descriptor = open(filename, O_RDONLY);
+		if (descriptor < 0)
+			return false;
+		struct stat info;
+		if (fstat(descriptor, &info) != 0) {
+			Close();
+			return false;
+		}
+		size = static_cast<size_t>(info.st_size);
+		if (size == 0)
+			return true;
+		void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view == MAP_FAILED) {
+			Close();
+			return false;
+		}
+		// the whole file is read front to back: read ahead aggressively, and start reading it in now
+		madvise(view, size, MADV_SEQUENTIAL);
+		madvise(view, size, MADV_WILLNEED);
+		data = static_cast<const char*>(view);
+#endif
+		if (data == nullptr) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != nullptr)
+			munmap(const_cast<char*>(data), size);
+		if (descriptor >= 0)
+			close(descriptor);
+		descriptor = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int descriptor = -1;
+#endif
+};
+
+// A name next to path that no other process, or thread of this one, writing path at the same time uses
+inline std::string TemporaryPathFor(const std::string& path)
+{
+	static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+	const unsigned long process = GetCurrentProcessId();
+#else
+	const unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+	return path + "." + std::to_string(process) + "." + std::to_string(counter++) + ".tmp";
+}
+
+// Writes a file so readers only ever see its old or its complete new contents: write(out) fills a temporary
+// next to path, which then replaces path in one step. False when anything failed; the temporary is removed.
+template <typename Write>
+bool WriteFileAtomically(const std::string& path, Write write)
+{
+	const std::string temporary = TemporaryPathFor(path);
+	std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+	write(out);
+	out.close();
+#ifdef _WIN32
+	// rename refuses to replace an existing file here
+	if (out && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0)
+		return true;
+#else
+	if (out && std::rename(temporary.c_str(), path.c_str()) == 0)
+		return true;
+#endif
+	std::remove(temporary.c_str());
+	return false;
+}
+#endif
@@ -0,0 +1,277 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Default size of the simulated post-transform vertex cache
+const unsigned int VERTEX_CACHE_SIZE = 32;
+
+// Builds an indexed triangle list from unindexed vertices.
+// Vertices are flat runs of floats (e.g. position + texture coordinate); identical runs are welded into one vertex.
+class MeshBuilder
+{
+public:
+	explicit MeshBuilder(unsigned int floatsPerVertex) : stride(floatsPerVertex), table(64, EMPTY) {}
+
+	// appends one triangle-list corner, reusing an existing vertex when all of its floats match
+	void AddVertex(const float* vertex)
+	{
+		if ((vertexCount() + 1) * 2 > table.size())
+			rehash(table.size() * 2);
+
+		size_t mask = table.size() - 1;
+		size_t slot = hash(vertex) & mask;
+		while (table[slot] != EMPTY) {
+			if (same(&vertices[table[slot] * stride], vertex)) {
+				indices.push_back(table[slot]);
+				return;
+			}
+			slot = (slot + 1) & mask;
+		}
+
+		uint32_t index = static_cast<uint32_t>(vertexCount());
+		vertices.insert(vertices.end(), vertex, vertex + stride);
+		table[slot] = index;
+		indices.push_back(index);
+	}
+
+	// appends a whole unindexed triangle list
+	void AddVertices(const float* data, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			AddVertex(data + i * stride);
+	}
+
+	// appends a mesh that is indexed already, as it is (its vertices are not welded with each other); later
+	// AddVertex calls still weld against them
+	void AddIndexed(const float* data, size_t count, const uint32_t* meshIndices, size_t indexCount)
+	{
+		const uint32_t base = static_cast<uint32_t>(vertexCount());
+		vertices.insert(vertices.end(), data, data + count * stride);
+		for (size_t i = 0; i < indexCount; ++i)
+			indices.push_back(base + meshIndices[i]);
+		size_t size = table.size();
+		while (vertexCount() * 2 > size)
+			size *= 2;
+		rehash(size);
+	}
+
+	size_t VertexCount() const { return vertexCount(); }
+	size_t IndexCount() const { return indices.size(); }
+	unsigned int FloatsPerVertex() const { return stride; }
+	const std::vector<float>& Vertices() const { return vertices; }
+	const std::vector<uint32_t>& Indices() const { return indices; }
+
+	// 16-bit indices are enough (and half the size) while every vertex index fits in them
+	bool UsesShortIndices() const { return vertexCount() <= 0xFFFF; }
+
+	std::vector<uint16_t> ShortIndices() const
+	{
+		return std::vector<uint16_t>(indices.begin(), indices.end());
+	}
+
+	// average cache miss ratio: vertex shader invocations per triangle with a FIFO post-transform cache
+	float ComputeAcmr(unsigned int cacheSize = VERTEX_CACHE_SIZE) const
+	{
+		if (indices.empty())
+			return 0.0f;
+
+		std::vector<size_t> insertedAt(vertexCount(), 0); // 0 = never cached, otherwise miss counter + 1
+		size_t misses = 0;
+		for (uint32_t index : indices) {
+			if (insertedAt[index] == 0 || misses - (insertedAt[index] - 1) >= cacheSize) {
+				insertedAt[index] = misses + 1;
+				++misses;
+			}
+		}
+		return static_cast<float>(misses) / (indices.size() / 3);
+	}
+
+	// reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+	void OptimizeVertexCache(unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		const size_t count = vertexCount();
+		if (triangleCount == 0)
+			return;
+
+		// vertex -> triangle adjacency, the first activeCount entries of each list are the unemitted triangles
+		std::vector<uint32_t> activeCount(count, 0);
+		for (uint32_t index : indices)
+			++activeCount[index];
+		std::vector<size_t> offsets(count + 1, 0);
+		for (size_t v = 0; v < count; ++v)
+			offsets[v + 1] = offsets[v] + activeCount[v];
+		std::vector<uint32_t> adjacency(indices.size());
+		std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+
+		std::vector<int> cachePosition(count, -1);
+		std::vector<float> vertexScores(count);
+		for (size_t v = 0; v < count; ++v)
+			vertexScores[v] = vertexScore(-1, activeCount[v], cacheSize);
+
+		std::vector<float> triangleScores(triangleCount);
+		for (size_t t = 0; t < triangleCount; ++t)
+			triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+		std::vector<uint32_t> cache;
+		std::vector<uint32_t> nextCache;
+		size_t scanCursor = 0;	// no triangle before it is still to be emitted
+
+		long best = bestTriangle(triangleScores);
+		while (best >= 0) {
+			const uint32_t* triangle = &indices[best * 3];
+			emitted[best] = true;
+			output.insert(output.end(), triangle, triangle + 3);
+
+			// remove the triangle from its vertices' active lists
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = triangle[k];
+				uint32_t* list = &adjacency[offsets[v]];
+				for (uint32_t i = 0; i < activeCount[v]; ++i) {
+					if (list[i] == static_cast<uint32_t>(best)) {
+						list[i] = list[activeCount[v] - 1];
+						--activeCount[v];
+						break;
+					}
+				}
+			}
+
+			// LRU cache update: this triangle's vertices move to the front
+			nextCache.assign(triangle, triangle + 3);
+			for (uint32_t v : cache)
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			cache.swap(nextCache);
+
+			for (size_t i = 0; i < cache.size(); ++i) {
+				uint32_t v = cache[i];
+				cachePosition[v] = i < cacheSize ? static_cast<int>(i) : -1;
+				vertexScores[v] = vertexScore(cachePosition[v], activeCount[v], cacheSize);
+			}
+
+			// rescore the triangles touching cached vertices and pick the best of them
+			best = -1;
+			float bestScore = -1.0f;
+			for (uint32_t v : cache) {
+				for (uint32_t i = 0; i < activeCount[v]; ++i) {
+					uint32_t t = adjacency[offsets[v] + i];
+					float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+					triangleScores[t] = score;
+					if (score > bestScore) {
+						bestScore = score;
+						best = t;
+					}
+				}
+			}
+
+			if (cache.size() > cacheSize)
+				cache.resize(cacheSize);
+
+			// nothing adjacent to the cache is left: restart from the next triangle not yet emitted
+			if (best < 0)
+				best = nextTriangle(emitted, scanCursor);
+		}
+
+		indices.swap(output);
+	}
+
+private:
+	static constexpr uint32_t EMPTY = 0xFFFFFFFFu;
+
+	unsigned int stride;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> table; // open-addressing hash table of vertex indices
+
+	size_t vertexCount() const { return vertices.size() / stride; }
+
+	// FNV-1a over the vertex floats, with -0.0f treated as 0.0f so both weld together
+	size_t hash(const float* vertex) const
+	{
+		uint64_t h = 14695981039346656037ull;
+		for (unsigned int i = 0; i < stride; ++i) {
+			float value = vertex[i] == 0.0f ? 0.0f : vertex[i];
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			h = (h ^ bits) * 1099511628211ull;
+		}
+		return static_cast<size_t>(h ^ (h >> 32));
+	}
+
+	// float by float, so -0.0f matches 0.0f the same way hash() treats them
+	bool same(const float* a, const float* b) const
+	{
+		for (unsigned int i = 0; i < stride; ++i)
+			if (a[i] != b[i])
+				return false;
+		return true;
+	}
+
+	void rehash(size_t size)
+	{
+		table.assign(size, EMPTY);
+		size_t mask = size - 1;
+		for (size_t v = 0; v < vertexCount(); ++v) {
+			size_t slot = hash(&vertices[v * stride]) & mask;
+			while (table[slot] != EMPTY)
+				slot = (slot + 1) & mask;
+			table[slot] = static_cast<uint32_t>(v);
+		}
+	}
+
+	static float vertexScore(int position, uint32_t remainingTriangles, unsigned int cacheSize)
+	{
+		const float cacheDecayPower = 1.5f;
+		const float lastTriangleScore = 0.75f;
+		const float valenceBoostScale = 2.0f;
+		const float valenceBoostPower = 0.5f;
+
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (position >= 0) {
+			if (position < 3)
+				score = lastTriangleScore; // vertices of the last triangle get a fixed score so it is not simply repeated
+			else
+				score = std::pow(1.0f - (position - 3) / static_cast<float>(cacheSize - 3), cacheDecayPower);
+		}
+
+		// vertices with few triangles left are boosted so they get finished off and leave the cache
+		score += valenceBoostScale * std::pow(static_cast<float>(remainingTriangles), -valenceBoostPower);
+		return score;
+	}
+
+	// highest-scoring triangle, to start from
+	static long bestTriangle(const std::vector<float>& scores)
+	{
+		long best = -1;
+		float bestScore = -1.0f;
+		for (size_t t = 0; t < scores.size(); ++t) {
+			if (scores[t] > bestScore) {
+				bestScore = scores[t];
+				best = static_cast<long>(t);
+			}
+		}
+		return best;
+	}
+
+	// first triangle at or after the cursor not yet emitted, or -1; the cursor only moves forward, so all
+	// the restarts together walk the triangles once instead of rescanning them every time the cache runs dry
+	static long nextTriangle(const std::vector<bool>& emitted, size_t& cursor)
+	{
+		while (cursor < emitted.size() && emitted[cursor])
+			++cursor;
+		return cursor < emitted.size() ? static_cast<long>(cursor) : -1;
+	}
+};
+#endif
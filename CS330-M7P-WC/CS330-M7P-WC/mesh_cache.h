@@ -0,0 +1,156 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "mesh_builder.h"
+
+// Precooked mesh file (.mesh): a fixed header followed by aligned vertex and index blobs that
+// are uploaded to GL as they are, without any parsing
+const uint32_t MESH_CACHE_MAGIC = 0x4853454D; // "MESH"
+const uint32_t MESH_CACHE_VERSION = 1;
+const uint64_t MESH_CACHE_ALIGNMENT = 64;
+const unsigned int MESH_CACHE_MAX_ATTRIBUTES = 4;
+
+// Vertex attributes in buffer order: shader location and float component count of each
+struct MeshCacheLayout
+{
+	uint32_t AttributeCount;
+	uint32_t Locations[MESH_CACHE_MAX_ATTRIBUTES];
+	uint32_t Components[MESH_CACHE_MAX_ATTRIBUTES];
+
+	uint32_t FloatsPerVertex() const
+	{
+		uint32_t floats = 0;
+		for (uint32_t i = 0; i < AttributeCount; ++i)
+			floats += Components[i];
+		return floats;
+	}
+
+	bool operator==(const MeshCacheLayout& other) const
+	{
+		if (AttributeCount != other.AttributeCount)
+			return false;
+		for (uint32_t i = 0; i < AttributeCount; ++i)
+			if (Locations[i] != other.Locations[i] || Components[i] != other.Components[i])
+				return false;
+		return true;
+	}
+};
+
+struct MeshCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t SourceHash;	// HashBytes of the model file the cache was cooked from
+	MeshCacheLayout Layout;
+	uint32_t IndexSize;		// 2 (GL_UNSIGNED_SHORT) or 4 (GL_UNSIGNED_INT)
+	uint32_t Reserved;
+	uint64_t VertexCount;
+	uint64_t IndexCount;
+	float BoundsMin[3];
+	float BoundsMax[3];
+	uint64_t VertexOffset;
+	uint64_t VertexBytes;
+	uint64_t IndexOffset;
+	uint64_t IndexBytes;
+};
+
+// A validated, memory-mapped .mesh file
+class MeshCache
+{
+public:
+	// maps the cache and checks it against the current source hash and vertex layout; false means "rebuild it"
+	bool Open(const std::string& path, uint64_t sourceHash, const MeshCacheLayout& layout)
+	{
+		if (!file.Open(path.c_str()) || file.Size() < sizeof(MeshCacheHeader))
+			return false;
+		std::memcpy(&header, file.Data(), sizeof(header));
+
+		if (header.Magic != MESH_CACHE_MAGIC || header.Version != MESH_CACHE_VERSION)
+			return false;
+		if (header.SourceHash != sourceHash || !(header.Layout == layout))
+			return false;
+		if (header.IndexSize != 2 && header.IndexSize != 4)
+			return false;
+		if (header.VertexBytes != header.VertexCount * layout.FloatsPerVertex() * sizeof(float)
+			|| header.IndexBytes != header.IndexCount * header.IndexSize)
+			return false;
+		if (header.VertexOffset % MESH_CACHE_ALIGNMENT != 0 || header.IndexOffset % MESH_CACHE_ALIGNMENT != 0
+			|| header.VertexOffset + header.VertexBytes > file.Size() || header.IndexOffset + header.IndexBytes > file.Size())
+			return false;
+		return true;
+	}
+
+	const MeshCacheHeader& Header() const { return header; }
+	const void* VertexData() const { return file.Data() + header.VertexOffset; }
+	const void* IndexData() const { return file.Data() + header.IndexOffset; }
+	void Close() { file.Close(); }
+
+	// cooks a welded, cache-optimized mesh into a .mesh file; written to a temporary file first so a crash never leaves a torn cache
+	static bool Write(const std::string& path, uint64_t sourceHash, const MeshCacheLayout& layout, const MeshBuilder& builder)
+	{
+		MeshCacheHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.Magic = MESH_CACHE_MAGIC;
+		header.Version = MESH_CACHE_VERSION;
+		header.SourceHash = sourceHash;
+		header.Layout = layout;
+		header.IndexSize = builder.UsesShortIndices() ? 2 : 4;
+		header.VertexCount = builder.VertexCount();
+		header.IndexCount = builder.IndexCount();
+
+		// bounds of the position attribute (the first three floats of every vertex)
+		const std::vector<float>& vertices = builder.Vertices();
+		const uint32_t stride = layout.FloatsPerVertex();
+		for (int k = 0; k < 3; ++k) {
+			header.BoundsMin[k] = vertices.empty() ? 0.0f : vertices[k];
+			header.BoundsMax[k] = header.BoundsMin[k];
+		}
+		for (size_t v = 0; v < vertices.size(); v += stride) {
+			for (int k = 0; k < 3; ++k) {
+				header.BoundsMin[k] = std::min(header.BoundsMin[k], vertices[v + k]);
+				header.BoundsMax[k] = std::max(header.BoundsMax[k], vertices[v + k]);
+			}
+		}
+
+		header.VertexBytes = vertices.size() * sizeof(float);
+		header.IndexBytes = header.IndexCount * header.IndexSize;
+		header.VertexOffset = align(sizeof(MeshCacheHeader));
+		header.IndexOffset = align(header.VertexOffset + header.VertexBytes);
+
+		return WriteFileAtomically(path, [&](std::ofstream& out) {
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			pad(out, header.VertexOffset - sizeof(header));
+			out.write(reinterpret_cast<const char*>(vertices.data()), header.VertexBytes);
+			pad(out, header.IndexOffset - header.VertexOffset - header.VertexBytes);
+			if (header.IndexSize == 2) {
+				std::vector<uint16_t> indices = builder.ShortIndices();
+				out.write(reinterpret_cast<const char*>(indices.data()), header.IndexBytes);
+			}
+			else
+				out.write(reinterpret_cast<const char*>(builder.Indices().data()), header.IndexBytes);
+		});
+	}
+
+private:
+	MappedFile file;
+	MeshCacheHeader header;
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+	}
+
+	static void pad(std::ofstream& out, uint64_t bytes)
+	{
+		static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+		out.write(zeros, bytes);
+	}
+};
+#endif
@@ -0,0 +1,63 @@
+#ifndef MESH_POOL_H
+#define MESH_POOL_H
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "mesh_builder.h"
+
+// Where one mesh lives inside a MeshPool, in the terms of a DrawElementsIndirectCommand
+struct PoolMesh
+{
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	int32_t BaseVertex;
+	glm::vec3 Center;	// bounding sphere in model space
+	float Radius;
+	glm::vec3 Extents;	// half size of the axis-aligned bounding box around Center
+};
+
+// Packs several welded meshes of the same vertex layout into one vertex array and one 32-bit index array,
+// so they can share a vertex array object and be drawn by a single multi-draw call
+class MeshPool
+{
+public:
+	explicit MeshPool(unsigned int floatsPerVertex) : stride(floatsPerVertex) {}
+
+	// appends the mesh; its indices stay relative to its own first vertex (BaseVertex)
+	PoolMesh Add(const MeshBuilder& builder)
+	{
+		PoolMesh mesh;
+		mesh.FirstIndex = static_cast<uint32_t>(indices.size());
+		mesh.IndexCount = static_cast<uint32_t>(builder.IndexCount());
+		mesh.BaseVertex = static_cast<int32_t>(vertices.size() / stride);
+
+		const std::vector<float>& source = builder.Vertices();
+		glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+		for (size_t v = 0; v < source.size(); v += stride) {
+			glm::vec3 position(source[v], source[v + 1], source[v + 2]);
+			boundsMin = v == 0 ? position : glm::min(boundsMin, position);
+			boundsMax = v == 0 ? position : glm::max(boundsMax, position);
+		}
+		mesh.Center = (boundsMin + boundsMax) * 0.5f;
+		mesh.Radius = glm::length(boundsMax - boundsMin) * 0.5f;
+		mesh.Extents = (boundsMax - boundsMin) * 0.5f;
+
+		vertices.insert(vertices.end(), source.begin(), source.end());
+		indices.insert(indices.end(), builder.Indices().begin(), builder.Indices().end());
+		meshes.push_back(mesh);
+		return mesh;
+	}
+
+	unsigned int FloatsPerVertex() const { return stride; }
+	size_t VertexCount() const { return vertices.size() / stride; }
+	const std::vector<float>& Vertices() const { return vertices; }
+	const std::vector<uint32_t>& Indices() const { return indices; }
+	const std::vector<PoolMesh>& Meshes() const { return meshes; }
+
+private:
+	unsigned int stride;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<PoolMesh> meshes;
+};
+#endif
@@ -0,0 +1,116 @@
+#ifndef MIP_CACHE_H
+#define MIP_CACHE_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "content_hash.h"
+#include "image_kernels.h"
+#include "mapped_file.h"
+
+// Precomputed mip chain file (.mips): a fixed header followed by every RGBA8 level of one image,
+// level 0 first and bottom row first, exactly the bytes glTexSubImage uploads
+const uint32_t MIP_CACHE_MAGIC = 0x5350494D; // "MIPS"
+const uint32_t MIP_CACHE_VERSION = 1;
+const uint64_t MIP_CACHE_ALIGNMENT = 64;
+
+struct MipCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t SourceHash;	// HashBytes of the image file the chain was built from
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t LevelCount;
+	uint32_t Reserved;
+	uint64_t DataOffset;
+	uint64_t DataBytes;
+};
+
+// Mip chain geometry: levels halve (rounding down, never below 1) until 1x1
+inline uint32_t MipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while (width > 1 || height > 1) {
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		++levels;
+	}
+	return levels;
+}
+
+inline uint32_t MipLevelWidth(uint32_t width, uint32_t level) { return std::max(1u, width >> level); }
+inline uint32_t MipLevelHeight(uint32_t height, uint32_t level) { return std::max(1u, height >> level); }
+
+// byte offset of a level inside a contiguous RGBA8 chain; MipChainOffset(w, h, MipLevelCount(w, h)) is the chain size
+inline size_t MipChainOffset(uint32_t width, uint32_t height, uint32_t level)
+{
+	size_t offset = 0;
+	for (uint32_t i = 0; i < level; ++i)
+		offset += static_cast<size_t>(MipLevelWidth(width, i)) * MipLevelHeight(height, i) * 4;
+	return offset;
+}
+
+// fills levels 1.. of a contiguous chain from its level 0 with the linear-light box filter
+inline void BuildMipChain(unsigned char* chain, uint32_t width, uint32_t height)
+{
+	const ImageKernels& kernels = GetImageKernels();
+	const uint32_t levels = MipLevelCount(width, height);
+	for (uint32_t level = 1; level < levels; ++level)
+		kernels.DownsampleSrgbRgba(chain + MipChainOffset(width, height, level - 1), MipLevelWidth(width, level - 1), MipLevelHeight(height, level - 1),
+			chain + MipChainOffset(width, height, level));
+}
+
+// A validated, memory-mapped .mips file
+class MipCache
+{
+public:
+	// maps the cache and checks it against the current source hash and size; false means "rebuild it"
+	bool Open(const std::string& path, uint64_t sourceHash, uint32_t width, uint32_t height)
+	{
+		if (!file.Open(path.c_str()) || file.Size() < sizeof(MipCacheHeader))
+			return false;
+		std::memcpy(&header, file.Data(), sizeof(header));
+
+		if (header.Magic != MIP_CACHE_MAGIC || header.Version != MIP_CACHE_VERSION)
+			return false;
+		if (header.SourceHash != sourceHash || header.Width != width || header.Height != height)
+			return false;
+		if (header.LevelCount != MipLevelCount(width, height) || header.DataBytes != MipChainOffset(width, height, header.LevelCount))
+			return false;
+		if (header.DataOffset % MIP_CACHE_ALIGNMENT != 0 || header.DataOffset + header.DataBytes > file.Size())
+			return false;
+		return true;
+	}
+
+	const MipCacheHeader& Header() const { return header; }
+	const unsigned char* Data() const { return reinterpret_cast<const unsigned char*>(file.Data()) + header.DataOffset; }
+
+	// writes a full chain; written to a temporary file first so a crash never leaves a torn cache
+	static bool Write(const std::string& path, uint64_t sourceHash, uint32_t width, uint32_t height, const unsigned char* chain)
+	{
+		MipCacheHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.Magic = MIP_CACHE_MAGIC;
+		header.Version = MIP_CACHE_VERSION;
+		header.SourceHash = sourceHash;
+		header.Width = width;
+		header.Height = height;
+		header.LevelCount = MipLevelCount(width, height);
+		header.DataOffset = (sizeof(MipCacheHeader) + MIP_CACHE_ALIGNMENT - 1) / MIP_CACHE_ALIGNMENT * MIP_CACHE_ALIGNMENT;
+		header.DataBytes = MipChainOffset(width, height, header.LevelCount);
+
+		return WriteFileAtomically(path, [&](std::ofstream& out) {
+			static const char zeros[MIP_CACHE_ALIGNMENT] = {};
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(zeros, header.DataOffset - sizeof(header));
+			out.write(reinterpret_cast<const char*>(chain), header.DataBytes);
+		});
+	}
+
+private:
+	MappedFile file;
+	MipCacheHeader header;
+};
+#endif
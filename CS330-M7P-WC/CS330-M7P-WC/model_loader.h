@@ -0,0 +1,956 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mapped_file.h"
+#include "worker_pool.h"
+
+// Interleaved layout written by ModelLoader: position (3 floats), texture coordinate (2 floats) and
+// texture array layer (1 float, always layer 0 for loaded models), the same as UCreateMesh
+const unsigned int MODEL_FLOATS_PER_VERTEX = 6;
+
+// Minimal JSON document, enough to read glTF headers
+struct JsonValue
+{
+	enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+	Type Kind = NUL;
+	bool Boolean = false;
+	double Number = 0.0;
+	std::string String;
+	std::vector<JsonValue> Items;		// array elements, or object member values
+	std::vector<std::string> Keys;		// object member names, parallel to Items
+
+	// returns the member with this name, or nullptr
+	const JsonValue* Get(const char* key) const
+	{
+		if (Kind != OBJECT)
+			return nullptr;
+		for (size_t i = 0; i < Keys.size(); ++i)
+			if (Keys[i] == key)
+				return &Items[i];
+		return nullptr;
+	}
+
+	// returns the array element at this index, or nullptr (also for NaN and fractional indices)
+	const JsonValue* At(double index) const
+	{
+		if (Kind != ARRAY || !(index >= 0 && index < Items.size()) || index != std::floor(index))
+			return nullptr;
+		return &Items[static_cast<size_t>(index)];
+	}
+
+	double NumberOr(const char* key, double fallback) const
+	{
+		const JsonValue* value = Get(key);
+		return value != nullptr && value->Kind == NUMBER ? value->Number : fallback;
+	}
+
+	// reads the member as a size, fallback when it is absent; false when it is not a non-negative integer that fits
+	bool SizeOr(const char* key, size_t fallback, size_t& size) const
+	{
+		const JsonValue* value = Get(key);
+		if (value == nullptr) {
+			size = fallback;
+			return true;
+		}
+		if (value->Kind != NUMBER || !(value->Number >= 0 && value->Number < static_cast<double>(std::numeric_limits<size_t>::max()))
+			|| value->Number != std::floor(value->Number))
+			return false;
+		size = static_cast<size_t>(value->Number);
+		return true;
+	}
+
+	static bool Parse(const char* begin, const char* end, JsonValue& out)
+	{
+		const char* p = begin;
+		if (!parseValue(p, end, out, 0))
+			return false;
+		skipWhitespace(p, end);
+		return p == end;
+	}
+
+private:
+	static void skipWhitespace(const char*& p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+			++p;
+	}
+
+	static bool parseLiteral(const char*& p, const char* end, const char* literal)
+	{
+		size_t length = std::strlen(literal);
+		if (static_cast<size_t>(end - p) < length || std::memcmp(p, literal, length) != 0)
+			return false;
+		p += length;
+		return true;
+	}
+
+	static bool parseString(const char*& p, const char* end, std::string& out)
+	{
+		if (p >= end || *p != '"')
+			return false;
+		++p;
+		out.clear();
+		while (p < end && *p != '"') {
+			if (*p != '\\') {
+				out.push_back(*p++);
+				continue;
+			}
+			if (++p >= end)
+				return false;
+			char escape = *p++;
+			switch (escape) {
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'n': out.push_back('\n'); break;
+			case 'r': out.push_back('\r'); break;
+			case 't': out.push_back('\t'); break;
+			case 'u': {
+				unsigned int code = 0;
+				if (end - p < 4 || std::from_chars(p, p + 4, code, 16).ptr != p + 4)
+					return false;
+				p += 4;
+				// basic multilingual plane only, which covers glTF names and URIs
+				if (code < 0x80)
+					out.push_back(static_cast<char>(code));
+				else if (code < 0x800) {
+					out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+					out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+				}
+				else {
+					out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+					out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+					out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+				}
+			}
+			break;
+			default: out.push_back(escape); break; // \" \\ and \/
+			}
+		}
+		if (p >= end)
+			return false;
+		++p;
+		return true;
+	}
+
+	static bool parseValue(const char*& p, const char* end, JsonValue& out, int depth)
+	{
+		if (depth > 64)
+			return false;
+		skipWhitespace(p, end);
+		if (p >= end)
+			return false;
+
+		switch (*p) {
+		case '{': {
+			out.Kind = OBJECT;
+			++p;
+			skipWhitespace(p, end);
+			if (p < end && *p == '}') {
+				++p;
+				return true;
+			}
+			while (true) {
+				std::string key;
+				skipWhitespace(p, end);
+				if (!parseString(p, end, key))
+					return false;
+				skipWhitespace(p, end);
+				if (p >= end || *p++ != ':')
+					return false;
+				out.Keys.push_back(key);
+				out.Items.emplace_back();
+				if (!parseValue(p, end, out.Items.back(), depth + 1))
+					return false;
+				skipWhitespace(p, end);
+				if (p < end && *p == ',') {
+					++p;
+					continue;
+				}
+				if (p < end && *p == '}') {
+					++p;
+					return true;
+				}
+				return false;
+			}
+		}
+		case '[': {
+			out.Kind = ARRAY;
+			++p;
+			skipWhitespace(p, end);
+			if (p < end && *p == ']') {
+				++p;
+				return true;
+			}
+			while (true) {
+				out.Items.emplace_back();
+				if (!parseValue(p, end, out.Items.back(), depth + 1))
+					return false;
+				skipWhitespace(p, end);
+				if (p < end && *p == ',') {
+					++p;
+					continue;
+				}
+				if (p < end && *p == ']') {
+					++p;
+					return true;
+				}
+				return false;
+			}
+		}
+		case '"':
+			out.Kind = STRING;
+			return parseString(p, end, out.String);
+		case 't':
+			out.Kind = BOOLEAN;
+			out.Boolean = true;
+			return parseLiteral(p, end, "true");
+		case 'f':
+			out.Kind = BOOLEAN;
+			return parseLiteral(p, end, "false");
+		case 'n':
+			return parseLiteral(p, end, "null");
+		default: {
+			out.Kind = NUMBER;
+			std::from_chars_result result = std::from_chars(p, end, out.Number);
+			if (result.ec != std::errc())
+				return false;
+			p = result.ptr;
+			return true;
+		}
+		}
+	}
+};
+
+
+// Loads OBJ and glTF (.gltf + .bin, or .glb) triangle meshes from memory-mapped files.
+// Open() parses everything that does not depend on the destination; WriteVertices/WriteIndices then
+// fill caller-provided memory (typically a mapped GL buffer) directly, split across worker threads.
+class ModelLoader
+{
+public:
+	// threads == 0 uses one worker per hardware thread
+	explicit ModelLoader(unsigned int threads = 0)
+	{
+		threadCount = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	bool Open(const char* filename)
+	{
+		error.clear();
+		if (!file.Open(filename))
+			return fail(std::string("cannot open ") + filename);
+
+		std::string name(filename);
+		std::string extension = name.substr(name.find_last_of('.') + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+
+		if (extension == "obj") {
+			format = OBJ;
+			return openObj();
+		}
+		if (extension == "gltf" || extension == "glb") {
+			format = GLTF;
+			std::string directory = name.substr(0, name.find_last_of("/\\") + 1);
+			return openGltf(extension == "glb", directory);
+		}
+		return fail("unsupported model format ." + extension);
+	}
+
+	size_t VertexCount() const { return vertexCount; }
+	size_t IndexCount() const { return indexCount; }
+	unsigned int ThreadCount() const { return threadCount; }
+	const std::string& Error() const { return error; }
+
+	// writes VertexCount() interleaved vertices of MODEL_FLOATS_PER_VERTEX floats each
+	bool WriteVertices(float* destination)
+	{
+		return format == OBJ ? writeObjVertices(destination) : writeGltfVertices(destination);
+	}
+
+	// writes IndexCount() indices as uint16_t (shortIndices) or uint32_t
+	bool WriteIndices(void* destination, bool shortIndices)
+	{
+		return format == OBJ ? writeObjIndices(destination, shortIndices) : writeGltfIndices(destination, shortIndices);
+	}
+
+private:
+	enum Format { OBJ, GLTF };
+
+	// one newline-aligned slice of an OBJ file and where its data lands in the outputs
+	struct ObjChunk
+	{
+		const char* Begin;
+		const char* End;
+		size_t Positions = 0;
+		size_t TexCoords = 0;
+		size_t Triangles = 0;
+		size_t PositionOffset = 0;
+		size_t TexCoordOffset = 0;
+		size_t TriangleOffset = 0;
+		size_t VertexOffset = 0;
+		std::vector<uint64_t> Vertices;	// objCorner() key of every vertex the chunk welded, in order
+		bool Failed = false;
+	};
+
+	// strided view of one glTF accessor
+	struct GltfAccessor
+	{
+		const unsigned char* Data = nullptr;
+		size_t Count = 0;
+		size_t Stride = 0;
+		int ComponentType = 0;
+		bool Normalized = false;
+	};
+
+	struct GltfPrimitive
+	{
+		GltfAccessor Positions;
+		GltfAccessor TexCoords;		// Data == nullptr when the primitive has no TEXCOORD_0
+		GltfAccessor Indices;		// Data == nullptr for non-indexed primitives
+		size_t VertexOffset = 0;
+		size_t IndexOffset = 0;
+		size_t IndexCount = 0;
+	};
+
+	unsigned int threadCount;
+	Format format = OBJ;
+	MappedFile file;
+	std::string error;
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+
+	// OBJ state: per-chunk counts and welded vertices, the shared position / texture coordinate pools faces index
+	// into, and the vertex every triangle corner uses (relative to its chunk's VertexOffset)
+	std::vector<ObjChunk> chunks;
+	std::vector<float> positions;
+	std::vector<float> texCoords;
+	std::vector<uint32_t> objIndices;
+
+	// glTF state
+	std::vector<std::unique_ptr<MappedFile>> buffers;
+	std::vector<std::pair<const unsigned char*, size_t>> bufferData;
+	std::vector<GltfPrimitive> primitives;
+
+	bool fail(const std::string& message)
+	{
+		error = message;
+		return false;
+	}
+
+	static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	static const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+			++p;
+		return p;
+	}
+
+	static const char* lineEnd(const char* p, const char* end)
+	{
+		const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		return newline != nullptr ? newline : end;
+	}
+
+	static const char* parseFloats(const char* p, const char* end, float* values, int count)
+	{
+		for (int i = 0; i < count; ++i) {
+			p = skipSpaces(p, end);
+			if (p < end && *p == '+')
+				++p;
+			std::from_chars_result result = std::from_chars(p, end, values[i]);
+			if (result.ec != std::errc())
+				values[i] = 0.0f;
+			else
+				p = result.ptr;
+		}
+		return p;
+	}
+
+	// "v", "v/vt", "v//vn" or "v/vt/vn"; texCoord is 0 when absent
+	static const char* parseCorner(const char* p, const char* end, int64_t& position, int64_t& texCoord)
+	{
+		position = 0;
+		texCoord = 0;
+		std::from_chars_result result = std::from_chars(p, end, position);
+		p = result.ptr;
+		if (p < end && *p == '/') {
+			++p;
+			if (p < end && *p != '/')
+				p = std::from_chars(p, end, texCoord).ptr;
+		}
+		while (p < end && !isSpace(*p))
+			++p;
+		return p;
+	}
+
+	// line kinds we care about; everything else (vn, comments, groups, materials) is skipped
+	enum ObjLine { OTHER, POSITION, TEXCOORD, FACE };
+
+	static ObjLine classify(const char*& p, const char* end)
+	{
+		p = skipSpaces(p, end);
+		if (end - p < 2)
+			return OTHER;
+		if (p[0] == 'v' && isSpace(p[1])) {
+			p += 2;
+			return POSITION;
+		}
+		if (p[0] == 'f' && isSpace(p[1])) {
+			p += 2;
+			return FACE;
+		}
+		if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+			p += 3;
+			return TEXCOORD;
+		}
+		return OTHER;
+	}
+
+	bool openObj()
+	{
+		const char* data = file.Data();
+		const char* end = data + file.Size();
+
+		// split into newline-aligned chunks, one per worker
+		chunks.assign(threadCount, ObjChunk());
+		const char* begin = data;
+		for (unsigned int i = 0; i < threadCount; ++i) {
+			const char* split = i + 1 == threadCount ? end : data + file.Size() * (i + 1) / threadCount;
+			if (split < begin)
+				split = begin;
+			split = split < end ? lineEnd(split, end) : end;
+			chunks[i].Begin = begin;
+			chunks[i].End = split;
+			begin = split;
+		}
+
+		// pass 1: count what every chunk contributes
+		ParallelFor(threadCount, [this](unsigned int worker) {
+			ObjChunk& chunk = chunks[worker];
+			for (const char* line = chunk.Begin; line < chunk.End;) {
+				const char* end = lineEnd(line, chunk.End);
+				const char* p = line;
+				switch (classify(p, end)) {
+				case POSITION: ++chunk.Positions; break;
+				case TEXCOORD: ++chunk.TexCoords; break;
+				case FACE: {
+					size_t corners = 0;
+					for (p = skipSpaces(p, end); p < end; p = skipSpaces(p, end)) {
+						while (p < end && !isSpace(*p))
+							++p;
+						++corners;
+					}
+					if (corners >= 3)
+						chunk.Triangles += corners - 2;
+				}
+				break;
+				default: break;
+				}
+				line = end + 1;
+			}
+		});
+
+		size_t positionCount = 0;
+		size_t texCoordCount = 0;
+		size_t triangleCount = 0;
+		for (ObjChunk& chunk : chunks) {
+			chunk.PositionOffset = positionCount;
+			chunk.TexCoordOffset = texCoordCount;
+			chunk.TriangleOffset = triangleCount;
+			positionCount += chunk.Positions;
+			texCoordCount += chunk.TexCoords;
+			triangleCount += chunk.Triangles;
+		}
+
+		// pass 2: parse the attribute pools at each chunk's offset
+		positions.resize(positionCount * 3);
+		texCoords.resize(texCoordCount * 2);
+		ParallelFor(threadCount, [this](unsigned int worker) {
+			const ObjChunk& chunk = chunks[worker];
+			float* position = positions.data() + chunk.PositionOffset * 3;
+			float* texCoord = texCoords.data() + chunk.TexCoordOffset * 2;
+			for (const char* line = chunk.Begin; line < chunk.End;) {
+				const char* end = lineEnd(line, chunk.End);
+				const char* p = line;
+				ObjLine kind = classify(p, end);
+				if (kind == POSITION) {
+					parseFloats(p, end, position, 3);
+					position += 3;
+				}
+				else if (kind == TEXCOORD) {
+					parseFloats(p, end, texCoord, 2);
+					texCoord += 2;
+				}
+				line = end + 1;
+			}
+		});
+
+		// pass 3: triangulate faces, welding the corners of every chunk that reference the same position and
+		// texture coordinate into one vertex (normals are not part of the vertex layout, so corners that only
+		// differ in vn weld too). Chunks weld on their own, so a vertex shared across a chunk boundary is stored
+		// once per chunk.
+		objIndices.resize(triangleCount * 3);
+		ParallelFor(threadCount, [&](unsigned int worker) {
+			ObjChunk& chunk = chunks[worker];
+			uint32_t* out = objIndices.data() + chunk.TriangleOffset * 3;
+			// relative (negative) indices count back from the attributes defined so far
+			int64_t positionsSeen = static_cast<int64_t>(chunk.PositionOffset);
+			int64_t texCoordsSeen = static_cast<int64_t>(chunk.TexCoordOffset);
+			std::vector<int64_t> face;
+			std::vector<uint32_t> table(1024, OBJ_EMPTY);	// open-addressing hash table of chunk vertices
+			chunk.Vertices.clear();
+
+			for (const char* line = chunk.Begin; line < chunk.End;) {
+				const char* end = lineEnd(line, chunk.End);
+				const char* p = line;
+				ObjLine kind = classify(p, end);
+				if (kind == POSITION)
+					++positionsSeen;
+				else if (kind == TEXCOORD)
+					++texCoordsSeen;
+				else if (kind == FACE) {
+					face.clear();
+					for (p = skipSpaces(p, end); p < end; p = skipSpaces(p, end)) {
+						int64_t position, texCoord;
+						p = parseCorner(p, end, position, texCoord);
+						face.push_back(position > 0 ? position - 1 : positionsSeen + position);
+						face.push_back(texCoord > 0 ? texCoord - 1 : (texCoord < 0 ? texCoordsSeen + texCoord : -1));
+					}
+
+					// fan triangulation: (0, i - 1, i)
+					size_t cornerCount = face.size() / 2;
+					for (size_t i = 2; i < cornerCount; ++i) {
+						const size_t fan[3] = { 0, i - 1, i };
+						for (size_t k = 0; k < 3; ++k) {
+							int64_t position = face[fan[k] * 2];
+							int64_t texCoord = face[fan[k] * 2 + 1];
+							if (position < 0 || static_cast<size_t>(position) >= positionCount) {
+								chunk.Failed = true;
+								position = 0;
+							}
+							if (texCoord >= 0 && static_cast<size_t>(texCoord) >= texCoordCount) {
+								chunk.Failed = true;
+								texCoord = -1;
+							}
+							*out++ = weld(chunk.Vertices, table, objCorner(position, texCoord));
+						}
+					}
+				}
+				line = end + 1;
+			}
+		});
+
+		vertexCount = 0;
+		for (ObjChunk& chunk : chunks) {
+			if (chunk.Failed)
+				return fail("face references a vertex that does not exist");
+			chunk.VertexOffset = vertexCount;
+			vertexCount += chunk.Vertices.size();
+		}
+		indexCount = objIndices.size();
+		return true;
+	}
+
+	static constexpr uint32_t OBJ_EMPTY = 0xFFFFFFFFu;
+
+	// a corner's position index in the high half, its texture coordinate index + 1 (0 = none) in the low half
+	static uint64_t objCorner(int64_t position, int64_t texCoord)
+	{
+		return (static_cast<uint64_t>(position) << 32) | static_cast<uint32_t>(texCoord + 1);
+	}
+
+	// index of the vertex with this corner key, appended when it is new; table (a power of two in size, holding
+	// vertex indices) doubles whenever it gets half full
+	static uint32_t weld(std::vector<uint64_t>& vertices, std::vector<uint32_t>& table, uint64_t key)
+	{
+		if ((vertices.size() + 1) * 2 > table.size()) {
+			table.assign(table.size() * 2, OBJ_EMPTY);
+			for (size_t v = 0; v < vertices.size(); ++v) {
+				size_t slot = objSlot(vertices[v], table.size());
+				while (table[slot] != OBJ_EMPTY)
+					slot = (slot + 1) & (table.size() - 1);
+				table[slot] = static_cast<uint32_t>(v);
+			}
+		}
+		size_t slot = objSlot(key, table.size());
+		while (table[slot] != OBJ_EMPTY) {
+			if (vertices[table[slot]] == key)
+				return table[slot];
+			slot = (slot + 1) & (table.size() - 1);
+		}
+		table[slot] = static_cast<uint32_t>(vertices.size());
+		vertices.push_back(key);
+		return table[slot];
+	}
+
+	static size_t objSlot(uint64_t key, size_t tableSize)
+	{
+		key *= 0x9E3779B97F4A7C15ull;
+		return static_cast<size_t>(key ^ (key >> 32)) & (tableSize - 1);
+	}
+
+	// copies every chunk's welded vertices out of the attribute pools
+	bool writeObjVertices(float* destination)
+	{
+		ParallelFor(threadCount, [&](unsigned int worker) {
+			const ObjChunk& chunk = chunks[worker];
+			float* out = destination + chunk.VertexOffset * MODEL_FLOATS_PER_VERTEX;
+			for (uint64_t key : chunk.Vertices) {
+				size_t position = static_cast<size_t>(key >> 32);
+				uint32_t texCoord = static_cast<uint32_t>(key);
+				std::memcpy(out, &positions[position * 3], sizeof(float) * 3);
+				if (texCoord != 0)
+					std::memcpy(out + 3, &texCoords[(texCoord - 1) * 2], sizeof(float) * 2);
+				else
+					out[3] = out[4] = 0.0f;
+				out[5] = 0.0f;
+				out += MODEL_FLOATS_PER_VERTEX;
+			}
+		});
+		return true;
+	}
+
+	// writes every chunk's corners, moved past the vertices of the chunks before it
+	bool writeObjIndices(void* destination, bool shortIndices)
+	{
+		ParallelFor(threadCount, [&](unsigned int worker) {
+			const ObjChunk& chunk = chunks[worker];
+			const uint32_t offset = static_cast<uint32_t>(chunk.VertexOffset);
+			const size_t first = chunk.TriangleOffset * 3;
+			const size_t last = first + chunk.Triangles * 3;
+			for (size_t i = first; i < last; ++i) {
+				if (shortIndices)
+					static_cast<uint16_t*>(destination)[i] = static_cast<uint16_t>(objIndices[i] + offset);
+				else
+					static_cast<uint32_t*>(destination)[i] = objIndices[i] + offset;
+			}
+		});
+		return true;
+	}
+
+	bool openGltf(bool binary, const std::string& directory)
+	{
+		const char* data = file.Data();
+		size_t size = file.Size();
+		const char* jsonBegin = data;
+		const char* jsonEnd = data + size;
+
+		buffers.clear();
+		bufferData.clear();
+		primitives.clear();
+
+		// .glb: 12 byte header, then a JSON chunk and an optional BIN chunk
+		const unsigned char* binChunk = nullptr;
+		size_t binSize = 0;
+		if (binary) {
+			uint32_t header[3];
+			if (size < 20)
+				return fail("truncated glb header");
+			std::memcpy(header, data, sizeof(header));
+			if (header[0] != 0x46546C67u || header[1] != 2u)
+				return fail("not a glTF 2.0 binary file");
+			size_t offset = 12;
+			bool haveJson = false;
+			while (offset + 8 <= size) {
+				uint32_t chunkHeader[2];
+				std::memcpy(chunkHeader, data + offset, sizeof(chunkHeader));
+				offset += 8;
+				if (chunkHeader[0] > size - offset)
+					return fail("truncated glb chunk");
+				if (chunkHeader[1] == 0x4E4F534Au && !haveJson) {
+					jsonBegin = data + offset;
+					jsonEnd = jsonBegin + chunkHeader[0];
+					haveJson = true;
+				}
+				else if (chunkHeader[1] == 0x004E4942u && binChunk == nullptr) {
+					binChunk = reinterpret_cast<const unsigned char*>(data + offset);
+					binSize = chunkHeader[0];
+				}
+				offset += (chunkHeader[0] + 3) & ~size_t(3);
+			}
+			if (!haveJson)
+				return fail("glb has no JSON chunk");
+		}
+
+		JsonValue document;
+		if (!JsonValue::Parse(jsonBegin, jsonEnd, document))
+			return fail("malformed glTF JSON");
+
+		// map every buffer: the glb BIN chunk or an external file next to the .gltf
+		const JsonValue* bufferList = document.Get("buffers");
+		for (size_t i = 0; bufferList != nullptr && i < bufferList->Items.size(); ++i) {
+			const JsonValue* uri = bufferList->Items[i].Get("uri");
+			if (uri == nullptr) {
+				if (binChunk == nullptr)
+					return fail("glTF buffer without uri or BIN chunk");
+				bufferData.emplace_back(binChunk, binSize);
+				continue;
+			}
+			if (uri->String.compare(0, 5, "data:") == 0)
+				return fail("embedded data URIs are not supported, use a .bin or .glb");
+			buffers.emplace_back(new MappedFile());
+			if (!buffers.back()->Open((directory + uri->String).c_str()))
+				return fail("cannot open glTF buffer " + uri->String);
+			bufferData.emplace_back(reinterpret_cast<const unsigned char*>(buffers.back()->Data()), buffers.back()->Size());
+		}
+
+		// every triangle primitive of every mesh becomes part of one combined mesh (node transforms are not applied)
+		const JsonValue* meshes = document.Get("meshes");
+		for (size_t m = 0; meshes != nullptr && m < meshes->Items.size(); ++m) {
+			const JsonValue* primitiveList = meshes->Items[m].Get("primitives");
+			for (size_t p = 0; primitiveList != nullptr && p < primitiveList->Items.size(); ++p) {
+				const JsonValue& primitive = primitiveList->Items[p];
+				if (primitive.NumberOr("mode", 4) != 4)
+					continue;
+				const JsonValue* attributes = primitive.Get("attributes");
+				const JsonValue* position = attributes != nullptr ? attributes->Get("POSITION") : nullptr;
+				if (position == nullptr)
+					continue;
+
+				GltfPrimitive result;
+				if (!resolveAccessor(document, position->Number, 3, result.Positions))
+					return false;
+				if (result.Positions.ComponentType != 5126)
+					return fail("POSITION must be float");
+				const JsonValue* texCoord = attributes->Get("TEXCOORD_0");
+				if (texCoord != nullptr && !resolveAccessor(document, texCoord->Number, 2, result.TexCoords))
+					return false;
+				const JsonValue* indices = primitive.Get("indices");
+				if (indices != nullptr && !resolveAccessor(document, indices->Number, 1, result.Indices))
+					return false;
+
+				result.VertexOffset = vertexCount;
+				result.IndexOffset = indexCount;
+				result.IndexCount = result.Indices.Data != nullptr ? result.Indices.Count : result.Positions.Count;
+				vertexCount += result.Positions.Count;
+				indexCount += result.IndexCount;
+				primitives.push_back(result);
+			}
+		}
+
+		if (primitives.empty())
+			return fail("glTF file has no triangle meshes");
+		return true;
+	}
+
+	static size_t componentSize(int componentType)
+	{
+		switch (componentType) {
+		case 5120: case 5121: return 1;	// BYTE, UNSIGNED_BYTE
+		case 5122: case 5123: return 2;	// SHORT, UNSIGNED_SHORT
+		case 5125: case 5126: return 4;	// UNSIGNED_INT, FLOAT
+		default: return 0;
+		}
+	}
+
+	bool resolveAccessor(const JsonValue& document, double index, int components, GltfAccessor& accessor)
+	{
+		const JsonValue* accessors = document.Get("accessors");
+		const JsonValue* source = accessors != nullptr ? accessors->At(index) : nullptr;
+		if (source == nullptr)
+			return fail("missing glTF accessor");
+		const JsonValue* views = document.Get("bufferViews");
+		const JsonValue* view = views != nullptr ? views->At(source->NumberOr("bufferView", -1)) : nullptr;
+		if (view == nullptr)
+			return fail("sparse or view-less glTF accessors are not supported");
+
+		// every size is checked before it is used, so a malformed file cannot wrap an offset past the checks
+		size_t buffer, viewOffset, viewLength, componentType, offset;
+		if (!view->SizeOr("buffer", bufferData.size(), buffer) || !view->SizeOr("byteOffset", 0, viewOffset)
+			|| !view->SizeOr("byteLength", 0, viewLength) || !view->SizeOr("byteStride", 0, accessor.Stride)
+			|| !source->SizeOr("componentType", 0, componentType) || !source->SizeOr("count", 0, accessor.Count)
+			|| !source->SizeOr("byteOffset", 0, offset))
+			return fail("glTF accessor has a negative, fractional or oversized number");
+		if (buffer >= bufferData.size())
+			return fail("glTF buffer view references a missing buffer");
+
+		accessor.ComponentType = componentType <= 5126 ? static_cast<int>(componentType) : 0;
+		const JsonValue* normalized = source->Get("normalized");
+		accessor.Normalized = normalized != nullptr && normalized->Boolean;
+
+		size_t elementSize = componentSize(accessor.ComponentType) * components;
+		if (elementSize == 0)
+			return fail("unsupported glTF component type");
+		if (accessor.Stride == 0)
+			accessor.Stride = elementSize;
+
+		const size_t bufferSize = bufferData[buffer].second;
+		if (viewOffset > bufferSize || viewLength > bufferSize - viewOffset || offset > viewLength)
+			return fail("glTF accessor runs past the end of its buffer");
+		const size_t available = viewLength - offset;
+		if (accessor.Count != 0 && (accessor.Count - 1 > available / accessor.Stride
+			|| accessor.Stride * (accessor.Count - 1) + elementSize > available))
+			return fail("glTF accessor runs past the end of its buffer");
+
+		accessor.Data = bufferData[buffer].first + viewOffset + offset;
+		return true;
+	}
+
+	static float readComponent(const GltfAccessor& accessor, const unsigned char* element, int component)
+	{
+		switch (accessor.ComponentType) {
+		case 5126: {
+			float value;
+			std::memcpy(&value, element + component * 4, sizeof(value));
+			return value;
+		}
+		case 5121: {
+			float value = element[component];
+			return accessor.Normalized ? value / 255.0f : value;
+		}
+		case 5123: {
+			uint16_t value;
+			std::memcpy(&value, element + component * 2, sizeof(value));
+			return accessor.Normalized ? value / 65535.0f : value;
+		}
+		default:
+			return 0.0f;
+		}
+	}
+
+	static uint32_t readIndex(const GltfAccessor& accessor, size_t i)
+	{
+		const unsigned char* element = accessor.Data + i * accessor.Stride;
+		switch (accessor.ComponentType) {
+		case 5121: return element[0];
+		case 5123: {
+			uint16_t value;
+			std::memcpy(&value, element, sizeof(value));
+			return value;
+		}
+		default: {
+			uint32_t value;
+			std::memcpy(&value, element, sizeof(value));
+			return value;
+		}
+		}
+	}
+
+	bool writeGltfVertices(float* destination)
+	{
+		// every worker converts one contiguous range of the combined vertex array
+		ParallelFor(threadCount, [&](unsigned int worker) {
+			size_t first = vertexCount * worker / threadCount;
+			size_t last = vertexCount * (worker + 1) / threadCount;
+			for (const GltfPrimitive& primitive : primitives) {
+				size_t begin = std::max(first, primitive.VertexOffset);
+				size_t end = std::min(last, primitive.VertexOffset + primitive.Positions.Count);
+				for (size_t v = begin; v < end; ++v) {
+					size_t local = v - primitive.VertexOffset;
+					float* out = destination + v * MODEL_FLOATS_PER_VERTEX;
+					std::memcpy(out, primitive.Positions.Data + local * primitive.Positions.Stride, sizeof(float) * 3);
+					if (primitive.TexCoords.Data != nullptr && local < primitive.TexCoords.Count) {
+						const unsigned char* element = primitive.TexCoords.Data + local * primitive.TexCoords.Stride;
+						out[3] = readComponent(primitive.TexCoords, element, 0);
+						// glTF puts the texture origin at the top left, OpenGL at the bottom left
+						out[4] = 1.0f - readComponent(primitive.TexCoords, element, 1);
+					}
+					else
+						out[3] = out[4] = 0.0f;
+					out[5] = 0.0f;
+				}
+			}
+		});
+		return true;
+	}
+
+	bool writeGltfIndices(void* destination, bool shortIndices)
+	{
+		std::atomic<bool> failed(false);
+		ParallelFor(threadCount, [&](unsigned int worker) {
+			size_t first = indexCount * worker / threadCount;
+			size_t last = indexCount * (worker + 1) / threadCount;
+			for (const GltfPrimitive& primitive : primitives) {
+				size_t begin = std::max(first, primitive.IndexOffset);
+				size_t end = std::min(last, primitive.IndexOffset + primitive.IndexCount);
+				for (size_t i = begin; i < end; ++i) {
+					size_t local = i - primitive.IndexOffset;
+					uint32_t index = primitive.Indices.Data != nullptr ? readIndex(primitive.Indices, local) : static_cast<uint32_t>(local);
+					if (index >= primitive.Positions.Count) {
+						failed.store(true, std::memory_order_relaxed);
+						index = 0;
+					}
+					index += static_cast<uint32_t>(primitive.VertexOffset);
+					if (shortIndices)
+						static_cast<uint16_t*>(destination)[i] = static_cast<uint16_t>(index);
+					else
+						static_cast<uint32_t*>(destination)[i] = index;
+				}
+			}
+		});
+		return failed.load(std::memory_order_relaxed) ? fail("glTF index references a vertex that does not exist") : true;
+	}
+};
+
+
+// Straightforward single-threaded OBJ reader (ifstream + istringstream into std::vector),
+// kept only as the baseline the loader benchmark compares ModelLoader against
+inline bool LoadObjNaive(const char* filename, std::vector<float>& vertices)
+{
+	std::ifstream input(filename);
+	if (!input)
+		return false;
+
+	std::vector<float> positions;
+	std::vector<float> texCoords;
+	std::string line;
+	while (std::getline(input, line)) {
+		std::istringstream stream(line);
+		std::string kind;
+		stream >> kind;
+		if (kind == "v") {
+			float x = 0, y = 0, z = 0;
+			stream >> x >> y >> z;
+			positions.insert(positions.end(), { x, y, z });
+		}
+		else if (kind == "vt") {
+			float u = 0, v = 0;
+			stream >> u >> v;
+			texCoords.insert(texCoords.end(), { u, v });
+		}
+		else if (kind == "f") {
+			std::vector<std::pair<long, long>> corners;
+			std::string token;
+			while (stream >> token) {
+				long position = std::stol(token);
+				long texCoord = 0;
+				size_t slash = token.find('/');
+				if (slash != std::string::npos && slash + 1 < token.size() && token[slash + 1] != '/')
+					texCoord = std::stol(token.substr(slash + 1));
+				long positionCount = static_cast<long>(positions.size() / 3);
+				long texCoordCount = static_cast<long>(texCoords.size() / 2);
+				corners.emplace_back(position > 0 ? position - 1 : positionCount + position,
+					texCoord > 0 ? texCoord - 1 : (texCoord < 0 ? texCoordCount + texCoord : -1));
+			}
+			for (size_t i = 2; i < corners.size(); ++i) {
+				const std::pair<long, long>* fan[3] = { &corners[0], &corners[i - 1], &corners[i] };
+				for (const std::pair<long, long>* corner : fan) {
+					if (corner->first < 0 || static_cast<size_t>(corner->first) * 3 >= positions.size())
+						return false;
+					vertices.insert(vertices.end(), positions.begin() + corner->first * 3, positions.begin() + corner->first * 3 + 3);
+					if (corner->second >= 0 && static_cast<size_t>(corner->second) * 2 < texCoords.size())
+						vertices.insert(vertices.end(), texCoords.begin() + corner->second * 2, texCoords.begin() + corner->second * 2 + 2);
+					else
+						vertices.insert(vertices.end(), { 0.0f, 0.0f });
+					vertices.push_back(0.0f);
+				}
+			}
+		}
+	}
+	return true;
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "content_hash.h"
+#include "mapped_file.h"
+
+// Cached program binary file (<key>.program): a fixed header followed by the driver's binary as
+// returned by glGetProgramBinary
+const uint32_t PROGRAM_CACHE_MAGIC = 0x4E494250; // "PBIN"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t Key;			// ProgramCache::Key() of the sources and driver the binary was linked with
+	uint32_t Format;		// binary format reported by glGetProgramBinary
+	uint32_t Reserved;
+	uint64_t DataBytes;
+	uint64_t DataHash;		// HashBytes of the binary, so a truncated or corrupt file is never handed to the driver
+};
+
+// Linked programs saved with glGetProgramBinary and restored with glProgramBinary. Binaries are only valid
+// for the driver that produced them, so the key mixes the GL vendor, renderer and version strings into the
+// hash of the shader sources: a driver update simply misses the cache. Every method needs a current context.
+class ProgramCache
+{
+public:
+	explicit ProgramCache(const std::string& directory) : directory(directory) {}
+
+	// false when the driver offers no binary format (program binaries are then never saved or loaded)
+	bool Supported() const
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+
+	// identifies a program by its shader sources (in stage order) and the driver
+	uint64_t Key(const char* const sources[], int count)
+	{
+		if (driver.empty()) {
+			const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+			for (GLenum name : names) {
+				const GLubyte* value = glGetString(name);
+				driver += value ? reinterpret_cast<const char*>(value) : "";
+				driver += '\n';
+			}
+		}
+		std::string text = driver;
+		for (int i = 0; i < count; ++i) {
+			text += sources[i];
+			text += '\0';
+		}
+		return HashBytes(text.data(), text.size());
+	}
+
+	std::string PathFor(uint64_t key) const
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.program", static_cast<unsigned long long>(key));
+		return directory + "/" + name;
+	}
+
+	// restores the binary into programId and checks that it links; false means "compile it". A file the
+	// driver rejects is deleted, and the program object should not be reused for compiling
+	bool Load(uint64_t key, GLuint programId) const
+	{
+		const std::string path = PathFor(key);
+		MappedFile file;
+		if (!file.Open(path.c_str()) || file.Size() < sizeof(ProgramCacheHeader))
+			return false;
+		ProgramCacheHeader header;
+		std::memcpy(&header, file.Data(), sizeof(header));
+
+		const char* data = file.Data() + sizeof(header);
+		if (header.Magic != PROGRAM_CACHE_MAGIC || header.Version != PROGRAM_CACHE_VERSION || header.Key != key
+			|| header.DataBytes == 0 || sizeof(header) + header.DataBytes > file.Size() || HashBytes(data, header.DataBytes) != header.DataHash) {
+			file.Close();
+			std::remove(path.c_str());
+			return false;
+		}
+
+		glProgramBinary(programId, header.Format, data, static_cast<GLsizei>(header.DataBytes));
+		GLint linked = GL_FALSE;
+		glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			file.Close();
+			std::remove(path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// saves a linked program (created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT); written to a temporary file first
+	// so a crash never leaves a torn binary
+	bool Save(uint64_t key, GLuint programId) const
+	{
+		GLint length = 0;
+		glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(programId, length, &length, &format, binary.data());
+		if (length <= 0)
+			return false;
+
+		ProgramCacheHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.Magic = PROGRAM_CACHE_MAGIC;
+		header.Version = PROGRAM_CACHE_VERSION;
+		header.Key = key;
+		header.Format = format;
+		header.DataBytes = static_cast<uint64_t>(length);
+		header.DataHash = HashBytes(binary.data(), header.DataBytes);
+
+		std::error_code ignored;
+		std::filesystem::create_directories(directory, ignored);
+		const std::string path = PathFor(key);
+		return WriteFileAtomically(path, [&](std::ofstream& out) {
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(binary.data(), header.DataBytes);
+		});
+	}
+
+private:
+	std::string directory;
+	std::string driver;		// GL_VENDOR, GL_RENDERER and GL_VERSION, read on first use
+};
+#endif
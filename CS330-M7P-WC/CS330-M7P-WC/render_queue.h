@@ -0,0 +1,134 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "instance_buffer.h"
+
+// Passes in the order they are drawn (the top bits of every sort key)
+const unsigned int RENDER_PASS_OPAQUE = 0;
+
+// GL call a RenderCommand replays
+enum class RenderDraw : uint8_t
+{
+	Elements,				// glDrawElements, with the constant instance attributes of Instance when it is set
+	Instanced,				// glDrawElementsInstanced of InstanceCount instances
+	ElementsBaseInstance,	// one command of an indirect draw list issued on its own
+	MultiIndirect,			// glMultiDrawElementsIndirect of Count commands from IndirectBuffer
+	MultiIndirectCount		// the same, drawing as many as ParameterBuffer holds (at most Count)
+};
+
+// Everything one draw needs: the state to bind, and the arguments of its draw call. Uniforms are not part of it;
+// a program drawn once per frame has its uniforms set while the draw is recorded, the others read per-draw data.
+struct RenderCommand
+{
+	GLuint Program = 0;
+	GLuint Vao = 0;
+	GLuint Texture = 0;			// GL_TEXTURE_2D_ARRAY on unit 0, or 0 when the program samples nothing
+	GLuint DrawBuffer = 0;		// shader storage buffer of the per-draw data, or 0
+	GLuint IndirectBuffer = 0;
+	GLuint ParameterBuffer = 0;
+	RenderDraw Draw = RenderDraw::Elements;
+	GLenum IndexType = GL_UNSIGNED_INT;
+	GLsizei Count = 0;			// indices, or commands of a multi-draw
+	GLsizei InstanceCount = 1;
+	GLuint FirstIndex = 0;
+	GLint BaseVertex = 0;
+	GLuint BaseInstance = 0;
+	const InstanceData* Instance = nullptr;
+};
+
+// One frame's draws, recorded in any order and replayed sorted by a 64-bit key. The key orders by pass, then by
+// program, material (texture) and vertex array so draws sharing state come together, and last by quantized depth
+// so draws sharing all of it go front to back and the early depth test rejects the most fragments:
+//
+//   63..60 pass | 59..52 program | 51..40 material | 39..24 vertex array | 23..0 depth
+//
+// GL names are small integers handed out in order, so their low bits are kept as they are; two names that share
+// them would only sort together, never draw wrong. Keys are radix sorted, eight bits per pass, skipping the passes
+// where every key has the same digit (most of them, as a frame uses few programs and vertex arrays).
+class RenderQueue
+{
+public:
+	static constexpr uint32_t DEPTH_BITS = 24;
+
+	static uint64_t Key(unsigned int pass, GLuint program, GLuint material, GLuint vao, uint32_t depth)
+	{
+		return (static_cast<uint64_t>(pass & 0xF) << 60) | (static_cast<uint64_t>(program & 0xFF) << 52)
+			| (static_cast<uint64_t>(material & 0xFFF) << 40) | (static_cast<uint64_t>(vao & 0xFFFF) << 24) | (depth & 0xFFFFFF);
+	}
+
+	// view depth in [0, farPlane] mapped onto the depth bits (nearer is smaller)
+	static uint32_t QuantizeDepth(float depth, float farPlane)
+	{
+		const float scale = static_cast<float>((1u << DEPTH_BITS) - 1);
+		return static_cast<uint32_t>(std::min(std::max(depth / farPlane, 0.0f), 1.0f) * scale);
+	}
+
+	void Clear()
+	{
+		entries.clear();
+		commands.clear();
+	}
+
+	void Add(uint64_t key, const RenderCommand& command)
+	{
+		entries.push_back({ key, static_cast<uint32_t>(commands.size()) });
+		commands.push_back(command);
+	}
+
+	// adds every draw of another queue, e.g. one a worker thread recorded, in the order it recorded them
+	void Append(const RenderQueue& other)
+	{
+		const uint32_t offset = static_cast<uint32_t>(commands.size());
+		for (const Entry& entry : other.entries)
+			entries.push_back({ entry.Key, entry.Command + offset });
+		commands.insert(commands.end(), other.commands.begin(), other.commands.end());
+	}
+
+	// stable least significant digit first radix sort of the keys
+	void Sort()
+	{
+		const size_t count = entries.size();
+		size_t histograms[8][256];
+		std::memset(histograms, 0, sizeof(histograms));
+		for (const Entry& entry : entries)
+			for (int digit = 0; digit < 8; ++digit)
+				++histograms[digit][(entry.Key >> (8 * digit)) & 0xFF];
+
+		scratch.resize(count);
+		for (int digit = 0; digit < 8; ++digit) {
+			size_t* histogram = histograms[digit];
+			if (histogram[(entries.empty() ? 0 : entries[0].Key >> (8 * digit)) & 0xFF] == count)
+				continue;	// every key has this digit, the order stays as it is
+
+			size_t offset = 0;
+			for (int bucket = 0; bucket < 256; ++bucket) {
+				size_t bucketCount = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketCount;
+			}
+			for (const Entry& entry : entries)
+				scratch[histogram[(entry.Key >> (8 * digit)) & 0xFF]++] = entry;
+			entries.swap(scratch);
+		}
+	}
+
+	size_t Count() const { return entries.size(); }
+	uint64_t Key(size_t i) const { return entries[i].Key; }
+	// the command at position i of the sorted order
+	const RenderCommand& operator[](size_t i) const { return commands[entries[i].Command]; }
+
+private:
+	struct Entry
+	{
+		uint64_t Key;
+		uint32_t Command;	// index into commands, which stay in recording order
+	};
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+	std::vector<RenderCommand> commands;
+};
+#endif
@@ -0,0 +1,143 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Maps a C++ uniform value type to the GL types it may be bound to
+template <typename T> struct UniformType;
+template <> struct UniformType<int> { static bool Accepts(GLenum type) { return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY; } };
+template <> struct UniformType<float> { static bool Accepts(GLenum type) { return type == GL_FLOAT; } };
+template <> struct UniformType<glm::vec3> { static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC3; } };
+template <> struct UniformType<glm::vec4> { static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC4; } };
+template <> struct UniformType<glm::mat3> { static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT3; } };
+template <> struct UniformType<glm::mat4> { static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT4; } };
+
+// Typed handle to one reflected uniform of a ShaderProgram (index -1 means "not present", and setting it is a no-op like location -1)
+template <typename T>
+struct Uniform
+{
+	int Index = -1;
+};
+
+// A linked shader program whose active uniforms are enumerated once at link time.
+// Every uniform keeps a shadow copy of its current value so unchanged values are never re-uploaded.
+class ShaderProgram
+{
+public:
+	GLuint Id = 0;
+	// upload statistics, useful to see how many driver calls the shadow copies avoid
+	unsigned int UploadCount = 0;
+	unsigned int SkippedCount = 0;
+
+	// enumerates GL_ACTIVE_UNIFORMS of the linked program and allocates their shadow storage
+	void Reflect(GLuint programId)
+	{
+		Id = programId;
+		uniforms.clear();
+		shadow.clear();
+
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(Id, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(Id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<char> name(maxLength + 1);
+		for (GLint i = 0; i < count; ++i) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(Id, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+
+			ReflectedUniform uniform;
+			uniform.Name.assign(name.data(), length);
+			uniform.Location = glGetUniformLocation(Id, uniform.Name.c_str());
+			// members of uniform blocks have no location and are not set through glUniform*
+			if (uniform.Location < 0)
+				continue;
+
+			// arrays are reported as "name[0]"; only their first element is shadowed
+			size_t bracket = uniform.Name.find('[');
+			if (bracket != std::string::npos)
+				uniform.Name.erase(bracket);
+
+			uniform.Type = type;
+			uniform.Offset = shadow.size();
+			uniform.Size = byteSize(type);
+			uniform.Valid = false;
+			shadow.resize(shadow.size() + uniform.Size);
+			uniforms.push_back(uniform);
+		}
+	}
+
+	// resolves a typed handle by name; returns an empty handle if the uniform is missing or has another type
+	template <typename T>
+	Uniform<T> GetUniform(const char* name) const
+	{
+		Uniform<T> handle;
+		for (size_t i = 0; i < uniforms.size(); ++i) {
+			if (uniforms[i].Name == name && UniformType<T>::Accepts(uniforms[i].Type)) {
+				handle.Index = static_cast<int>(i);
+				break;
+			}
+		}
+		return handle;
+	}
+
+	// uploads the value only when it differs from the shadow copy (uses glProgramUniform*, no bind required)
+	template <typename T>
+	void Set(Uniform<T> handle, const T& value)
+	{
+		if (handle.Index < 0)
+			return;
+
+		ReflectedUniform& uniform = uniforms[handle.Index];
+		unsigned char* current = shadow.data() + uniform.Offset;
+		if (uniform.Valid && std::memcmp(current, &value, sizeof(T)) == 0) {
+			++SkippedCount;
+			return;
+		}
+
+		std::memcpy(current, &value, sizeof(T));
+		uniform.Valid = true;
+		upload(uniform.Location, value);
+		++UploadCount;
+	}
+
+private:
+	struct ReflectedUniform
+	{
+		std::string Name;
+		GLint Location;
+		GLenum Type;
+		size_t Offset;	// byte offset of the shadow copy
+		size_t Size;	// byte size of the shadow copy
+		bool Valid;		// false until the first upload, GL's initial value is not tracked
+	};
+
+	std::vector<ReflectedUniform> uniforms;
+	std::vector<unsigned char> shadow;
+
+	static size_t byteSize(GLenum type)
+	{
+		switch (type) {
+		case GL_FLOAT_VEC2: return sizeof(float) * 2;
+		case GL_FLOAT_VEC3: return sizeof(float) * 3;
+		case GL_FLOAT_VEC4: return sizeof(float) * 4;
+		case GL_FLOAT_MAT3: return sizeof(float) * 9;
+		case GL_FLOAT_MAT4: return sizeof(float) * 16;
+		default: return sizeof(GLint); // float, int, bool and samplers
+		}
+	}
+
+	void upload(GLint location, int value) { glProgramUniform1i(Id, location, value); }
+	void upload(GLint location, float value) { glProgramUniform1f(Id, location, value); }
+	void upload(GLint location, const glm::vec3& value) { glProgramUniform3fv(Id, location, 1, glm::value_ptr(value)); }
+	void upload(GLint location, const glm::vec4& value) { glProgramUniform4fv(Id, location, 1, glm::value_ptr(value)); }
+	void upload(GLint location, const glm::mat3& value) { glProgramUniformMatrix3fv(Id, location, 1, GL_FALSE, glm::value_ptr(value)); }
+	void upload(GLint location, const glm::mat4& value) { glProgramUniformMatrix4fv(Id, location, 1, GL_FALSE, glm::value_ptr(value)); }
+};
+#endif
@@ -0,0 +1,249 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "file_watcher.h"
+#include "program_cache.h"
+
+// reads a whole GLSL file; false when it cannot be read. A line #include "name" is replaced by the file name
+// next to it (e.g. the camera block every shader shares), one level deep; edits to an included file are picked
+// up the next time a shader that includes it is rebuilt.
+inline bool LoadShaderSource(const std::string& path, std::string& source)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	const std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	std::ostringstream text;
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t open = line.find('"');
+		size_t close = line.find('"', open + 1);
+		if (line.compare(0, 8, "#include") != 0 || open == std::string::npos || close == std::string::npos) {
+			text << line << '\n';
+			continue;
+		}
+		std::ifstream included(directory + line.substr(open + 1, close - open - 1), std::ios::binary);
+		if (!included)
+			return false;
+		text << included.rdbuf() << '\n';
+	}
+	source = text.str();
+	return !in.bad();
+}
+
+// Rebuilds shader programs whose GLSL files change, without stalling the render loop. A background thread
+// watches the files, then compiles and links on its own context (a hidden window sharing objects with the
+// render context) and fences the result; the render thread only picks up programs whose fence has signaled,
+// between frames, and swaps them in. A failed build reports its log and never replaces the running program.
+class ShaderReloader
+{
+public:
+	struct Result
+	{
+		int Program = -1;		// index returned by Watch()
+		GLuint ProgramId = 0;	// 0 when the build failed
+		std::string Log;		// compile or link errors
+		double BuildMs = 0.0;
+	};
+
+	ShaderReloader() {}
+	~ShaderReloader() { Stop(); }
+
+	ShaderReloader(const ShaderReloader&) = delete;
+	ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+	// registers a program by its files, before Start(); returns its index
+	int Watch(const std::string& vertexPath, const std::string& fragmentPath)
+	{
+		programs.push_back(Files{ vertexPath, fragmentPath });
+		return static_cast<int>(programs.size() - 1);
+	}
+
+	// context must share objects with the render context and be current on no thread; rebuilt binaries
+	// are saved to cache when useCache is set
+	bool Start(GLFWwindow* context, const ProgramCache& cache, bool useCache)
+	{
+		for (const Files& files : programs) {
+			if (!watcher.Add(files.Vertex) || !watcher.Add(files.Fragment))
+				return false;
+		}
+		this->context = context;
+		this->cache.reset(new ProgramCache(cache));
+		this->useCache = useCache;
+		stopping = false;
+		worker = std::thread(&ShaderReloader::run, this);
+		return true;
+	}
+
+	// render thread: the next rebuild whose GL work has completed, if any
+	bool TakeResult(Result& result)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (finished.empty())
+			return false;
+		Build& build = finished.front();
+		if (build.Fence != 0) {
+			if (glClientWaitSync(build.Fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				return false;
+			glDeleteSync(build.Fence);
+		}
+		result = build.Result;
+		finished.pop_front();
+		return true;
+	}
+
+	// render thread (deletes programs nobody picked up)
+	void Stop()
+	{
+		if (!worker.joinable())
+			return;
+		stopping = true;
+		worker.join();
+		for (Build& build : finished) {
+			if (build.Fence != 0)
+				glDeleteSync(build.Fence);
+			glDeleteProgram(build.Result.ProgramId);
+		}
+		finished.clear();
+		watcher.Close();
+	}
+
+private:
+	struct Files
+	{
+		std::string Vertex;
+		std::string Fragment;
+	};
+
+	struct Build
+	{
+		ShaderReloader::Result Result;
+		GLsync Fence = 0;
+	};
+
+	std::vector<Files> programs;
+	FileWatcher watcher;
+	GLFWwindow* context = nullptr;
+	std::unique_ptr<ProgramCache> cache;
+	bool useCache = false;
+	std::thread worker;
+	std::atomic<bool> stopping{ false };
+	std::mutex mutex;
+	std::deque<Build> finished;
+
+	void run()
+	{
+		glfwMakeContextCurrent(context);
+		while (!stopping) {
+			std::vector<std::string> changed = watcher.Wait(100);
+			if (changed.empty())
+				continue;
+
+			// editors may write a file in several steps, give them a moment and collect the rest
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			for (const std::string& path : watcher.Wait(0))
+				if (std::find(changed.begin(), changed.end(), path) == changed.end())
+					changed.push_back(path);
+
+			for (size_t i = 0; i < programs.size(); ++i) {
+				const Files& files = programs[i];
+				if (std::find(changed.begin(), changed.end(), files.Vertex) != changed.end()
+					|| std::find(changed.begin(), changed.end(), files.Fragment) != changed.end()) {
+					Build build = rebuild(static_cast<int>(i));
+					std::lock_guard<std::mutex> lock(mutex);
+					finished.push_back(build);
+				}
+			}
+		}
+		glfwMakeContextCurrent(NULL);
+	}
+
+	// compiles and links one program on the background context (blocking here is fine, nobody renders on it)
+	Build rebuild(int index)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Build build;
+		build.Result.Program = index;
+		const Files& files = programs[index];
+
+		std::string sources[2];
+		if (!LoadShaderSource(files.Vertex, sources[0]) || !LoadShaderSource(files.Fragment, sources[1])) {
+			build.Result.Log = "cannot read " + files.Vertex + " or " + files.Fragment;
+			return build;
+		}
+
+		const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		const char* const stageSources[] = { sources[0].c_str(), sources[1].c_str() };
+		GLuint programId = glCreateProgram();
+		if (useCache)
+			glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		GLuint shaderIds[2];
+		bool compiled = true;
+		for (int stage = 0; stage < 2; ++stage) {
+			shaderIds[stage] = glCreateShader(stages[stage]);
+			glShaderSource(shaderIds[stage], 1, &stageSources[stage], NULL);
+			glCompileShader(shaderIds[stage]);
+			GLint status = GL_FALSE;
+			glGetShaderiv(shaderIds[stage], GL_COMPILE_STATUS, &status);
+			if (!status) {
+				build.Result.Log += (stage == 0 ? files.Vertex : files.Fragment) + ":\n" + infoLog(shaderIds[stage], false);
+				compiled = false;
+			}
+			glAttachShader(programId, shaderIds[stage]);
+		}
+
+		GLint linked = GL_FALSE;
+		if (compiled) {
+			glLinkProgram(programId);
+			glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+			if (!linked)
+				build.Result.Log += "link:\n" + infoLog(programId, true);
+		}
+		for (int stage = 0; stage < 2; ++stage)
+			glDeleteShader(shaderIds[stage]);
+
+		if (!linked) {
+			glDeleteProgram(programId);
+			return build;
+		}
+		if (useCache)
+			cache->Save(cache->Key(stageSources, 2), programId);
+
+		// the render context may only use the program once this context's commands have completed
+		build.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		build.Result.ProgramId = programId;
+		build.Result.BuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return build;
+	}
+
+	static std::string infoLog(GLuint id, bool program)
+	{
+		GLint length = 0;
+		if (program)
+			glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+		else
+			glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+		std::string log(std::max(length, 1), '\0');
+		if (program)
+			glGetProgramInfoLog(id, length, NULL, &log[0]);
+		else
+			glGetShaderInfoLog(id, length, NULL, &log[0]);
+		log.resize(std::strlen(log.c_str()));
+		return log;
+	}
+};
+#endif
@@ -0,0 +1,165 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "content_hash.h"
+#include "image_kernels.h"
+#include "mapped_file.h"
+#include "mip_cache.h"
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+#include "worker_pool.h"
+
+// Offset alignment of each image in the destination, so two workers never write the same cache line
+const size_t TEXTURE_LOADER_ALIGNMENT = 64;
+
+// Decodes a set of images on worker threads straight into caller-provided memory (the mip chains that
+// TextureResidency streams from when the .mips files cannot be used). Open() only reads the image headers, so the caller knows
+// the sizes and can allocate the destination before any pixel is decoded; Decode() then writes the full
+// RGBA mip chain of every image, bottom row first, the layout OpenGL expects. Mip chains are built once
+// and kept in a .mips file next to the image, so later loads skip both decoding and filtering.
+class TextureLoader
+{
+public:
+	struct Image
+	{
+		std::string Filename;
+		int Width = 0;
+		int Height = 0;
+		int Channels = 0;		// channels in the file (1-4); the destination always holds RGBA
+		uint32_t Levels = 0;	// mip levels down to 1x1
+		size_t Offset = 0;		// byte offset of the chain in the destination, levels at MipChainOffset()
+		size_t Bytes = 0;
+		bool FromCache = false;	// set by Decode() when the chain came from the .mips file
+	};
+
+	// threads == 0 uses one worker per hardware thread
+	explicit TextureLoader(unsigned int threads = 0, bool useMipCache = true) : useMipCache(useMipCache)
+	{
+		threadCount = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	bool Open(const char* const filenames[], int count)
+	{
+		error.clear();
+		images.assign(count, Image());
+		totalBytes = 0;
+		for (int i = 0; i < count; ++i) {
+			Image& image = images[i];
+			image.Filename = filenames[i];
+			if (!stbi_info(filenames[i], &image.Width, &image.Height, &image.Channels))
+				return fail("Failed to load texture " + image.Filename);
+			image.Levels = MipLevelCount(image.Width, image.Height);
+			image.Offset = totalBytes;
+			image.Bytes = MipChainOffset(image.Width, image.Height, image.Levels);
+			totalBytes = align(totalBytes + image.Bytes);
+		}
+		return true;
+	}
+
+	const std::vector<Image>& Images() const { return images; }
+	size_t TotalBytes() const { return totalBytes; }
+	unsigned int ThreadCount() const { return threadCount; }
+	const std::string& Error() const { return error; }
+
+	// the .mips file kept for an image
+	static std::string MipCachePath(const std::string& filename) { return filename + ".mips"; }
+
+	// writes every mip chain to destination + Image::Offset, from the .mips file when it is current,
+	// otherwise by decoding the image (flipped and expanded to RGBA) and filtering it down
+	bool Decode(unsigned char* destination)
+	{
+		std::atomic<size_t> next(0);
+		std::atomic<bool> failed(false);
+		std::vector<std::string> errors(images.size());
+
+		unsigned int workers = std::min(threadCount, static_cast<unsigned int>(images.size()));
+		ParallelFor(workers, [&](unsigned int) {
+			for (size_t i = next++; i < images.size(); i = next++) {
+				if (!decode(images[i], destination + images[i].Offset, errors[i]))
+					failed = true;
+			}
+		});
+
+		if (!failed)
+			return true;
+		for (const std::string& message : errors)
+			if (!message.empty())
+				return fail(message);
+		return false;
+	}
+
+private:
+	unsigned int threadCount;
+	bool useMipCache;
+	std::vector<Image> images;
+	size_t totalBytes = 0;
+	std::string error;
+
+	bool fail(const std::string& message)
+	{
+		error = message;
+		return false;
+	}
+
+	static size_t align(size_t offset)
+	{
+		return (offset + TEXTURE_LOADER_ALIGNMENT - 1) / TEXTURE_LOADER_ALIGNMENT * TEXTURE_LOADER_ALIGNMENT;
+	}
+
+	bool decode(Image& image, unsigned char* destination, std::string& error) const
+	{
+		MappedFile source;
+		if (!source.Open(image.Filename.c_str())) {
+			error = "Failed to load texture " + image.Filename;
+			return false;
+		}
+		const uint64_t sourceHash = HashBytes(source.Data(), source.Size());
+		const std::string cachePath = MipCachePath(image.Filename);
+		if (useMipCache) {
+			MipCache cache;
+			if (cache.Open(cachePath, sourceHash, image.Width, image.Height)) {
+				std::memcpy(destination, cache.Data(), image.Bytes);
+				image.FromCache = true;
+				return true;
+			}
+		}
+
+		int width, height, channels;
+		unsigned char* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(source.Data()), static_cast<int>(source.Size()), &width, &height, &channels, 0);
+		if (!pixels) {
+			error = "Failed to load texture " + image.Filename;
+			return false;
+		}
+		// the file changed between Open() and Decode()
+		if (width != image.Width || height != image.Height || channels != image.Channels) {
+			stbi_image_free(pixels);
+			error = "Texture " + image.Filename + " changed while loading";
+			return false;
+		}
+
+		// Images are loaded with Y axis going down, but OpenGL's Y axis goes up. The chain is built in
+		// ordinary memory because the filter reads it back, which is slow from a mapped GL buffer
+		std::vector<unsigned char> chain(image.Bytes);
+		const ImageKernels& kernels = GetImageKernels();
+		const size_t sourceRowBytes = static_cast<size_t>(width) * channels;
+		const size_t rowBytes = static_cast<size_t>(width) * 4;
+		for (int row = 0; row < height; ++row)
+			kernels.ExpandToRgba(pixels + row * sourceRowBytes, channels, chain.data() + (height - 1 - row) * rowBytes, width);
+		stbi_image_free(pixels);
+
+		BuildMipChain(chain.data(), width, height);
+		std::memcpy(destination, chain.data(), image.Bytes);
+
+		// a cache that cannot be written only costs the next start its decode
+		if (useMipCache)
+			MipCache::Write(cachePath, sourceHash, width, height, chain.data());
+		return true;
+	}
+};
+#endif
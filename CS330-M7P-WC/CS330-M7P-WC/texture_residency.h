@@ -0,0 +1,589 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+#include <GL/glew.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "block_compressor.h"
+#include "ktx_texture.h"
+#include "mip_cache.h"
+#include "texture_loader.h"
+
+// Mip levels whose larger side is at most this many texels form a texture's tail: uploaded when the
+// texture is added and never evicted, so every texture can be drawn from its first frame
+const uint32_t TEXTURE_RESIDENCY_TAIL_SIZE = 64;
+// Frames GL_TEXTURE_MIN_LOD takes to blend a newly streamed level in, so it does not pop
+const int TEXTURE_RESIDENCY_FADE_FRAMES = 8;
+// Levels being streamed at once; each one holds a staging buffer until it is uploaded
+const int TEXTURE_RESIDENCY_MAX_STREAMS = 2;
+
+// Where the levels of a streamed texture array come from. CopyLevel() runs on the streaming thread,
+// so a source must only read data that does not change after it is opened
+class TextureSource
+{
+public:
+	virtual ~TextureSource() {}
+
+	virtual uint32_t Width() const = 0;
+	virtual uint32_t Height() const = 0;
+	virtual uint32_t Layers() const = 0;
+	virtual uint32_t LevelCount() const = 0;
+	virtual GLenum InternalFormat() const = 0;
+	virtual bool Compressed() const = 0;
+
+	// bytes of one layer of a level
+	virtual size_t LevelBytes(uint32_t level) const = 0;
+	// writes one layer of a level, laid out the way glTexSubImage3D/glCompressedTexSubImage3D read it
+	virtual void CopyLevel(uint32_t level, uint32_t layer, unsigned char* destination) const = 0;
+};
+
+// RGBA8 mip chains, mapped straight from the .mips files when every layer has a current one; otherwise
+// the images are decoded once with TextureLoader, which writes the .mips files, and those are mapped
+// instead. The decoded chains only stay in memory when the .mips files cannot be written: unlike a
+// whole-texture load they cannot go straight into a pixel-unpack buffer, because the finer levels are
+// uploaded only when they stream in, possibly many frames later or never
+class MipChainTextureSource : public TextureSource
+{
+public:
+	bool Open(const char* const filenames[], int layers, bool useMipCache)
+	{
+		error.clear();
+		caches.clear();
+		chains.clear();
+		layerData.clear();
+		fromCache = false;
+
+		TextureLoader loader(0, useMipCache);
+		if (!loader.Open(filenames, layers))
+			return fail(loader.Error());
+		const std::vector<TextureLoader::Image>& images = loader.Images();
+		width = images[0].Width;
+		height = images[0].Height;
+		levels = images[0].Levels;
+		for (const TextureLoader::Image& image : images) {
+			if (static_cast<uint32_t>(image.Width) != width || static_cast<uint32_t>(image.Height) != height)
+				return fail("Texture " + image.Filename + " is " + std::to_string(image.Width) + "x" + std::to_string(image.Height)
+					+ ", the texture array is " + std::to_string(width) + "x" + std::to_string(height));
+		}
+
+		if (useMipCache && mapCaches(images)) {
+			fromCache = true;
+			return true;
+		}
+
+		chains.resize(loader.TotalBytes());
+		if (!loader.Decode(chains.data()))
+			return fail(loader.Error());
+		// the chains were just written out, so map them like a cached start and let the heap copy go
+		if (useMipCache && mapCaches(images)) {
+			std::vector<unsigned char>().swap(chains);
+			return true;
+		}
+		for (const TextureLoader::Image& image : images)
+			layerData.push_back(chains.data() + image.Offset);
+		return true;
+	}
+
+	bool FromCache() const { return fromCache; }
+	const std::string& Error() const { return error; }
+
+	uint32_t Width() const override { return width; }
+	uint32_t Height() const override { return height; }
+	uint32_t Layers() const override { return static_cast<uint32_t>(layerData.size()); }
+	uint32_t LevelCount() const override { return levels; }
+	GLenum InternalFormat() const override { return GL_RGBA8; }
+	bool Compressed() const override { return false; }
+
+	size_t LevelBytes(uint32_t level) const override
+	{
+		return static_cast<size_t>(MipLevelWidth(width, level)) * MipLevelHeight(height, level) * 4;
+	}
+
+	void CopyLevel(uint32_t level, uint32_t layer, unsigned char* destination) const override
+	{
+		std::memcpy(destination, layerData[layer] + MipChainOffset(width, height, level), LevelBytes(level));
+	}
+
+private:
+	std::vector<std::unique_ptr<MipCache>> caches;
+	std::vector<unsigned char> chains;				// decoded chains when the caches could not be used
+	std::vector<const unsigned char*> layerData;	// level 0 of each layer's chain
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t levels = 0;
+	bool fromCache = false;
+	std::string error;
+
+	bool fail(const std::string& message)
+	{
+		error = message;
+		return false;
+	}
+
+	// Only hashing the sources is needed when the caches are current, the chains are paged in as levels stream
+	bool mapCaches(const std::vector<TextureLoader::Image>& images)
+	{
+		for (const TextureLoader::Image& image : images) {
+			MappedFile file;
+			if (!file.Open(image.Filename.c_str()))
+				break;
+			std::unique_ptr<MipCache> cache(new MipCache());
+			if (!cache->Open(TextureLoader::MipCachePath(image.Filename), HashBytes(file.Data(), file.Size()), width, height))
+				break;
+			caches.push_back(std::move(cache));
+		}
+		if (caches.size() != images.size()) {
+			caches.clear();
+			return false;
+		}
+		for (const std::unique_ptr<MipCache>& cache : caches)
+			layerData.push_back(cache->Data());
+		return true;
+	}
+};
+
+// Block-compressed levels mapped from the .ktx2 files written by --encode-ktx2. BC1 and BC3 layers can
+// share the array as BC3, the BC1 blocks getting an opaque alpha block as they are copied
+class Ktx2TextureSource : public TextureSource
+{
+public:
+	// false with an empty Error() when none of the images has a .ktx2 file
+	bool Open(const char* const filenames[], int layers)
+	{
+		error.clear();
+		textures.clear();
+		int found = 0;
+		for (int layer = 0; layer < layers; ++layer) {
+			textures.emplace_back(new Ktx2Texture());
+			if (textures.back()->Open(Ktx2PathFor(filenames[layer])))
+				++found;
+			else if (error.empty())
+				error = textures.back()->Error();
+		}
+		if (found == 0) {
+			error.clear();
+			return false;
+		}
+		if (found == layers) {
+			for (const std::unique_ptr<Ktx2Texture>& texture : textures)
+				if (texture->Width() != textures[0]->Width() || texture->Height() != textures[0]->Height() || texture->LevelCount() != textures[0]->LevelCount())
+					error = "the .ktx2 files differ in size or mip count";
+		}
+		if (!error.empty())
+			return false;
+
+		bool alpha = false;
+		for (const std::unique_ptr<Ktx2Texture>& texture : textures)
+			alpha = alpha || texture->Format() == KTX2_FORMAT_BC3_UNORM;
+		format = alpha ? KTX2_FORMAT_BC3_UNORM : KTX2_FORMAT_BC1_RGB_UNORM;
+		return true;
+	}
+
+	bool HasAlpha() const { return format == KTX2_FORMAT_BC3_UNORM; }
+	const std::string& Error() const { return error; }
+
+	uint32_t Width() const override { return textures[0]->Width(); }
+	uint32_t Height() const override { return textures[0]->Height(); }
+	uint32_t Layers() const override { return static_cast<uint32_t>(textures.size()); }
+	uint32_t LevelCount() const override { return textures[0]->LevelCount(); }
+	GLenum InternalFormat() const override { return HasAlpha() ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT; }
+	bool Compressed() const override { return true; }
+
+	size_t LevelBytes(uint32_t level) const override
+	{
+		return static_cast<size_t>(Ktx2Texture::LevelBytes(format, textures[0]->LevelWidth(level), textures[0]->LevelHeight(level)));
+	}
+
+	void CopyLevel(uint32_t level, uint32_t layer, unsigned char* destination) const override
+	{
+		const Ktx2Texture& texture = *textures[layer];
+		if (texture.Format() != format)
+			BlockCompressor::PromoteBc1ToBc3(texture.LevelData(level), LevelBytes(level) / BlockCompressor::BC3_BLOCK_BYTES, destination);
+		else
+			std::memcpy(destination, texture.LevelData(level), LevelBytes(level));
+	}
+
+private:
+	std::vector<std::unique_ptr<Ktx2Texture>> textures;
+	uint32_t format = KTX2_FORMAT_BC1_RGB_UNORM;
+	std::string error;
+};
+
+// Keeps the mip levels of texture arrays resident in video memory only while they are needed. A texture
+// starts with just its tail; every frame the renderer reports how large each texture appears on screen,
+// and Update() streams finer levels in (copied into a staging buffer on a background thread) and, when
+// that would exceed the budget, drops the finest levels of the least recently used textures. The GL texture
+// only ever allocates the levels it holds, so changing them reallocates it and copies the kept levels on the
+// GPU. A level still in flight is allocated but hidden with GL_TEXTURE_BASE_LEVEL, and once it arrives
+// GL_TEXTURE_MIN_LOD blends it in. Everything except the streaming thread runs on the GL thread.
+class TextureResidency
+{
+public:
+	typedef int Handle;
+
+	explicit TextureResidency(size_t budgetBytes) : budgetBytes(budgetBytes) {}
+	~TextureResidency() { stopWorker(); }
+
+	TextureResidency(const TextureResidency&) = delete;
+	TextureResidency& operator=(const TextureResidency&) = delete;
+
+	void SetBudget(size_t bytes) { budgetBytes = bytes; }
+	size_t Budget() const { return budgetBytes; }
+	size_t ResidentBytes() const { return residentBytes; }
+	size_t PeakBytes() const { return peakBytes; }
+	int StreamedLevels() const { return streamedLevels; }
+	int EvictedLevels() const { return evictedLevels; }
+
+	// uploads the tail of the texture right away; the rest streams in as Request() asks for it
+	Handle Add(std::unique_ptr<TextureSource> source)
+	{
+		Entry entry;
+		entry.Source = std::move(source);
+		const TextureSource& textureSource = *entry.Source;
+		while (entry.TailLevel + 1 < textureSource.LevelCount()
+			&& std::max(MipLevelWidth(textureSource.Width(), entry.TailLevel), MipLevelHeight(textureSource.Height(), entry.TailLevel)) > TEXTURE_RESIDENCY_TAIL_SIZE)
+			++entry.TailLevel;
+		entry.AllocatedLevel = textureSource.LevelCount();
+		entry.VisibleLevel = entry.TailLevel;
+		entry.WantedLevel = entry.TailLevel;
+		entry.Lod = static_cast<float>(entry.TailLevel);
+
+		const size_t tailBytes = allocationBytes(entry, entry.TailLevel);
+		makeRoom(tailBytes, nullptr);
+		reallocate(entry, entry.TailLevel);
+
+		// The tail is copied straight into a mapped pixel-unpack buffer, client memory only if mapping fails
+		GLuint staging = 0;
+		unsigned char* pixels = mapStaging(tailBytes, staging);
+		std::vector<unsigned char> fallback;
+		if (pixels == nullptr) {
+			fallback.resize(tailBytes);
+			pixels = fallback.data();
+		}
+		size_t offset = 0;
+		for (uint32_t level = entry.TailLevel; level < textureSource.LevelCount(); ++level) {
+			for (uint32_t layer = 0; layer < textureSource.Layers(); ++layer)
+				textureSource.CopyLevel(level, layer, pixels + offset + layer * textureSource.LevelBytes(level));
+			offset += textureSource.LevelBytes(level) * textureSource.Layers();
+		}
+		const unsigned char* data = staging != 0 ? nullptr : pixels;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+		for (uint32_t level = entry.TailLevel; level < textureSource.LevelCount(); ++level) {
+			upload(entry, level, data);
+			data += textureSource.LevelBytes(level) * textureSource.Layers();
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (staging != 0)
+			deleteStaging(staging);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		entries.push_back(std::move(entry));
+		if (!worker.joinable())
+			worker = std::thread(&TextureResidency::run, this);
+		return static_cast<Handle>(entries.size() - 1);
+	}
+
+	// current GL texture; it changes whenever levels are streamed in or evicted, so bind it every frame
+	GLuint TextureId(Handle handle) const { return entries[handle].Texture; }
+
+	// finest level that is resident and visible
+	uint32_t VisibleLevel(Handle handle) const { return entries[handle].VisibleLevel; }
+
+	// records that the texture is drawn this frame covering about `pixels` screen pixels along its larger side
+	void Request(Handle handle, float pixels)
+	{
+		Entry& entry = entries[handle];
+		const float size = static_cast<float>(std::max(entry.Source->Width(), entry.Source->Height()));
+		uint32_t level = 0;
+		if (pixels > 0.0f && pixels < size)
+			level = static_cast<uint32_t>(std::floor(std::log2(size / pixels)));
+		entry.WantedLevel = std::min(entry.WantedLevel, std::min(level, entry.TailLevel));
+		entry.LastUsed = frame;
+	}
+
+	// once per frame, after the frame's requests: uploads finished levels, blends them in, and starts new streams
+	void Update()
+	{
+		int streaming = 0;
+		for (Entry& entry : entries) {
+			if (entry.Job && entry.Job->Done.load(std::memory_order_acquire))
+				finishStream(entry);
+			if (entry.Job)
+				++streaming;
+
+			if (entry.Lod > entry.VisibleLevel) {
+				entry.Lod = std::max(static_cast<float>(entry.VisibleLevel), entry.Lod - 1.0f / TEXTURE_RESIDENCY_FADE_FRAMES);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, entry.Texture);
+				glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_LOD, entry.Lod - entry.VisibleLevel);
+			}
+		}
+
+		// The textures furthest below the detail they are drawn at go first
+		std::vector<Entry*> candidates;
+		for (Entry& entry : entries)
+			if (!entry.Job && entry.WantedLevel < entry.AllocatedLevel)
+				candidates.push_back(&entry);
+		std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+			return a->AllocatedLevel - a->WantedLevel > b->AllocatedLevel - b->WantedLevel;
+		});
+		for (Entry* entry : candidates) {
+			if (streaming >= TEXTURE_RESIDENCY_MAX_STREAMS)
+				break;
+			if (startStream(*entry))
+				++streaming;
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		for (Entry& entry : entries)
+			entry.WantedLevel = entry.TailLevel;
+		++frame;
+	}
+
+	// stops streaming and deletes every texture; needs the GL context, unlike the destructor
+	void Clear()
+	{
+		stopWorker();
+		for (Entry& entry : entries) {
+			if (entry.Job)
+				releaseStaging(entry);
+			glDeleteTextures(1, &entry.Texture);
+		}
+		entries.clear();
+		residentBytes = 0;
+	}
+
+private:
+	// one level being copied into a staging buffer by the streaming thread
+	struct StreamJob
+	{
+		const TextureSource* Source = nullptr;
+		uint32_t Level = 0;
+		unsigned char* Destination = nullptr;
+		std::atomic<bool> Done{ false };
+	};
+
+	struct Entry
+	{
+		std::unique_ptr<TextureSource> Source;
+		GLuint Texture = 0;
+		uint32_t TailLevel = 0;			// first level of the tail
+		uint32_t AllocatedLevel = 0;	// source level stored as level 0 of the GL texture
+		uint32_t VisibleLevel = 0;		// finest level with data, above AllocatedLevel while it streams
+		uint32_t WantedLevel = 0;		// finest level any draw asked for this frame
+		uint64_t LastUsed = 0;			// frame of the last Request()
+		float Lod = 0.0f;				// finest level sampled, fading down to VisibleLevel
+		GLuint StagingBuffer = 0;
+		std::shared_ptr<StreamJob> Job;
+	};
+
+	std::vector<Entry> entries;
+	size_t budgetBytes;
+	size_t residentBytes = 0;
+	size_t peakBytes = 0;
+	int streamedLevels = 0;
+	int evictedLevels = 0;
+	uint64_t frame = 1;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::shared_ptr<StreamJob>> queue;
+	bool stopping = false;
+
+	static size_t allocationBytes(const Entry& entry, uint32_t level)
+	{
+		size_t bytes = 0;
+		for (; level < entry.Source->LevelCount(); ++level)
+			bytes += entry.Source->LevelBytes(level) * entry.Source->Layers();
+		return bytes;
+	}
+
+	// replaces the GL texture with one holding the levels from `level` down, keeping the visible levels both have
+	void reallocate(Entry& entry, uint32_t level)
+	{
+		const TextureSource& source = *entry.Source;
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, source.LevelCount() - level, source.InternalFormat(),
+			MipLevelWidth(source.Width(), level), MipLevelHeight(source.Height(), level), source.Layers());
+
+		entry.VisibleLevel = std::max(entry.VisibleLevel, level);
+		entry.Lod = std::max(entry.Lod, static_cast<float>(entry.VisibleLevel));
+		if (entry.Texture != 0) {
+			for (uint32_t copy = entry.VisibleLevel; copy < source.LevelCount(); ++copy)
+				glCopyImageSubData(entry.Texture, GL_TEXTURE_2D_ARRAY, copy - entry.AllocatedLevel, 0, 0, 0,
+					texture, GL_TEXTURE_2D_ARRAY, copy - level, 0, 0, 0,
+					MipLevelWidth(source.Width(), copy), MipLevelHeight(source.Height(), copy), source.Layers());
+			glDeleteTextures(1, &entry.Texture);
+			residentBytes -= allocationBytes(entry, entry.AllocatedLevel);
+		}
+
+		// levels above the visible one have no data yet and must never be sampled
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, entry.VisibleLevel - level);
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_LOD, entry.Lod - entry.VisibleLevel);
+
+		entry.Texture = texture;
+		entry.AllocatedLevel = level;
+		residentBytes += allocationBytes(entry, level);
+		peakBytes = std::max(peakBytes, residentBytes);
+	}
+
+	// uploads every layer of a level to the bound texture; pixels is a buffer offset while a pixel-unpack buffer is bound
+	void upload(const Entry& entry, uint32_t level, const unsigned char* pixels)
+	{
+		const TextureSource& source = *entry.Source;
+		const GLsizei width = MipLevelWidth(source.Width(), level);
+		const GLsizei height = MipLevelHeight(source.Height(), level);
+		const size_t bytes = source.LevelBytes(level);
+		for (uint32_t layer = 0; layer < source.Layers(); ++layer) {
+			const void* data = pixels + layer * bytes;
+			if (source.Compressed())
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level - entry.AllocatedLevel, 0, 0, layer, width, height, 1, source.InternalFormat(), static_cast<GLsizei>(bytes), data);
+			else
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level - entry.AllocatedLevel, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		}
+	}
+
+	// evicts the finest levels of other textures, least recently used first, until `bytes` more fit the budget
+	bool makeRoom(size_t bytes, const Entry* keep)
+	{
+		while (residentBytes + bytes > budgetBytes) {
+			Entry* victim = nullptr;
+			for (Entry& entry : entries) {
+				if (&entry == keep || entry.Job || entry.AllocatedLevel >= entry.TailLevel)
+					continue;
+				// a texture drawn this frame only gives up levels finer than it was drawn at
+				if (entry.LastUsed == frame && entry.AllocatedLevel >= entry.WantedLevel)
+					continue;
+				if (victim == nullptr || entry.LastUsed < victim->LastUsed)
+					victim = &entry;
+			}
+			if (victim == nullptr)
+				return false;
+			reallocate(*victim, victim->AllocatedLevel + 1);
+			++evictedLevels;
+		}
+		return true;
+	}
+
+	// allocates the next finer level hidden behind the base level and hands its copy to the streaming thread
+	bool startStream(Entry& entry)
+	{
+		const uint32_t level = entry.AllocatedLevel - 1;
+		const size_t growth = allocationBytes(entry, level) - allocationBytes(entry, entry.AllocatedLevel);
+		if (!makeRoom(growth, &entry))
+			return false;
+		reallocate(entry, level);
+
+		unsigned char* staging = mapStaging(entry.Source->LevelBytes(level) * entry.Source->Layers(), entry.StagingBuffer);
+		if (staging == nullptr)
+			return false;
+
+		entry.Job = std::make_shared<StreamJob>();
+		entry.Job->Source = entry.Source.get();
+		entry.Job->Level = level;
+		entry.Job->Destination = staging;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(entry.Job);
+		}
+		wake.notify_one();
+		return true;
+	}
+
+	// uploads a level the streaming thread has finished and makes it visible
+	void finishStream(Entry& entry)
+	{
+		const uint32_t level = entry.Job->Level;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, entry.Texture);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.StagingBuffer);
+		upload(entry, level, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		// GL keeps the staging buffer alive until the upload has consumed it
+		releaseStaging(entry);
+
+		entry.VisibleLevel = level;
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, entry.VisibleLevel - entry.AllocatedLevel);
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_LOD, entry.Lod - entry.VisibleLevel);
+		++streamedLevels;
+	}
+
+	void releaseStaging(Entry& entry)
+	{
+		deleteStaging(entry.StagingBuffer);
+		entry.Job.reset();
+	}
+
+	// creates a persistently mapped pixel-unpack buffer; nullptr (and no buffer) when it cannot be mapped
+	static unsigned char* mapStaging(size_t bytes, GLuint& buffer)
+	{
+		const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, mapFlags);
+		unsigned char* data = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, mapFlags));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (data == nullptr)
+			deleteStaging(buffer);
+		return data;
+	}
+
+	// GL keeps a deleted buffer alive until the uploads reading it have consumed it
+	static void deleteStaging(GLuint& buffer)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+	// streaming thread: copies queued levels out of their sources (usually page faults on a mapped file)
+	void run()
+	{
+		for (;;) {
+			std::shared_ptr<StreamJob> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+				job = queue.front();
+				queue.pop_front();
+			}
+			const size_t bytes = job->Source->LevelBytes(job->Level);
+			for (uint32_t layer = 0; layer < job->Source->Layers(); ++layer)
+				job->Source->CopyLevel(job->Level, layer, job->Destination + layer * bytes);
+			job->Done.store(true, std::memory_order_release);
+		}
+	}
+
+	void stopWorker()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			queue.clear();
+		}
+		wake.notify_one();
+		worker.join();
+		stopping = false;
+	}
+};
+#endif
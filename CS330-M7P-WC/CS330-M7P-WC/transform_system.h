@@ -0,0 +1,374 @@
+#ifndef TRANSFORM_SYSTEM_H
+#define TRANSFORM_SYSTEM_H
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_SYSTEM_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define TRANSFORM_SYSTEM_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Four floats processed together: one lane per object of a batch. SSE2 and NEON are part of the baseline of
+// every target they are compiled for, so unlike the image kernels there is no runtime CPU check.
+namespace transform_lanes
+{
+#if defined(TRANSFORM_SYSTEM_SSE)
+	typedef __m128 Lanes;
+	inline Lanes Load(const float* p) { return _mm_loadu_ps(p); }
+	inline void Store(float* p, Lanes v) { _mm_storeu_ps(p, v); }
+	inline Lanes Splat(float v) { return _mm_set1_ps(v); }
+	inline Lanes Plus(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+	inline Lanes Minus(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+	inline Lanes Times(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+	inline Lanes Abs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+	inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+	// bit i set when lane i is below zero
+	inline int NegativeMask(Lanes a) { return _mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())); }
+	inline void Transpose(Lanes& a, Lanes& b, Lanes& c, Lanes& d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+	const char* const NAME = "sse2";
+#elif defined(TRANSFORM_SYSTEM_NEON)
+	typedef float32x4_t Lanes;
+	inline Lanes Load(const float* p) { return vld1q_f32(p); }
+	inline void Store(float* p, Lanes v) { vst1q_f32(p, v); }
+	inline Lanes Splat(float v) { return vdupq_n_f32(v); }
+	inline Lanes Plus(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+	inline Lanes Minus(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+	inline Lanes Times(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+	inline Lanes Abs(Lanes a) { return vabsq_f32(a); }
+	inline Lanes Min(Lanes a, Lanes b) { return vminq_f32(a, b); }
+	inline Lanes Max(Lanes a, Lanes b) { return vmaxq_f32(a, b); }
+	inline int NegativeMask(Lanes a)
+	{
+		uint32x4_t negative = vcltq_f32(a, vdupq_n_f32(0.0f));
+		return (vgetq_lane_u32(negative, 0) & 1) | (vgetq_lane_u32(negative, 1) & 2) | (vgetq_lane_u32(negative, 2) & 4) | (vgetq_lane_u32(negative, 3) & 8);
+	}
+	inline void Transpose(Lanes& a, Lanes& b, Lanes& c, Lanes& d)
+	{
+		float32x4x2_t ab = vtrnq_f32(a, b);
+		float32x4x2_t cd = vtrnq_f32(c, d);
+		a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+		b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+		c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+		d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+	}
+	const char* const NAME = "neon";
+#else
+	struct Lanes { float v[4]; };
+	inline Lanes Load(const float* p) { Lanes r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+	inline void Store(float* p, Lanes v) { std::memcpy(p, v.v, sizeof(v.v)); }
+	inline Lanes Splat(float v) { Lanes r = { { v, v, v, v } }; return r; }
+	inline Lanes Plus(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+	inline Lanes Minus(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+	inline Lanes Times(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+	inline Lanes Abs(Lanes a) { for (int i = 0; i < 4; ++i) a.v[i] = std::fabs(a.v[i]); return a; }
+	inline Lanes Min(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+	inline Lanes Max(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+	inline int NegativeMask(Lanes a) { int mask = 0; for (int i = 0; i < 4; ++i) mask |= a.v[i] < 0.0f ? 1 << i : 0; return mask; }
+	inline void Transpose(Lanes& a, Lanes& b, Lanes& c, Lanes& d)
+	{
+		Lanes rows[4] = { a, b, c, d };
+		for (int i = 0; i < 4; ++i) {
+			a.v[i] = rows[i].v[0];
+			b.v[i] = rows[i].v[1];
+			c.v[i] = rows[i].v[2];
+			d.v[i] = rows[i].v[3];
+		}
+	}
+	const char* const NAME = "scalar";
+#endif
+}
+
+// Half size of the box given to objects without bounds: large enough never to be culled, small enough to stay finite
+const float TRANSFORM_UNBOUNDED = 1.0e30f;
+
+// Per-object translation, rotation and scale kept in structure-of-arrays form, four objects per batch.
+// Update recomputes the world, normal and model-view-projection matrices of dirty batches only (every MVP
+// when the view-projection changes) and stores them as contiguous glm::mat4 arrays, ready to be set as
+// uniforms or uploaded as instance data. World-space bounds are transformed in the same pass and kept as SoA
+// arrays for the culling tests. The batches are independent, so an update can also be split across threads
+// (BeginUpdate, UpdateBatches on disjoint ranges, EndUpdate).
+class TransformSystem
+{
+public:
+	typedef int Handle;
+	static constexpr size_t BATCH = 4;
+
+	// adds an object with world matrix translate(position) * rotate(angle, axis) * scale(scale); angle in radians
+	Handle Add(const glm::vec3& position, float angle, const glm::vec3& axis, const glm::vec3& scale)
+	{
+		size_t index = count++;
+		if (index % BATCH == 0)
+			grow();
+		SetPosition(static_cast<Handle>(index), position);
+		SetRotation(static_cast<Handle>(index), angle, axis);
+		SetScale(static_cast<Handle>(index), scale);
+		return static_cast<Handle>(index);
+	}
+
+	void SetPosition(Handle handle, const glm::vec3& position)
+	{
+		for (int k = 0; k < 3; ++k)
+			this->position[k][handle] = position[k];
+		markDirty(handle);
+	}
+
+	// rotation of angle radians about axis (the same rotation glm::rotate builds)
+	void SetRotation(Handle handle, float angle, const glm::vec3& axis)
+	{
+		glm::vec3 unit = glm::normalize(axis) * std::sin(angle * 0.5f);
+		for (int k = 0; k < 3; ++k)
+			rotation[k][handle] = unit[k];
+		rotation[3][handle] = std::cos(angle * 0.5f);
+		markDirty(handle);
+	}
+
+	// a zero scale component collapses the object; its normal matrix keeps that axis at zero instead of dividing by it
+	void SetScale(Handle handle, const glm::vec3& scale)
+	{
+		for (int k = 0; k < 3; ++k) {
+			this->scale[k][handle] = scale[k];
+			inverseScale[k][handle] = scale[k] != 0.0f ? 1.0f / scale[k] : 0.0f;
+		}
+		markDirty(handle);
+	}
+
+	// model-space bounding sphere and axis-aligned box (center, half size) of the object; a radius of 0 means unknown
+	void SetBounds(Handle handle, const glm::vec3& center, float radius, const glm::vec3& extents)
+	{
+		bool known = radius > 0.0f;
+		for (int k = 0; k < 3; ++k) {
+			localCenter[k][handle] = known ? center[k] : 0.0f;
+			localExtent[k][handle] = known ? extents[k] : TRANSFORM_UNBOUNDED;
+		}
+		localRadius[handle] = known ? radius : TRANSFORM_UNBOUNDED;
+		markDirty(handle);
+	}
+
+	// recomputes the matrices of dirty objects and, when viewProjection differs from the last call, every MVP
+	void Update(const glm::mat4& viewProjection)
+	{
+		size_t worlds = 0;
+		size_t mvps = 0;
+		BeginUpdate(viewProjection);
+		UpdateBatches(0, Batches(), worlds, mvps);
+		EndUpdate(worlds, mvps);
+	}
+
+	// first step of an update: notes whether the camera moved since the last one
+	void BeginUpdate(const glm::mat4& viewProjection)
+	{
+		cameraMoved = !hasViewProjection || std::memcmp(&viewProjection, &lastViewProjection, sizeof(glm::mat4)) != 0;
+		lastViewProjection = viewProjection;
+		hasViewProjection = true;
+	}
+
+	// updates the batches [first, last), adding the objects whose world matrix / MVP were recomputed to the counts;
+	// safe to call from several threads at once on disjoint ranges
+	void UpdateBatches(size_t first, size_t last, size_t& worlds, size_t& mvps)
+	{
+		for (size_t batch = first; batch < last; ++batch) {
+			if (!dirty[batch] && !cameraMoved)
+				continue;
+
+			transform_lanes::Lanes world[4][4];
+			if (dirty[batch]) {
+				computeWorld(batch, world);
+				dirty[batch] = 0;
+				worlds += BATCH;
+			}
+			else
+				loadWorld(batch, world);
+			computeMvp(batch, world);
+			mvps += BATCH;
+		}
+	}
+
+	// last step of an update, with the counts of every UpdateBatches call summed
+	void EndUpdate(size_t worlds, size_t mvps)
+	{
+		updatedWorlds = worlds;
+		updatedMvps = mvps;
+	}
+
+	size_t Count() const { return count; }
+	size_t Batches() const { return dirty.size(); }
+	const glm::mat4& World(Handle handle) const { return worlds[handle]; }
+	// inverse transpose of the world matrix's upper 3x3 (translation cleared), for transforming normals
+	const glm::mat4& Normal(Handle handle) const { return normals[handle]; }
+	const glm::mat4& Mvp(Handle handle) const { return mvps[handle]; }
+	// contiguous arrays of Count() matrices
+	const glm::mat4* Worlds() const { return worlds.data(); }
+	const glm::mat4* Normals() const { return normals.data(); }
+	const glm::mat4* Mvps() const { return mvps.data(); }
+
+	// world-space bounds as SoA arrays padded to whole batches: sphere (center, radius) and box (center, extent)
+	const float* BoundsCenter(int axis) const { return boundsCenter[axis].data(); }
+	const float* BoundsExtent(int axis) const { return boundsExtent[axis].data(); }
+	const float* BoundsRadius() const { return boundsRadius.data(); }
+
+	// objects whose world matrix / MVP the last Update recomputed (whole batches, so rounded up to BATCH)
+	size_t UpdatedWorlds() const { return updatedWorlds; }
+	size_t UpdatedMvps() const { return updatedMvps; }
+
+private:
+	// SoA inputs, padded to whole batches: position xyz, rotation quaternion xyzw, scale xyz and its reciprocal
+	std::vector<float> position[3];
+	std::vector<float> rotation[4];
+	std::vector<float> scale[3];
+	std::vector<float> inverseScale[3];
+	std::vector<float> localCenter[3];	// model-space bounds
+	std::vector<float> localExtent[3];
+	std::vector<float> localRadius;
+	std::vector<uint8_t> dirty;		// one flag per batch
+	// world-space bounds
+	std::vector<float> boundsCenter[3];
+	std::vector<float> boundsExtent[3];
+	std::vector<float> boundsRadius;
+	// AoS outputs, padded like the inputs
+	std::vector<glm::mat4> worlds;
+	std::vector<glm::mat4> normals;
+	std::vector<glm::mat4> mvps;
+	size_t count = 0;
+	glm::mat4 lastViewProjection;
+	bool hasViewProjection = false;
+	bool cameraMoved = false;	// set by BeginUpdate
+	size_t updatedWorlds = 0;
+	size_t updatedMvps = 0;
+
+	// adds one batch of identity transforms
+	void grow()
+	{
+		size_t size = dirty.size() * BATCH + BATCH;
+		for (int k = 0; k < 3; ++k) {
+			position[k].resize(size, 0.0f);
+			scale[k].resize(size, 1.0f);
+			inverseScale[k].resize(size, 1.0f);
+			localCenter[k].resize(size, 0.0f);
+			localExtent[k].resize(size, TRANSFORM_UNBOUNDED);
+			boundsCenter[k].resize(size, 0.0f);
+			boundsExtent[k].resize(size, TRANSFORM_UNBOUNDED);
+		}
+		localRadius.resize(size, TRANSFORM_UNBOUNDED);
+		boundsRadius.resize(size, TRANSFORM_UNBOUNDED);
+		for (int k = 0; k < 4; ++k)
+			rotation[k].resize(size, k == 3 ? 1.0f : 0.0f);
+		dirty.push_back(1);
+		worlds.resize(size, glm::mat4(1.0f));
+		normals.resize(size, glm::mat4(1.0f));
+		mvps.resize(size, glm::mat4(1.0f));
+	}
+
+	void markDirty(Handle handle)
+	{
+		dirty[handle / BATCH] = 1;
+	}
+
+	// writes four objects' matrices from lane form (column c, row r in m[c][r]) to the AoS array
+	static void storeMatrices(transform_lanes::Lanes m[4][4], glm::mat4* destination)
+	{
+		for (int c = 0; c < 4; ++c) {
+			transform_lanes::Lanes column[4] = { m[c][0], m[c][1], m[c][2], m[c][3] };
+			transform_lanes::Transpose(column[0], column[1], column[2], column[3]);
+			for (size_t lane = 0; lane < BATCH; ++lane)
+				transform_lanes::Store(&destination[lane][c][0], column[lane]);
+		}
+	}
+
+	void loadWorld(size_t batch, transform_lanes::Lanes world[4][4]) const
+	{
+		const glm::mat4* source = &worlds[batch * BATCH];
+		for (int c = 0; c < 4; ++c) {
+			for (size_t lane = 0; lane < BATCH; ++lane)
+				world[c][lane] = transform_lanes::Load(&source[lane][c][0]);
+			transform_lanes::Transpose(world[c][0], world[c][1], world[c][2], world[c][3]);
+		}
+	}
+
+	// world = T * R * S and normal = R * S^-1, which is the inverse transpose of R * S without a general inverse.
+	// The box's world extent along each axis is |world 3x3| * extent; the sphere scales by the largest scale
+	void computeWorld(size_t batch, transform_lanes::Lanes world[4][4])
+	{
+		using namespace transform_lanes;
+		const size_t first = batch * BATCH;
+		Lanes x = Load(&rotation[0][first]);
+		Lanes y = Load(&rotation[1][first]);
+		Lanes z = Load(&rotation[2][first]);
+		Lanes w = Load(&rotation[3][first]);
+		Lanes two = Splat(2.0f);
+		Lanes one = Splat(1.0f);
+		Lanes zero = Splat(0.0f);
+
+		Lanes xx = Times(x, x), yy = Times(y, y), zz = Times(z, z);
+		Lanes xy = Times(x, y), xz = Times(x, z), yz = Times(y, z);
+		Lanes wx = Times(w, x), wy = Times(w, y), wz = Times(w, z);
+
+		// rotation matrix of the unit quaternion, r[c][row]
+		Lanes r[3][3] = {
+			{ Minus(one, Times(two, Plus(yy, zz))), Times(two, Plus(xy, wz)), Times(two, Minus(xz, wy)) },
+			{ Times(two, Minus(xy, wz)), Minus(one, Times(two, Plus(xx, zz))), Times(two, Plus(yz, wx)) },
+			{ Times(two, Plus(xz, wy)), Times(two, Minus(yz, wx)), Minus(one, Times(two, Plus(xx, yy))) }
+		};
+
+		Lanes normal[4][4];
+		for (int c = 0; c < 3; ++c) {
+			Lanes s = Load(&scale[c][first]);
+			Lanes inverse = Load(&inverseScale[c][first]);
+			for (int row = 0; row < 3; ++row) {
+				world[c][row] = Times(r[c][row], s);
+				normal[c][row] = Times(r[c][row], inverse);
+			}
+			world[c][3] = zero;
+			normal[c][3] = zero;
+		}
+		for (int row = 0; row < 3; ++row) {
+			world[3][row] = Load(&position[row][first]);
+			normal[3][row] = zero;
+		}
+		world[3][3] = one;
+		normal[3][3] = one;
+
+		storeMatrices(world, &worlds[first]);
+		storeMatrices(normal, &normals[first]);
+
+		Lanes center[3] = { Load(&localCenter[0][first]), Load(&localCenter[1][first]), Load(&localCenter[2][first]) };
+		Lanes extent[3] = { Load(&localExtent[0][first]), Load(&localExtent[1][first]), Load(&localExtent[2][first]) };
+		for (int row = 0; row < 3; ++row) {
+			Lanes worldCenter = world[3][row];
+			Lanes worldExtent = zero;
+			for (int c = 0; c < 3; ++c) {
+				worldCenter = Plus(worldCenter, Times(world[c][row], center[c]));
+				worldExtent = Plus(worldExtent, Times(Abs(world[c][row]), extent[c]));
+			}
+			Store(&boundsCenter[row][first], worldCenter);
+			Store(&boundsExtent[row][first], worldExtent);
+		}
+		Lanes largestScale = Max(Abs(Load(&scale[0][first])), Max(Abs(Load(&scale[1][first])), Abs(Load(&scale[2][first]))));
+		Store(&boundsRadius[first], Times(Load(&localRadius[first]), largestScale));
+	}
+
+	// mvp = viewProjection * world, with the view-projection entries broadcast to every lane
+	void computeMvp(size_t batch, transform_lanes::Lanes world[4][4])
+	{
+		using namespace transform_lanes;
+		const glm::mat4& vp = lastViewProjection;
+		Lanes mvp[4][4];
+		for (int c = 0; c < 4; ++c) {
+			for (int row = 0; row < 4; ++row) {
+				Lanes sum = Times(Splat(vp[0][row]), world[c][0]);
+				sum = Plus(sum, Times(Splat(vp[1][row]), world[c][1]));
+				sum = Plus(sum, Times(Splat(vp[2][row]), world[c][2]));
+				sum = Plus(sum, Times(Splat(vp[3][row]), world[c][3]));
+				mvp[c][row] = sum;
+			}
+		}
+		storeMatrices(mvp, &mvps[batch * BATCH]);
+	}
+};
+#endif
@@ -0,0 +1,119 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs function(worker) once on each of count threads started for the call, the calling thread acting as worker
+// 0, and returns when all of them finished. For one-off jobs such as loading; work that repeats every frame keeps
+// its threads in a WorkerPool instead.
+template <typename Function>
+void ParallelFor(unsigned int count, Function function)
+{
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < count; ++i)
+		workers.emplace_back(function, i);
+	function(0u);
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+// Threads kept for the whole run, so work that repeats every frame does not pay for creating them each time.
+// Run hands one function to every worker and returns once all of them finished it; the calling thread works
+// too, as worker 0, so a pool of one worker runs everything inline without any synchronization.
+class WorkerPool
+{
+public:
+	~WorkerPool() { Stop(); }
+
+	// starts count - 1 threads next to the caller; 0 uses one worker per hardware thread
+	void Start(unsigned int count)
+	{
+		Stop();
+		workerCount = count != 0 ? count : std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int worker = 1; worker < workerCount; ++worker)
+			threads.emplace_back(&WorkerPool::loop, this, worker);
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		started.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+		threads.clear();
+		stopping = false;
+		workerCount = 1;
+	}
+
+	unsigned int Count() const { return workerCount; }
+
+	// calls function(worker) once for every worker, in parallel, and waits for all of them
+	void Run(const std::function<void(unsigned int)>& function)
+	{
+		if (threads.empty()) {
+			function(0u);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &function;
+			pending = static_cast<unsigned int>(threads.size());
+			++generation;
+		}
+		started.notify_all();
+		function(0u);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this] { return pending == 0; });
+		job = nullptr;
+	}
+
+	// the share [first, last) of count items that worker takes, contiguous and as even as possible
+	static void Split(size_t count, unsigned int worker, unsigned int workers, size_t& first, size_t& last)
+	{
+		first = count * worker / workers;
+		last = count * (worker + 1) / workers;
+	}
+
+private:
+	std::vector<std::thread> threads;
+	unsigned int workerCount = 1;
+	std::mutex mutex;
+	std::condition_variable started;	// a job was handed out, or the pool is stopping
+	std::condition_variable finished;	// the last worker finished the job
+	const std::function<void(unsigned int)>* job = nullptr;
+	unsigned int pending = 0;			// workers still running the job
+	unsigned int generation = 0;		// counts jobs, so a worker never runs the same one twice
+	bool stopping = false;
+
+	void loop(unsigned int worker)
+	{
+		unsigned int seen = 0;
+		for (;;) {
+			const std::function<void(unsigned int)>* current;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				started.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+				current = job;
+			}
+			(*current)(worker);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--pending == 0)
+					finished.notify_one();
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,8 @@
+// Camera uniform block every program shares (std140, binding point 0); matches CameraBlock in Source.cpp
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec4 cameraPosition;
+	vec4 frustumPlanes[6];	// left, right, bottom, top, near, far; normals point inside
+};
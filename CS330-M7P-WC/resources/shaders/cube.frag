@@ -0,0 +1,45 @@
+#version 440 core
+// Lit cube fragment shader: Phong lighting (ambient, diffuse and specular)
+
+in vec3 vertexNormal;		// For incoming normals
+in vec3 vertexFragmentPos;	// For incoming fragment position
+out vec4 fragmentColor;		// For outgoing cube color to the GPU
+
+// Uniform / Global variables for object color, light color, and light position
+uniform vec3 objectColor;
+uniform vec3 lightColor;
+uniform vec3 lightPos;
+// Camera/view position comes from the shared camera uniform block (std140, binding point 0), updated once per frame for every program
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec4 cameraPosition;
+};
+
+void main() {
+	//Phong lighting model calculations to generate ambient, diffuse, and specular components
+	//Calculate Ambient lighting
+	float ambientStrength = 0.1f; // Set ambient or global lighting strength
+	vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+
+	//Calculate Diffuse lighting
+	vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+	vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+	float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
+	vec3 diffuse = impact * lightColor; // Generate diffuse light color
+
+	//Calculate Specular lighting
+	float specularIntensity = 0.8f; // Set specular light strength
+	float highlightSize = 16.0f; // Set specular highlight size
+	vec3 viewDir = normalize(cameraPosition.xyz - vertexFragmentPos); // Calculate view direction
+	vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
+
+	//Calculate specular component
+	float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+	vec3 specular = specularIntensity * specularComponent * lightColor;
+
+	// Calculate phong result
+	vec3 phong = (ambient + diffuse + specular) * objectColor;
+	fragmentColor = vec4(phong, 1.0f); // Send lighting results to GPU
+}
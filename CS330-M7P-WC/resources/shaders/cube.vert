@@ -0,0 +1,19 @@
+#version 440 core
+// Lit cube vertex shader: world-space position and normal for the Phong fragment shader
+
+layout(location = 0) in vec3 position;	// VAP position 0 for vertex position data
+layout(location = 1) in vec3 normal;	// VAP position 1 for normals
+out vec3 vertexNormal;					// For outgoing normals to fragment shader
+out vec3 vertexFragmentPos;				// For outgoing color / pixels to fragment shader
+
+// Uniform / Global variables for the  transform matrices (computed on the CPU once per object, not per vertex)
+uniform mat4 model;
+uniform mat4 mvp;				// projection * view * model
+uniform mat3 normalMatrix;		// inverse transpose of the model matrix's upper 3x3
+#include "camera.glsl"
+
+void main() {
+	gl_Position = mvp * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+	vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+	vertexNormal = normalMatrix * normal; // get normal vectors in world space only and exclude normal translation properties
+}
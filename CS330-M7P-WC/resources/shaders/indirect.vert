@@ -0,0 +1,27 @@
+#version 440 core
+// Multi-draw-indirect vertex shader: transform, tint and texture layer come from the per-draw storage buffer
+
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in float textureLayer;	// texture array layer of the vertex's material
+layout(location = 10) in uint drawIndex;		// index of this draw (divisor 1, offset by the command's baseInstance)
+out vec3 vertexTextureCoordinate;				// texture coordinate plus array layer
+out vec4 vertexTint;
+
+// Per-draw data (std430, binding point 1), one element per indirect command
+struct DrawData {
+	mat4 world;
+	vec4 tint;
+	float layer;	// replaces the vertex's layer unless it is negative
+};
+layout(std430, binding = 1) readonly buffer DrawBlock {
+	DrawData draws[];
+};
+#include "camera.glsl"
+
+void main() {
+	DrawData draw = draws[drawIndex];
+	gl_Position = viewProjection * draw.world * vec4(position, 1.0f); // transforms vertices to clip coordinates
+	vertexTextureCoordinate = vec3(textureCoordinate, draw.layer < 0.0f ? textureLayer : draw.layer);
+	vertexTint = draw.tint;
+}
@@ -0,0 +1,11 @@
+#version 440 core
+// Instanced and multi-draw textured mesh fragment shader: the material's texture array layer times the tint
+
+in vec3 vertexTextureCoordinate;
+in vec4 vertexTint;
+out vec4 fragmentColor;
+uniform sampler2DArray textures;	// one layer per material
+
+void main() {
+	fragmentColor = texture(textures, vertexTextureCoordinate) * vertexTint;
+}
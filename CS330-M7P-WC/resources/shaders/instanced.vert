@@ -0,0 +1,19 @@
+#version 440 core
+// Instanced textured mesh vertex shader: transform, tint and texture layer come from per-instance attributes
+
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in float textureLayer;	// texture array layer of the vertex's material
+// per-instance attributes (glVertexAttribDivisor 1)
+layout(location = 4) in mat4 instanceWorld;	// locations 4-7
+layout(location = 8) in vec4 instanceTint;
+layout(location = 9) in float instanceLayer;	// replaces the vertex's layer unless it is negative
+out vec3 vertexTextureCoordinate;				// texture coordinate plus array layer
+out vec4 vertexTint;
+#include "camera.glsl"
+
+void main() {
+	gl_Position = viewProjection * instanceWorld * vec4(position, 1.0f); // transforms vertices to clip coordinates
+	vertexTextureCoordinate = vec3(textureCoordinate, instanceLayer < 0.0f ? textureLayer : instanceLayer);
+	vertexTint = instanceTint;
+}
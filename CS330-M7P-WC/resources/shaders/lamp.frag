@@ -0,0 +1,9 @@
+#version 440 core
+// Lamp fragment shader: plain white
+
+out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
+#include "camera.glsl"
+
+void main() {
+	fragmentColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+}
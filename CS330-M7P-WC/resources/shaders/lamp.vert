@@ -0,0 +1,10 @@
+#version 440 core
+// Lamp vertex shader (the small cube marking the light position)
+
+layout(location = 0) in vec3 position; // VAP position 0 for vertex position data transform matrices
+uniform mat4 mvp;	// projection * view * model
+#include "camera.glsl"
+
+void main() {
+	gl_Position = mvp * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+}
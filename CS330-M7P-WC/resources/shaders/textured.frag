@@ -0,0 +1,12 @@
+#version 440 core
+// Textured mesh fragment shader: one texture array layer per material
+
+in vec3 position;
+in vec3 vertexTextureCoordinate;
+out vec4 fragmentColor;
+uniform sampler2DArray textures;	// one layer per material
+#include "camera.glsl"
+
+void main() {
+	fragmentColor = texture(textures, vertexTextureCoordinate); // Sends texture to the GPU for rendering (the layer selects the material)
+}
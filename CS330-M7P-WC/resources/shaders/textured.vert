@@ -0,0 +1,16 @@
+#version 440 core
+// Textured mesh vertex shader: passes the texture coordinate and texture array layer on
+
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in float textureLayer;	// texture array layer of the vertex's material
+out vec3 vertexTextureCoordinate;				// texture coordinate plus array layer
+
+//Global variables for the transform matrices
+uniform mat4 mvp;	// projection * view * model
+#include "camera.glsl"
+
+void main() {
+	gl_Position = mvp * vec4(position, 1.0f); // transforms vertices to clip coordinates
+	vertexTextureCoordinate = vec3(textureCoordinate, textureLayer);
+}